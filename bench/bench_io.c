@@ -0,0 +1,231 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "data_structures.h"
+#include "newline_scan.h"
+#include "text_editor_functions.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// File I/O throughput benchmark. Compares the old getline/create_new_line
+// loop with the memchr splitter and the block scanner and times loadFromFile
+// end to end on one thread and on every core, then compares the old per-line
+// fprintf save with saveToFile.
+// Usage: ben_bench [megabytes]
+
+static const char *BENCH_FILENAME = "bench_io.txt";
+// Saves go elsewhere: truncating the loaded file would pull it out from
+// under the mapped buffer
+static const char *BENCH_OUTPUT = "bench_io.out";
+
+static double
+now_seconds (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+report (const char *name, size_t bytes, double seconds, size_t lines)
+{
+  printf ("%-28s %8.1f MB/s  %9zu lines  %7.3f s\n", name,
+          bytes / seconds / (1024 * 1024), lines, seconds);
+}
+
+// Lines of 0 to 119 characters, like source code with some blank lines.
+static char *
+make_contents (size_t size)
+{
+  char *contents = malloc (size);
+  unsigned int state = 2463534242u;
+  size_t i = 0;
+
+  while (i < size)
+    {
+      state = state * 1103515245u + 12345u;
+      size_t length = (state >> 16) % 120;
+      for (size_t j = 0; j < length && i < size; j++, i++)
+        {
+          contents[i] = 'a' + (i + j) % 26;
+        }
+      if (i < size)
+        contents[i++] = '\n';
+    }
+
+  return contents;
+}
+
+static size_t
+split_memchr (const char *contents, size_t size)
+{
+  size_t lines = 0;
+  size_t start = 0;
+
+  while (start < size)
+    {
+      const char *newline = memchr (contents + start, '\n', size - start);
+      size_t end = newline ? (size_t)(newline - contents) : size;
+      start = end + 1;
+      lines++;
+    }
+
+  return lines;
+}
+
+static size_t
+split_scanner (const char *contents, size_t size)
+{
+  NewlineScanner scanner;
+  size_t lines = 0;
+  size_t start = 0;
+
+  newline_scanner_init (&scanner, contents, 0, size);
+  while (start < size)
+    {
+      start = newline_scanner_next (&scanner) + 1;
+      lines++;
+    }
+
+  return lines;
+}
+
+// The loader before zero-copy slices: one getline and one gap buffer per
+// line.
+static void
+load_getline (const char *filename, TextBuffer *buffer)
+{
+  FILE *file = fopen (filename, "r");
+  char *line = NULL;
+  size_t capacity = 0;
+  ssize_t length;
+
+  while ((length = getline (&line, &capacity, file)) != -1)
+    {
+      if (length > 0 && line[length - 1] == '\n')
+        line[length - 1] = '\0';
+      insert_line_at_end (buffer, create_new_line (line));
+    }
+  free (line);
+  fclose (file);
+}
+
+// The saver before vectored writes: one copy, one format pass and one free
+// per line, written over the file in place.
+static void
+save_fprintf (const char *filename, const TextBuffer *buffer, int sync)
+{
+  FILE *file = fopen (filename, "w");
+
+  for (Line *line = buffer->head; line != NULL; line = line->next)
+    {
+      char *text = line_to_string (line);
+      fprintf (file, "%s\n", text);
+      free (text);
+    }
+
+  fflush (file);
+  if (sync)
+    fsync (fileno (file));
+  fclose (file);
+}
+
+int
+main (int argc, char *argv[])
+{
+  size_t megabytes = argc > 1 ? strtoul (argv[1], NULL, 10) : 64;
+  size_t size = megabytes * 1024 * 1024;
+  char *contents = make_contents (size);
+  char *copy = malloc (size);
+  memset (copy, 0, size);
+  double start;
+  size_t lines;
+
+  printf ("%zu MB, newline scan: %s\n", megabytes, newline_scan_method ());
+
+  start = now_seconds ();
+  memcpy (copy, contents, size);
+  report ("memcpy (bandwidth)", size, now_seconds () - start, 0);
+  if (memcmp (copy, contents, size) != 0)
+    return 1;
+
+  start = now_seconds ();
+  lines = split_memchr (contents, size);
+  report ("split with memchr", size, now_seconds () - start, lines);
+
+  start = now_seconds ();
+  lines = split_scanner (contents, size);
+  report ("split with block scanner", size, now_seconds () - start, lines);
+
+  FILE *file = fopen (BENCH_FILENAME, "w");
+  fwrite (contents, 1, size, file);
+  fclose (file);
+
+  TextBuffer buffer;
+  init_editor_buffer (&buffer);
+  start = now_seconds ();
+  load_getline (BENCH_FILENAME, &buffer);
+  report ("getline + create_new_line", size, now_seconds () - start,
+          buffer.num_lines);
+  free_editor_buffer (&buffer);
+
+  // Untimed: the pools grow to their working size on the first load, and
+  // later loads reuse what the previous one freed
+  init_editor_buffer (&buffer);
+  loadFromFile (BENCH_FILENAME, &buffer);
+  buffer_load_all (&buffer);
+  free_editor_buffer (&buffer);
+
+  init_editor_buffer (&buffer);
+  buffer.load_threads = 1;
+  start = now_seconds ();
+  loadFromFile (BENCH_FILENAME, &buffer);
+  buffer_load_all (&buffer);
+  double one_thread = now_seconds () - start;
+  report ("loadFromFile, 1 thread", size, one_thread, buffer.num_lines);
+  free_editor_buffer (&buffer);
+
+  long cores = sysconf (_SC_NPROCESSORS_ONLN);
+  char name[32];
+  snprintf (name, sizeof (name), "loadFromFile, %ld threads", cores);
+  init_editor_buffer (&buffer);
+  start = now_seconds ();
+  loadFromFile (BENCH_FILENAME, &buffer);
+  buffer_load_all (&buffer);
+  double all_threads = now_seconds () - start;
+  report (name, size, all_threads, buffer.num_lines);
+  printf ("%-28s %8.2fx\n", "parallel load speedup", one_thread / all_threads);
+
+  // Edit every 16th line so the save sees gap buffers as well as slices
+  size_t number = 0;
+  for (Line *line = buffer.head; line != NULL; line = line->next, number++)
+    {
+      if (number % 16 == 0)
+        line_insert_string_at (line, 0, "edit ");
+    }
+  size_t saved_size = size + (buffer.num_lines + 15) / 16 * 5;
+
+  start = now_seconds ();
+  save_fprintf (BENCH_OUTPUT, &buffer, 0);
+  report ("fprintf per line", saved_size, now_seconds () - start,
+          buffer.num_lines);
+
+  start = now_seconds ();
+  save_fprintf (BENCH_OUTPUT, &buffer, 1);
+  report ("fprintf per line + fsync", saved_size, now_seconds () - start,
+          buffer.num_lines);
+
+  start = now_seconds ();
+  saveToFile (BENCH_OUTPUT, &buffer);
+  report ("saveToFile (writev + fsync)", saved_size, now_seconds () - start,
+          buffer.num_lines);
+  free_editor_buffer (&buffer);
+
+  remove (BENCH_OUTPUT);
+  remove (BENCH_FILENAME);
+  free (copy);
+  free (contents);
+  return 0;
+}
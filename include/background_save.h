@@ -0,0 +1,54 @@
+#ifndef BACKGROUND_SAVE_H
+#define BACKGROUND_SAVE_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "data_structures.h"
+
+// Smaller saves are quick enough to make on the spot
+#define BACKGROUND_SAVE_MIN_BYTES (1024 * 1024)
+// Edited text copied into a snapshot is packed into blocks this large
+#define SAVE_SNAPSHOT_BLOCK (256 * 1024)
+
+typedef struct SnapshotBlock {
+    struct SnapshotBlock *next;
+    size_t used;
+    size_t size;
+    char data[];
+} SnapshotBlock;
+
+// A save written on its own thread from a snapshot of the buffer, so
+// editing goes on while it runs. The snapshot lists the spans of bytes to
+// write: text the file was loaded with is never changed and is written from
+// where it lies, and only edited text is copied into `blocks`.
+typedef struct BackgroundSave {
+    pthread_t thread;
+    int threaded;               // Whether `thread` has to be joined
+    char *filename;
+    char *target;               // filename with symlinks resolved
+    int compressed;
+
+    struct iovec *spans;
+    size_t num_spans;
+    size_t span_capacity;
+    SnapshotBlock *blocks;      // Newest first
+    size_t total;               // Bytes in the spans
+
+    atomic_size_t written;
+    atomic_int done;
+    int status;                 // Set once done: 0, or -1 with `error`
+    int error;
+    struct stat st;             // The saved file, once done
+} BackgroundSave;
+
+BackgroundSave* background_save_start(const char *filename,
+                                      TextBuffer *buffer, int *status);
+int background_save_done(BackgroundSave *save);
+int background_save_progress(BackgroundSave *save);
+int background_save_finish(BackgroundSave *save, TextBuffer *buffer);
+void background_save_free(BackgroundSave *save);
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef BUFFER_ITERATOR_H
+#define BUFFER_ITERATOR_H
+
+#include <stddef.h>
+#include "data_structures.h"
+
+// Streams the bytes of a TextBuffer as contiguous chunks taken straight from
+// line storage, with every line followed by a virtual '\n' (the same bytes
+// saveToFile writes). Chunks are only valid until the buffer is edited.
+//
+// A position is (line, col) with col in [0, length]; col == length sits just
+// before the line's newline. The end of the buffer is (NULL, 0).
+typedef struct {
+    const TextBuffer *buffer;
+    Line *line;
+    size_t col;
+} BufferIterator;
+
+void buffer_iterator_init(BufferIterator *it, const TextBuffer *buffer);
+void buffer_iterator_seek(BufferIterator *it, size_t line_num, size_t col);
+void buffer_iterator_seek_line(BufferIterator *it, Line *line, size_t col);
+void buffer_iterator_seek_end(BufferIterator *it);
+size_t buffer_iterator_offset(const BufferIterator *it);
+
+size_t buffer_iterator_next(BufferIterator *it, const char **chunk);
+size_t buffer_iterator_prev(BufferIterator *it, const char **chunk);
+
+#endif
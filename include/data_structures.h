@@ -3,36 +3,145 @@
 
 #include <stddef.h>
 #include "gap_buffer.h"
+#include "piece_table.h"
 
+// Files at least this large are opened with piece-table storage
+#define PIECE_TABLE_THRESHOLD (64 * 1024 * 1024)
+// Files at least this large are mapped and split into lines on demand
+#define LAZY_LOAD_THRESHOLD (8 * 1024 * 1024)
+// Files at least this large are read on a background thread when the buffer
+// asks for it
+#define ASYNC_LOAD_THRESHOLD (1024 * 1024)
+// Each thread splitting a whole file into lines gets at least this much of it
+#define PARALLEL_LOAD_MIN_BYTES (1024 * 1024)
+#define PARALLEL_LOAD_MAX_THREADS 64
+
+// Line.flags bits, OR-ed over each index subtree so flagged lines can be
+// found without walking the buffer
+#define LINE_NEEDS_COMPACT 0x1u
+#define LINE_DIRTY 0x2u // Changed since the last load or save
+#define LINE_OWNS_STORAGE 0x4u // Text lives in a gap buffer or piece table
+
+struct FileLoader;
+struct Pager;
+
+// The file a buffer was last loaded from or saved to, as it was then. A
+// save to the same unchanged file can skip or patch it.
+typedef struct {
+    int valid;
+    unsigned long long device;
+    unsigned long long inode;
+    unsigned long long size;
+    long long mtime_sec;
+    long mtime_nsec;
+    int compressed;
+} FileIdentity;
+
+typedef enum {
+    STORAGE_GAP_BUFFER,
+    STORAGE_PIECE_TABLE
+} StorageMode;
+
+// A line is stored in one of three ways: as a read-only slice of the file
+// contents (gb and pt both NULL), as a gap buffer once it has been edited, or
+// as a piece table in STORAGE_PIECE_TABLE mode.
 typedef struct Line {
     GapBuffer *gb;
+    PieceTable *pt;
+    const char *text;       // Slice into TextBuffer.store until first edit
+    size_t text_length;
     struct Line *next;
     struct Line *prev;
+    unsigned int flags;
+    size_t saved_length;    // Length on disk, set when LINE_DIRTY is
+
+    // Line index node (see line_index.h)
+    struct Line *parent;
+    struct Line *left;
+    struct Line *right;
+    unsigned int priority;
+    size_t subtree_lines;
+    size_t subtree_bytes;
+    unsigned int subtree_flags;
 } Line;
 
 typedef struct TextBuffer {
     Line *head;
     Line *tail;
+    Line *index_root;
     size_t num_lines;
     Line *current_line_node;
     size_t current_col_offset;
+
+    // Position of current_line_node, kept in step by sync_cursor_position()
+    // and by every structural edit so the status bar never walks the buffer
+    Line *cursor_line;
+    size_t cursor_line_number;      // 0-based
+    size_t cursor_line_offset;      // Byte offset of the start of cursor_line
+
+    StorageMode storage_mode;
+    int lazy_load;              // Map the file and split lines on demand
+    int async_load;             // Load large files in the background
+    int load_threads;           // Threads splitting a whole file into lines
+                                // (0: one per core)
+    PieceStore *store;          // File contents behind slice and piece-table
+                                // lines (can be NULL)
+    size_t scan_offset;         // Bytes of store already split into lines
+    struct FileLoader *loader;  // Still filling store (can be NULL)
+    struct Pager *pager;        // Memory budget of a mapped store (can be
+                                // NULL)
+
+    int compressed;             // Saves write gzip; set when a gzip file
+                                // is loaded
+    int lines_changed;          // Lines added or removed since load or save
+    int load_error;             // errno of a read that failed, so the
+                                // buffer is not the whole file (0 if none)
+    FileIdentity disk;
+    FileIdentity partial;       // The file that load only got part of,
+                                // which saves must not replace
 } TextBuffer;
 
 void init_editor_buffer(TextBuffer *buffer);
 Line* create_new_line(const char *content);
+Line* create_new_line_bytes(const char *content, size_t length);
 Line* create_new_line_empty();
+Line* create_new_line_from_store(PieceStore *store, size_t start, size_t length);
+Line* create_new_line_slice(const char *text, size_t length);
+void free_line(Line *line);
 void insert_line_after(TextBuffer *buffer, Line *prev_line, Line *new_line);
 void insert_line_after_buffer(TextBuffer *buffer, Line *prev_line, Line *new_line);
 void insert_line_at_beginning(TextBuffer *buffer, Line *new_line);
 void free_editor_buffer(TextBuffer *buffer);
 void insert_line_at_end(TextBuffer *buffer, Line *new_line);
+void remove_line(TextBuffer *buffer, Line *line);
+
+int buffer_is_loaded(const TextBuffer *buffer);
+void buffer_ensure_lines(TextBuffer *buffer, size_t count);
+void buffer_load_all(TextBuffer *buffer);
+Line* buffer_next_line(TextBuffer *buffer, Line *line);
+int buffer_poll_load(TextBuffer *buffer, size_t max_lines);
+int buffer_load_progress(const TextBuffer *buffer);
+size_t buffer_page_out(TextBuffer *buffer, const size_t *hot_lines, size_t num_hot);
+
+void sync_cursor_position(TextBuffer *buffer);
+void refresh_cursor_position(TextBuffer *buffer);
+size_t get_cursor_line_number(const TextBuffer *buffer);
+size_t get_cursor_byte_offset(const TextBuffer *buffer);
 
 size_t line_get_length(const Line *line);
 char line_get_char_at(const Line *line, size_t position);
 char* line_to_string(const Line *line);
+size_t line_span_at(const Line *line, size_t col, const char **span);
+size_t line_span_before(const Line *line, size_t col, const char **span);
 void line_insert_char_at(Line *line, size_t position, char c);
 void line_insert_string_at(Line *line, size_t position, const char *str);
 void line_delete_char_at(Line *line, size_t position);
 void line_delete_char_before(Line *line, size_t position);
+void line_truncate(Line *line, size_t position);
+void line_replace_bytes(Line *line, size_t position, size_t delete_count, const char *bytes, size_t length);
+
+size_t buffer_compact_lines(TextBuffer *buffer, size_t max_lines);
+
+Line* buffer_replace_range(TextBuffer *buffer, Line *start_line, size_t start_col, Line *end_line, size_t end_col, const char *text, size_t length, size_t *end_col_out);
 
 #endif
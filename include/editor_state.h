@@ -2,7 +2,13 @@
 #define EDITOR_STATE_H
 
 #include "data_structures.h"
+#include "follow.h"
+#include "screen_damage.h"
+#include <stdint.h>
 
+struct BackgroundSave;
+struct FileFollower;
+struct Journal;
 
 typedef enum {
     MODE_NORMAL,
@@ -17,10 +23,23 @@ typedef struct {
     int line_wrap_enabled;
     char temp_message[256];         // Temporary status messages
     const char *filename;           // (can be NULL)
+    struct Journal *journal;        // Edits since the last save (can be
+                                    // NULL)
+    struct FileFollower *follower;  // Set by :follow (can be NULL)
+    struct BackgroundSave *save;    // Save still being written (can be
+                                    // NULL)
+    uint64_t save_journal_position; // Log position when `save` began
+    ScreenDamage screen;            // What the text rows show
 } EditorState;
 
 void init_editor_state(EditorState *state, const char *filename);
 void free_editor_state(EditorState *state);
+void report_load_error(EditorState *state);
+void open_editor_journal(EditorState *state);
+void close_editor_journal(EditorState *state);
+int start_following(EditorState *state);
+void stop_following(EditorState *state);
+FollowStatus poll_following(EditorState *state, size_t *appended);
 
 void set_temp_message(EditorState *state, const char *message);
 void clear_temp_message(EditorState *state);
@@ -0,0 +1,43 @@
+#ifndef FILE_LOADER_H
+#define FILE_LOADER_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include "gzip_file.h"
+
+#define FILE_LOADER_CHUNK (256 * 1024)
+
+// Fills a buffer with a file's contents on a background thread. `loaded`
+// only ever grows and is published with release ordering, so the bytes below
+// it can be read without locking while the rest is still being written. A
+// read that fails ends the load with its errno in `error`, which is set
+// before `done` is.
+//
+// A gzip file is inflated into the buffer instead, which is sized from the
+// trailer. Whatever a file holds past that size goes to `overflow`, for the
+// owner of the buffer to append once the load is done.
+typedef struct FileLoader {
+    pthread_t thread;
+    int fd;
+    char *contents;
+    size_t size;
+    int threaded;               // Whether `thread` has to be joined
+    int error;
+    GzipReader *gzip;
+    char *overflow;
+    size_t overflow_length;
+    atomic_size_t loaded;
+    atomic_int done;
+    atomic_int cancel;
+} FileLoader;
+
+FileLoader* file_loader_start(int fd, char *contents, size_t size);
+FileLoader* file_loader_start_gzip(int fd, char *contents, size_t size);
+size_t file_loader_available(FileLoader *loader);
+int file_loader_done(FileLoader *loader);
+int file_loader_error(FileLoader *loader);
+void file_loader_wait(FileLoader *loader);
+void file_loader_destroy(FileLoader *loader);
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef FOLLOW_H
+#define FOLLOW_H
+
+#include "data_structures.h"
+#include <sys/types.h>
+
+// Most bytes appended to the buffer per poll; a bigger burst of output is
+// taken a chunk at a time so the screen keeps redrawing
+#define FOLLOW_CHUNK (1024 * 1024)
+
+typedef enum {
+    FOLLOW_OK,
+    FOLLOW_TRUNCATED,       // The file is shorter than what was read
+    FOLLOW_GONE,            // The file was deleted or renamed away
+    FOLLOW_ERROR,
+} FollowStatus;
+
+// Appends what gets written to the end of a file to the buffer showing it,
+// as `:follow` does for logs. The file is watched with inotify, so polling
+// a quiet file is one read() that finds no events, and only the bytes past
+// `offset` are ever read.
+typedef struct FileFollower {
+    int fd;
+    int inotify_fd;         // -1 without inotify: every poll checks the size
+    off_t offset;           // Bytes of the file already in the buffer
+    int tail_open;          // The buffer's last line has no newline yet
+    int pending;            // More was written than one chunk
+} FileFollower;
+
+FileFollower* follower_start(const char *filename, TextBuffer *buffer);
+FollowStatus follower_poll(FileFollower *follower, TextBuffer *buffer,
+                           size_t *appended);
+void follower_stop(FileFollower *follower);
+
+#endif
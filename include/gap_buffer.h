@@ -3,11 +3,15 @@
 
 #include <stddef.h>
 
+// Text up to this size lives inside the GapBuffer itself
+#define GAP_BUFFER_INLINE_SIZE 48
+
 typedef struct {
-    char *buffer;
+    char *buffer;           // Points at inline_data until the text outgrows it
     size_t capacity;
     size_t gap_start;
     size_t gap_end;
+    char inline_data[GAP_BUFFER_INLINE_SIZE];
 } GapBuffer;
 
 GapBuffer* gap_buffer_create(size_t initial_capacity);
@@ -18,15 +22,24 @@ size_t gap_buffer_cursor_position(const GapBuffer *gb);
 
 void gap_buffer_insert_char(GapBuffer *gb, char c);
 void gap_buffer_insert_string(GapBuffer *gb, const char *str);
+void gap_buffer_insert_bytes(GapBuffer *gb, const char *bytes, size_t length);
 void gap_buffer_delete_char(GapBuffer *gb);
+void gap_buffer_delete_bytes(GapBuffer *gb, size_t count);
 void gap_buffer_delete_char_before(GapBuffer *gb);
+void gap_buffer_truncate(GapBuffer *gb, size_t position);
 
 size_t gap_buffer_length(const GapBuffer *gb);
 char gap_buffer_get_char_at(const GapBuffer *gb, size_t position);
 char* gap_buffer_to_string(const GapBuffer *gb);
+void gap_buffer_get_spans(const GapBuffer *gb, const char **first, size_t *first_length,
+                          const char **second, size_t *second_length);
+const char* gap_buffer_get_text(GapBuffer *gb);
 
 void gap_buffer_ensure_capacity(GapBuffer *gb, size_t needed_capacity);
 size_t gap_buffer_gap_size(const GapBuffer *gb);
+int gap_buffer_is_inline(const GapBuffer *gb);
+void gap_buffer_compact(GapBuffer *gb);
+int gap_buffer_wants_compact(const GapBuffer *gb);
 
 void gap_buffer_print_debug(const GapBuffer *gb);
 
@@ -0,0 +1,43 @@
+#ifndef GZIP_FILE_H
+#define GZIP_FILE_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <zlib.h>
+
+#define GZIP_CHUNK (256 * 1024)
+
+// Inflates a gzip file a few bytes or a few megabytes at a time, so a file
+// can be shown before all of it has been read.
+typedef struct {
+    z_stream stream;
+    int fd;
+    off_t offset;
+    unsigned char *in;
+    size_t members;
+    int finished;
+} GzipReader;
+
+// Streams text into a gzip file. Output is handed to the file descriptor
+// one GZIP_CHUNK at a time, so memory use does not depend on the size of
+// the text.
+typedef struct {
+    z_stream stream;
+    int fd;
+    unsigned char *out;
+} GzipWriter;
+
+int gzip_detect(FILE *file);
+size_t gzip_size_hint(FILE *file);
+char* gzip_read_contents(FILE *file, size_t *size);
+
+int gzip_reader_init(GzipReader *reader, int fd);
+ssize_t gzip_reader_read(GzipReader *reader, char *out, size_t space);
+void gzip_reader_end(GzipReader *reader);
+
+int gzip_writer_init(GzipWriter *writer, int fd);
+int gzip_writer_write(GzipWriter *writer, const char *bytes, size_t length);
+int gzip_writer_finish(GzipWriter *writer);
+
+#endif
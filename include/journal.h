@@ -0,0 +1,66 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "data_structures.h"
+
+#define JOURNAL_MAGIC "BENJRNL1"
+// Line number of an edit with no target line (a line inserted at the top)
+#define JOURNAL_NO_LINE UINT64_MAX
+
+// Identifies the file contents the records apply to.
+typedef struct {
+    char magic[8];
+    uint64_t device;
+    uint64_t inode;
+    uint64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+} JournalHeader;
+
+// Followed by `length` bytes of data.
+typedef struct {
+    uint32_t checksum;          // crc32 of the rest of the record and data
+    uint32_t length;
+    uint64_t line;
+    uint64_t column;
+    uint8_t type;
+    uint8_t padding[7];
+} JournalRecord;
+
+// Append-only log of the edits made since the file was last saved, next to
+// the file as .name.ben-journal. Recording an edit only copies it into
+// `pending`; a background thread writes whatever has piled up and syncs it
+// with one fdatasync, so records arriving during a sync are committed
+// together by the next one. Saving truncates the log back to its header,
+// keeping only edits made after the saved contents were taken.
+typedef struct Journal {
+    int fd;
+    char *path;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;        // Records are pending or the log is closing
+    pthread_cond_t idle;        // The thread finished a write
+    char *pending;
+    size_t pending_length;
+    size_t pending_capacity;
+    uint64_t logged;            // Bytes of records after the header,
+                                // written or pending
+    int writing;
+    int stop;
+    int failed;                 // A write failed; records are dropped
+} Journal;
+
+Journal* journal_open(const char *filename, TextBuffer *buffer,
+                      size_t *replayed);
+void journal_record(Journal *journal, int type, uint64_t line,
+                    uint64_t column, const char *data, size_t length);
+uint64_t journal_position(Journal *journal);
+int journal_checkpoint(Journal *journal, const FileIdentity *disk);
+int journal_checkpoint_at(Journal *journal, const FileIdentity *disk,
+                          uint64_t position);
+void journal_close(Journal *journal, int discard);
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef LINE_INDEX_H
+#define LINE_INDEX_H
+
+#include <stddef.h>
+#include "data_structures.h"
+
+// Order-statistics treap threaded through the Line nodes of a TextBuffer.
+// The linked list stays the source of truth for in-order traversal; the tree
+// answers "which line is number N" and "what number is this line" in
+// O(log n). Line numbers are 0-based.
+
+void line_index_init_node(Line *line);
+void line_index_insert_after(TextBuffer *buffer, Line *prev_line, Line *new_line);
+void line_index_remove(TextBuffer *buffer, Line *line);
+void line_index_build(TextBuffer *buffer);
+
+void line_index_update(Line *line);
+
+Line* line_index_find(const TextBuffer *buffer, size_t line_num);
+Line* line_index_find_flagged(const TextBuffer *buffer, size_t from, unsigned int flags);
+size_t line_index_position(const Line *line);
+size_t line_index_byte_offset(const Line *line);
+size_t line_index_total_bytes(const TextBuffer *buffer);
+int line_index_contains(const TextBuffer *buffer, const Line *line);
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef NEWLINE_SCAN_H
+#define NEWLINE_SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define NEWLINE_SCAN_BLOCK 64
+
+// Finds successive '\n' bytes in data[start, length). Each 64-byte block is
+// compared at once (AVX2 or SSE2 where available, eight bytes at a time
+// otherwise) and its newlines are handed out from a bit mask, so short lines
+// cost a few instructions each instead of a memchr call.
+typedef struct {
+    const char *data;
+    size_t length;
+    size_t block;           // Offset of the block `mask` describes
+    uint64_t mask;          // Newlines in that block not yet returned
+} NewlineScanner;
+
+void newline_scanner_init(NewlineScanner *scanner, const char *data,
+                          size_t start, size_t length);
+size_t newline_scanner_next(NewlineScanner *scanner);
+const char* newline_scan_method(void);
+
+#endif
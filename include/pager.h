@@ -0,0 +1,60 @@
+#ifndef PAGER_H
+#define PAGER_H
+
+#include <stddef.h>
+
+#define PAGER_WINDOW_SIZE (1024 * 1024)
+#define PAGER_SPILL_SEGMENT_SIZE (64 * 1024 * 1024)
+#define PAGER_DEFAULT_BUDGET ((size_t)512 * 1024 * 1024)
+
+// One window of a region. Windows that may have pages in memory are on the
+// pager's LRU list, most recently used first.
+typedef struct PagerWindow {
+    unsigned long last_used;
+    size_t region;              // Index of the region it belongs to
+    int listed;
+    struct PagerWindow *prev;
+    struct PagerWindow *next;
+} PagerWindow;
+
+// A mapping whose pages can be dropped and faulted back in, split into
+// windows that each remember the tick they were last used in.
+typedef struct {
+    char *base;
+    size_t length;
+    PagerWindow *windows;
+    size_t num_windows;
+} PagerRegion;
+
+// Keeps the memory behind a mapped buffer under a budget. Windows of the
+// mapped file that have gone cold are dropped and fault back in from the
+// file when read again. Text that only lives on the heap (edited lines) can
+// be moved to an unlinked spill file mapped the same way, so it can be
+// dropped too. Only windows that were touched or spilled into are counted
+// and dropped, so the cost of a tick follows what was read, not the size of
+// the file.
+typedef struct Pager {
+    size_t budget;
+    unsigned long tick;
+    PagerRegion *regions;       // [0] is the file, then spill segments
+    size_t num_regions;
+    PagerWindow *lru_head;
+    PagerWindow *lru_tail;
+    size_t num_listed;
+    int spill_fd;
+    int pagemap_fd;             // /proc/self/pagemap, or -1
+    size_t spill_used;          // Bytes used in the newest spill segment
+    size_t spilled_bytes;
+} Pager;
+
+Pager* pager_create(char *mapping, size_t length, size_t budget);
+void pager_destroy(Pager *pager);
+
+void pager_begin_tick(Pager *pager);
+void pager_touch(Pager *pager, const char *address, size_t length);
+const char* pager_spill(Pager *pager, const char *bytes, size_t length);
+
+size_t pager_resident_bytes(const Pager *pager);
+size_t pager_evict(Pager *pager, size_t max_resident);
+
+#endif
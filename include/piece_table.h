@@ -0,0 +1,67 @@
+#ifndef PIECE_TABLE_H
+#define PIECE_TABLE_H
+
+#include "pool.h"
+#include <stddef.h>
+
+typedef enum {
+    PIECE_ORIGINAL,
+    PIECE_ADD
+} PieceSource;
+
+typedef struct {
+    PieceSource source;
+    size_t start;           // Offset into the source buffer
+    size_t length;
+} Piece;
+
+// Shared by every line of a buffer: the file contents are never written to,
+// and all inserted text is appended to `add`.
+typedef struct {
+    char *original;
+    size_t original_length;
+    char *add;
+    size_t add_length;
+    size_t add_capacity;
+    int mapped;             // original is an mmap of the file, not malloc'd
+} PieceStore;
+
+typedef struct {
+    PieceStore *store;
+    Piece *pieces;
+    size_t num_pieces;
+    size_t capacity;
+    size_t length;
+} PieceTable;
+
+// Private allocators for creating piece tables on another thread; merged
+// into the shared ones by piece_table_arena_merge() once it is done.
+typedef struct {
+    Pool tables;
+    Pool pieces;
+} PieceTableArena;
+
+PieceStore* piece_store_create(char *original, size_t original_length);
+void piece_store_destroy(PieceStore *store);
+
+PieceTable* piece_table_create(PieceStore *store, size_t start, size_t length);
+void piece_table_arena_init(PieceTableArena *arena);
+PieceTable* piece_table_create_in(PieceTableArena *arena, PieceStore *store,
+                                  size_t start, size_t length);
+void piece_table_arena_merge(PieceTableArena *arena);
+void piece_table_destroy(PieceTable *pt);
+
+size_t piece_table_length(const PieceTable *pt);
+char piece_table_get_char_at(const PieceTable *pt, size_t position);
+char* piece_table_to_string(const PieceTable *pt);
+size_t piece_table_span_at(const PieceTable *pt, size_t position, const char **span);
+size_t piece_table_span_before(const PieceTable *pt, size_t position, const char **span);
+
+void piece_table_insert_char(PieceTable *pt, size_t position, char c);
+void piece_table_insert_string(PieceTable *pt, size_t position, const char *str);
+void piece_table_insert_bytes(PieceTable *pt, size_t position, const char *str, size_t length);
+void piece_table_delete_char(PieceTable *pt, size_t position);
+void piece_table_delete_range(PieceTable *pt, size_t position, size_t count);
+void piece_table_truncate(PieceTable *pt, size_t position);
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+#define POOL_CHUNK_SIZE (64 * 1024)
+#define POOL_MAX_BLOCK_SIZE 256
+
+typedef struct PoolChunk {
+    struct PoolChunk *next;
+} PoolChunk;
+
+// Fixed-size object pool. Objects are carved out of POOL_CHUNK_SIZE chunks
+// and recycled through an intrusive free list; chunks are only returned to
+// the system by pool_release(). A pool registers itself for statistics when
+// it first grows and unregisters on release.
+typedef struct Pool {
+    const char *name;
+    size_t object_size;
+    PoolChunk *chunks;
+    char *bump;                 // Next never-used object in the newest chunk
+    char *bump_end;
+    void *free_list;
+    size_t num_chunks;
+    size_t objects_in_use;
+    struct Pool *next_registered;
+    int registered;
+} Pool;
+
+#define POOL_INITIALIZER(pool_name, size) \
+    { (pool_name), (size), NULL, NULL, NULL, NULL, 0, 0, NULL, 0 }
+
+typedef struct {
+    const char *name;
+    size_t object_size;
+    size_t objects_in_use;
+    size_t objects_reserved;
+    size_t bytes_reserved;
+} PoolStats;
+
+void pool_init(Pool *pool, const char *name, size_t object_size);
+void* pool_alloc(Pool *pool);
+void pool_free(Pool *pool, void *object);
+void pool_release(Pool *pool);
+void pool_adopt(Pool *pool, Pool *from);
+void pool_get_stats(const Pool *pool, PoolStats *stats);
+
+// Size-class allocator for small variable-sized blocks such as line text.
+// *size is rounded up to the class that was used; requests above
+// POOL_MAX_BLOCK_SIZE fall through to malloc. Blocks must be freed with the
+// size returned by the allocation.
+void* pool_alloc_block(size_t *size);
+void pool_free_block(void *block, size_t size);
+size_t pool_block_size(size_t size);
+void pool_adopt_blocks(Pool *from);
+
+size_t pool_collect_stats(PoolStats *stats, size_t max_stats);
+void pool_format_stats(char *out, size_t out_size);
+
+#endif
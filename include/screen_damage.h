@@ -0,0 +1,29 @@
+#ifndef SCREEN_DAMAGE_H
+#define SCREEN_DAMAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SCREEN_HASH_SEED 14695981039346656037ULL
+
+// Remembers what each text row of the screen was last drawn from, so a
+// frame only redraws the rows whose contents changed. A row is summed up as
+// a signature of everything drawn on it. Settings that shape every row (the
+// size of the screen, wrapping, the search) go into the frame signature,
+// and a change there redraws them all.
+typedef struct {
+    uint64_t *rows;         // Signature of each row as last drawn
+    int num_rows;
+    uint64_t frame;
+    int full;               // Every row is redrawn on the next frame
+    int redraw;             // Every row is redrawn on this frame
+} ScreenDamage;
+
+void screen_damage_init(ScreenDamage *damage);
+void screen_damage_free(ScreenDamage *damage);
+void screen_damage_all(ScreenDamage *damage);
+void screen_damage_begin(ScreenDamage *damage, int num_rows, uint64_t frame);
+int screen_damage_row(ScreenDamage *damage, int row, uint64_t signature);
+uint64_t screen_hash(uint64_t hash, const void *data, size_t length);
+
+#endif
@@ -21,8 +21,9 @@ int find_next_match(EditorState *state, SearchState *search_state);
 int find_previous_match(EditorState *state, SearchState *search_state);
 void clear_search(SearchState *search_state);
 
-int search_in_line(const Line *line, const char *term, size_t start_col, int case_sensitive, size_t *match_col);
-int search_in_line_backward(const Line *line, const char *term, size_t start_col, int case_sensitive, size_t *match_col);
+int search_buffer(TextBuffer *buffer, const char *term, int case_sensitive,
+                  Line *line, size_t col, int forward, Line **match_line,
+                  size_t *match_col);
 void jump_to_match(EditorState *state, SearchState *search_state);
 
 char to_lower(char c);
@@ -0,0 +1,12 @@
+#ifndef STARTUP_TIME_H
+#define STARTUP_TIME_H
+
+// Records how long each step of startup takes, for `ben --startuptime`.
+// Every mark writes a line with the time since startup_time_open() and the
+// time since the mark before it, both in milliseconds. Marks are ignored
+// when no report is open, so they can stay on the startup path.
+int startup_time_open(const char *path);
+void startup_time_mark(const char *event);
+void startup_time_finish(const char *event);
+
+#endif
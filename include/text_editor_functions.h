@@ -14,18 +14,19 @@
 
 #define MAX_COMMAND_LENGTH 256
 
-void saveToFile(const char *filename, TextBuffer *buffer);
+int saveToFile(const char *filename, TextBuffer *buffer);
 void loadFromFile(const char *filename, TextBuffer *buffer);
 
-void drawLineNumbers(int visible_lines, const TextBuffer *buffer, int top_line);
-void drawTextContent(int visible_lines, const TextBuffer *buffer, int top_line, int line_wrap_enabled);
+void drawTextRows(int visible_lines, EditorState *state);
 void drawStatusBar(const EditorState *state, const char *command);
 void drawModeIndicator(EditorMode mode, int line_wrap_enabled);
 
-int get_wrapped_line_count(const char *text, int max_width, int line_wrap_enabled);
-void draw_wrapped_line(int row, int col, const char *text, int max_width, int color_pair, int line_wrap_enabled);
-void draw_line_with_search_highlight(int row, int col, const char *text, int max_width,
-                                   int color_pair, int line_wrap_enabled, Line *line_node);
+int get_wrapped_line_count(size_t length, int max_width, int line_wrap_enabled);
+void draw_wrapped_line(int row, int col, const char *text, size_t length, int max_width,
+                       int color_pair, int line_wrap_enabled);
+void draw_line_with_search_highlight(int row, int col, const char *text, size_t length,
+                                   int max_width, int max_rows, int color_pair,
+                                   int line_wrap_enabled, Line *line_node);
 int get_cursor_screen_row(const TextBuffer *buffer, int visible_lines, int top_line, int line_wrap_enabled);
 
 void handleNormalModeInput(int ch, EditorState *state);
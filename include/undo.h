@@ -34,7 +34,10 @@ typedef struct {
 
 extern UndoStack undo_stack;
 
+struct Journal;
+
 void init_undo_system(void);
+void undo_attach_journal(struct Journal *journal);
 void push_undo_operation(UndoType type, Line *target_line, size_t col_pos, const char *data, size_t data_len);
 int can_undo(void);
 int can_redo(void);
@@ -0,0 +1,56 @@
+#ifndef VIEWER_H
+#define VIEWER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "newline_scan.h"
+
+// Lines per entry of the line index
+#define VIEWER_INDEX_STRIDE 64
+#define VIEWER_INPUT_LENGTH 256
+
+// Read-only view of a mapped file, as opened by `ben -R`. There are no Line
+// objects: the only per-line state is the byte offset of every
+// VIEWER_INDEX_STRIDE-th line, found by scanning the mapping as far as the
+// view has reached, and everything drawn or searched is read straight from
+// the mapping.
+typedef struct {
+    const char *filename;
+    const char *data;
+    size_t size;
+
+    uint64_t *checkpoints;      // Start of line k * VIEWER_INDEX_STRIDE
+    size_t num_checkpoints;
+    size_t checkpoint_capacity;
+    size_t num_lines;           // Lines whose start is known so far
+    size_t last_start;          // Start of the last of those
+    int complete;               // Every line is known
+    NewlineScanner scanner;
+
+    size_t top_line;
+    size_t cursor_line;
+    size_t left_col;            // First column shown when not wrapping
+    int line_wrap_enabled;
+
+    char search_term[VIEWER_INPUT_LENGTH];
+    int has_active_search;
+    int case_sensitive;
+    size_t match_offset;        // Byte offset of the current match
+
+    char input[VIEWER_INPUT_LENGTH];
+    char prompt;                // ':', '/' or '?' while typing, else 0
+    char message[256];
+} Viewer;
+
+int viewer_open(Viewer *viewer, const char *filename);
+void viewer_close(Viewer *viewer);
+
+const char* viewer_line(Viewer *viewer, size_t line, size_t *length);
+size_t viewer_count_lines(Viewer *viewer);
+size_t viewer_line_of_offset(Viewer *viewer, size_t offset);
+int viewer_find(const Viewer *viewer, const char *term, size_t from,
+                int forward, size_t *match);
+
+int run_viewer(const char *filename);
+
+#endif
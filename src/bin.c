@@ -7,27 +7,78 @@
 #include "color_config.h"
 #include "data_structures.h"
 #include "editor_state.h"
+#include "startup_time.h"
 #include "text_editor_functions.h"
 #include "undo.h"
+#include "viewer.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
 
 int
 main (int argc, char *argv[])
 {
+  // ben --startuptime out.txt ...: time each step up to the first frame
+  if (argc > 1 && strcmp (argv[1], "--startuptime") == 0)
+    {
+      if (argc < 3)
+        {
+          fprintf (stderr, "Usage: ben --startuptime out.txt [filename]\n");
+          return EXIT_FAILURE;
+        }
+      if (startup_time_open (argv[2]) != 0)
+        {
+          fprintf (stderr, "ben: %s: %s\n", argv[2], strerror (errno));
+          return EXIT_FAILURE;
+        }
+      argc -= 2;
+      argv += 2;
+    }
+
+  // ben -R file: read-only view straight from the mapped file
+  int read_only = argc > 1 && strcmp (argv[1], "-R") == 0;
+  if (read_only && argc < 3)
+    {
+      fprintf (stderr, "Usage: ben -R filename\n");
+      return EXIT_FAILURE;
+    }
+
   initscr ();
+  startup_time_mark ("initscr");
 
   set_escdelay (25);
 
   start_color ();
   init_editor_colors ();
+  startup_time_mark ("init_editor_colors");
   cbreak ();
   keypad (stdscr, TRUE);
   noecho ();
+  // Lets curses scroll the terminal instead of redrawing every row
+  idlok (stdscr, TRUE);
+
+  if (read_only)
+    {
+      int status = run_viewer (argv[2]);
+      int saved_errno = errno;
+      endwin ();
+      if (status != 0)
+        {
+          fprintf (stderr, "ben: %s: %s\n", argv[2], strerror (saved_errno));
+          return EXIT_FAILURE;
+        }
+      return EXIT_SUCCESS;
+    }
 
   EditorState editor_state;
   const char *filename = (argc > 1) ? argv[1] : NULL;
   init_editor_state (&editor_state, filename);
+  startup_time_mark ("init_editor_state");
 
   init_undo_system ();
+  startup_time_mark ("init_undo_system");
+  open_editor_journal (&editor_state);
+  startup_time_mark ("open_editor_journal");
 
   char command[MAX_COMMAND_LENGTH] = "";
 
@@ -37,17 +88,18 @@ main (int argc, char *argv[])
       int max_col = getmaxx (stdscr);
       int visible_lines = max_row - 2;
       int text_width = max_col - 8;
-      clear ();
 
+      // Lazily loaded files are only split as far as the screen reaches
+      buffer_ensure_lines (&editor_state.buffer,
+                           editor_state.top_line + visible_lines + 1);
+      // Only the text rows that changed are drawn again; the top row and
+      // the status bar are cheap, and curses sends the terminal only what
+      // differs from the last frame
+      move (0, 0);
+      clrtoeol ();
       drawModeIndicator (editor_state.current_mode,
                          editor_state.line_wrap_enabled);
-
-      attron (COLOR_PAIR (COLOR_PAIR_LINE_NUMBERS));
-      drawLineNumbers (visible_lines, &editor_state.buffer,
-                       editor_state.top_line);
-      attroff (COLOR_PAIR (COLOR_PAIR_LINE_NUMBERS));
-      drawTextContent (visible_lines, &editor_state.buffer,
-                       editor_state.top_line, editor_state.line_wrap_enabled);
+      drawTextRows (visible_lines, &editor_state);
 
       drawStatusBar (&editor_state, editor_state.current_mode == MODE_COMMAND
                                         ? command
@@ -84,6 +136,7 @@ main (int argc, char *argv[])
 
       move (cursor_screen_row, cursor_screen_col);
       refresh ();
+      startup_time_finish ("first frame");
 
       handleInput (command, &editor_state);
     }
@@ -0,0 +1,96 @@
+#include "buffer_iterator.h"
+#include "line_index.h"
+#include "pager.h"
+
+void
+buffer_iterator_init (BufferIterator *it, const TextBuffer *buffer)
+{
+  it->buffer = buffer;
+  it->line = buffer->head;
+  it->col = 0;
+}
+
+void
+buffer_iterator_seek_line (BufferIterator *it, Line *line, size_t col)
+{
+  it->line = line;
+  it->col = 0;
+
+  if (line != NULL)
+    {
+      size_t length = line_get_length (line);
+      it->col = col < length ? col : length;
+    }
+}
+
+// O(log n) through the line index. Seeking past the last line goes to the end.
+void
+buffer_iterator_seek (BufferIterator *it, size_t line_num, size_t col)
+{
+  buffer_iterator_seek_line (it, line_index_find (it->buffer, line_num), col);
+}
+
+void
+buffer_iterator_seek_end (BufferIterator *it)
+{
+  it->line = NULL;
+  it->col = 0;
+}
+
+// Byte offset of the position from the start of the buffer.
+size_t
+buffer_iterator_offset (const BufferIterator *it)
+{
+  if (it->line == NULL)
+    return line_index_total_bytes (it->buffer);
+
+  return line_index_byte_offset (it->line) + it->col;
+}
+
+// Returns the length of the next chunk and advances past it; 0 at the end.
+// Chunks read from a mapped file are touched in its pager, so whatever is
+// read through an iterator can be paged out again.
+size_t
+buffer_iterator_next (BufferIterator *it, const char **chunk)
+{
+  if (it->line == NULL)
+    return 0;
+
+  if (it->col < line_get_length (it->line))
+    {
+      size_t length = line_span_at (it->line, it->col, chunk);
+      it->col += length;
+      if (it->buffer->pager != NULL)
+        pager_touch (it->buffer->pager, *chunk, length);
+      return length;
+    }
+
+  *chunk = "\n";
+  it->line = it->line->next;
+  it->col = 0;
+  return 1;
+}
+
+// Returns the length of the chunk before the position and moves back over
+// it; 0 at the start. The chunk is returned in forward byte order.
+size_t
+buffer_iterator_prev (BufferIterator *it, const char **chunk)
+{
+  if (it->col > 0)
+    {
+      size_t length = line_span_before (it->line, it->col, chunk);
+      it->col -= length;
+      if (it->buffer->pager != NULL)
+        pager_touch (it->buffer->pager, *chunk, length);
+      return length;
+    }
+
+  Line *prev = it->line ? it->line->prev : it->buffer->tail;
+  if (prev == NULL)
+    return 0;
+
+  *chunk = "\n";
+  it->line = prev;
+  it->col = line_get_length (prev);
+  return 1;
+}
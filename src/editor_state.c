@@ -1,5 +1,12 @@
+#include "background_save.h"
 #include "editor_state.h"
+#include "follow.h"
+#include "journal.h"
+#include "startup_time.h"
 #include "text_editor_functions.h"
+#include "undo.h"
+#include <errno.h>
+#include <stdio.h>
 #include <string.h>
 
 void
@@ -15,10 +22,20 @@ init_editor_state (EditorState *state, const char *filename)
   state->line_wrap_enabled = 1;
   state->temp_message[0] = '\0';
   state->filename = filename;
+  state->journal = NULL;
+  state->follower = NULL;
+  state->save = NULL;
+  state->save_journal_position = 0;
+  screen_damage_init (&state->screen);
 
   if (filename)
     {
+      // Large files keep loading in the background; handleInput() splits
+      // the rest into lines while idle
+      state->buffer.async_load = 1;
       loadFromFile (filename, &state->buffer);
+      startup_time_mark ("loadFromFile");
+      report_load_error (state);
     }
   else
     {
@@ -38,6 +55,8 @@ init_editor_state (EditorState *state, const char *filename)
       state->buffer.current_line_node = state->buffer.head;
       state->buffer.current_col_offset = 0;
     }
+
+  sync_cursor_position (&state->buffer);
 }
 
 void
@@ -46,7 +65,124 @@ free_editor_state (EditorState *state)
   if (!state)
     return;
 
+  // The save points into the buffer until it is written
+  if (state->save)
+    {
+      background_save_finish (state->save, &state->buffer);
+      background_save_free (state->save);
+      state->save = NULL;
+    }
+  stop_following (state);
+  close_editor_journal (state);
   free_editor_buffer (&state->buffer);
+  screen_damage_free (&state->screen);
+}
+
+// Says so on the status bar when the file could not be read to its end.
+// Saves over it are refused, since they would cut off the rest.
+void
+report_load_error (EditorState *state)
+{
+  if (!state || !state->buffer.load_error)
+    return;
+
+  char message[sizeof (state->temp_message)];
+  snprintf (message, sizeof (message),
+            "Could not read all of %s: %s; it cannot be saved over",
+            state->filename ? state->filename : "the file",
+            strerror (state->buffer.load_error));
+  set_temp_message (state, message);
+}
+
+// Starts logging edits to the file being edited, after replaying the log a
+// crash left behind. Needs the undo system, which replay pushes onto. A
+// file that could not be read whole is not logged, so that a log left
+// behind is kept for a load that succeeds.
+void
+open_editor_journal (EditorState *state)
+{
+  if (!state || !state->filename || state->buffer.load_error)
+    return;
+
+  size_t replayed;
+  state->journal = journal_open (state->filename, &state->buffer, &replayed);
+  undo_attach_journal (state->journal);
+
+  if (replayed > 0)
+    {
+      char message[sizeof (state->temp_message)];
+      snprintf (message, sizeof (message),
+                "Recovered %zu edits from the journal", replayed);
+      set_temp_message (state, message);
+    }
+}
+
+// Stops logging and deletes the log: whatever was not saved is being left
+// on purpose.
+void
+close_editor_journal (EditorState *state)
+{
+  if (!state || !state->journal)
+    return;
+
+  undo_attach_journal (NULL);
+  journal_close (state->journal, 1);
+  state->journal = NULL;
+}
+
+// Starts appending what is written to the end of the file to the buffer.
+// Returns nonzero on success; otherwise the reason is left on the status
+// bar.
+int
+start_following (EditorState *state)
+{
+  if (!state || !state->filename)
+    {
+      set_temp_message (state, "No file to follow");
+      return 0;
+    }
+  if (state->buffer.compressed)
+    {
+      set_temp_message (state, "Compressed files cannot be followed");
+      return 0;
+    }
+
+  stop_following (state);
+  state->follower = follower_start (state->filename, &state->buffer);
+  if (!state->follower)
+    {
+      char message[sizeof (state->temp_message)];
+      snprintf (message, sizeof (message), "Cannot follow %s: %s",
+                state->filename,
+                errno == ESTALE ? "file changed since it was loaded"
+                                : strerror (errno));
+      set_temp_message (state, message);
+      return 0;
+    }
+  return 1;
+}
+
+void
+stop_following (EditorState *state)
+{
+  if (!state || !state->follower)
+    return;
+
+  follower_stop (state->follower);
+  state->follower = NULL;
+}
+
+// Appends what was written to the followed file since the last poll. The
+// journal header moves along to the longer file, keeping every record, so
+// that a log left by a crash still replays over it.
+FollowStatus
+poll_following (EditorState *state, size_t *appended)
+{
+  FollowStatus status
+      = follower_poll (state->follower, &state->buffer, appended);
+  if (*appended > 0 && state->journal != NULL)
+    journal_checkpoint_at (state->journal, &state->buffer.disk, 0);
+  return status;
 }
 
 void
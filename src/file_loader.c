@@ -0,0 +1,237 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "file_loader.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Loads the next chunk starting at `offset` and returns its length, or 0 at
+// the end of the file or on a read error, which is kept in loader->error.
+static size_t
+load_chunk (FileLoader *loader, size_t offset)
+{
+  size_t length = loader->size - offset;
+  if (length > FILE_LOADER_CHUNK)
+    length = FILE_LOADER_CHUNK;
+
+  if (loader->gzip)
+    {
+      ssize_t count = gzip_reader_read (loader->gzip,
+                                        loader->contents + offset, length);
+      if (count < 0)
+        {
+          loader->error = errno ? errno : EIO;
+          return 0;
+        }
+      return (size_t)count;
+    }
+
+  ssize_t count;
+  do
+    {
+      count = pread (loader->fd, loader->contents + offset, length,
+                     (off_t)offset);
+    }
+  while (count < 0 && errno == EINTR);
+
+  if (count < 0)
+    {
+      loader->error = errno ? errno : EIO;
+      return 0;
+    }
+  return (size_t)count;
+}
+
+// Inflates what a gzip file holds past the end of the buffer into
+// `overflow`, for a file whose trailer undersold it.
+static void
+load_overflow (FileLoader *loader)
+{
+  size_t capacity = 0;
+  while (!atomic_load_explicit (&loader->cancel, memory_order_relaxed))
+    {
+      if (loader->overflow_length == capacity)
+        {
+          size_t larger = capacity ? capacity * 2 : FILE_LOADER_CHUNK;
+          char *grown = realloc (loader->overflow, larger);
+          if (!grown)
+            {
+              loader->error = ENOMEM;
+              return;
+            }
+          loader->overflow = grown;
+          capacity = larger;
+        }
+
+      ssize_t count = gzip_reader_read (
+          loader->gzip, loader->overflow + loader->overflow_length,
+          capacity - loader->overflow_length);
+      if (count < 0)
+        {
+          loader->error = errno ? errno : EIO;
+          return;
+        }
+      if (count == 0)
+        return;
+      loader->overflow_length += count;
+    }
+}
+
+static void
+load_rest (FileLoader *loader)
+{
+  size_t offset = atomic_load_explicit (&loader->loaded, memory_order_relaxed);
+
+  while (offset < loader->size
+         && !atomic_load_explicit (&loader->cancel, memory_order_relaxed))
+    {
+      size_t length = load_chunk (loader, offset);
+      if (length == 0)
+        break;
+      offset += length;
+      atomic_store_explicit (&loader->loaded, offset, memory_order_release);
+    }
+
+  if (loader->gzip && offset == loader->size && !loader->error)
+    load_overflow (loader);
+
+  atomic_store_explicit (&loader->done, 1, memory_order_release);
+}
+
+static void *
+loader_thread (void *arg)
+{
+  load_rest (arg);
+  return NULL;
+}
+
+static FileLoader *
+loader_create (int fd, char *contents, size_t size)
+{
+  FileLoader *loader = malloc (sizeof (FileLoader));
+  if (!loader)
+    return NULL;
+
+  loader->fd = dup (fd);
+  loader->contents = contents;
+  loader->size = size;
+  loader->threaded = 0;
+  loader->error = 0;
+  loader->gzip = NULL;
+  loader->overflow = NULL;
+  loader->overflow_length = 0;
+  atomic_init (&loader->loaded, 0);
+  atomic_init (&loader->done, 0);
+  atomic_init (&loader->cancel, 0);
+
+  if (loader->fd < 0)
+    {
+      free (loader);
+      return NULL;
+    }
+  return loader;
+}
+
+// Loads the first chunk so the caller always has something to show, then
+// the rest on a thread, or here as well if no thread can be started. A gzip
+// file is only known to be done once the reader has seen its end.
+static FileLoader *
+loader_run (FileLoader *loader)
+{
+  size_t first = load_chunk (loader, 0);
+  atomic_store_explicit (&loader->loaded, first, memory_order_relaxed);
+
+  if (first == 0 || (first == loader->size && !loader->gzip))
+    {
+      atomic_store_explicit (&loader->done, 1, memory_order_relaxed);
+    }
+  else if (pthread_create (&loader->thread, NULL, loader_thread, loader) == 0)
+    {
+      loader->threaded = 1;
+    }
+  else
+    {
+      load_rest (loader);
+    }
+
+  return loader;
+}
+
+// Starts loading `size` bytes of `fd` into `contents`.
+FileLoader *
+file_loader_start (int fd, char *contents, size_t size)
+{
+  FileLoader *loader = loader_create (fd, contents, size);
+  return loader ? loader_run (loader) : NULL;
+}
+
+// Starts inflating the gzip file `fd` into `contents`, which holds the
+// `size` bytes its trailer claims.
+FileLoader *
+file_loader_start_gzip (int fd, char *contents, size_t size)
+{
+  FileLoader *loader = loader_create (fd, contents, size);
+  if (!loader)
+    return NULL;
+
+  loader->gzip = malloc (sizeof (GzipReader));
+  if (!loader->gzip || gzip_reader_init (loader->gzip, loader->fd) != 0)
+    {
+      free (loader->gzip);
+      loader->gzip = NULL;
+      file_loader_destroy (loader);
+      return NULL;
+    }
+  return loader_run (loader);
+}
+
+// Number of bytes from the start of the contents that are ready to read.
+size_t
+file_loader_available (FileLoader *loader)
+{
+  return atomic_load_explicit (&loader->loaded, memory_order_acquire);
+}
+
+int
+file_loader_done (FileLoader *loader)
+{
+  return atomic_load_explicit (&loader->done, memory_order_acquire);
+}
+
+// The errno of the read that ended the load early; 0 while it is still
+// running or once it has read everything.
+int
+file_loader_error (FileLoader *loader)
+{
+  return file_loader_done (loader) ? loader->error : 0;
+}
+
+void
+file_loader_wait (FileLoader *loader)
+{
+  if (loader->threaded)
+    {
+      pthread_join (loader->thread, NULL);
+      loader->threaded = 0;
+    }
+}
+
+// Stops the thread if it is still running. The contents are left to the
+// caller; an overflow it has not taken is freed.
+void
+file_loader_destroy (FileLoader *loader)
+{
+  if (!loader)
+    return;
+
+  atomic_store_explicit (&loader->cancel, 1, memory_order_relaxed);
+  file_loader_wait (loader);
+  if (loader->gzip)
+    {
+      gzip_reader_end (loader->gzip);
+      free (loader->gzip);
+    }
+  free (loader->overflow);
+  close (loader->fd);
+  free (loader);
+}
@@ -1,12 +1,68 @@
-#define _POSIX_C_SOURCE 200809L
+#define _XOPEN_SOURCE 700
 
+#include "background_save.h"
+#include "buffer_iterator.h"
 #include "data_structures.h"
+#include "file_loader.h"
 #include "gap_buffer.h"
+#include "gzip_file.h"
+#include "line_index.h"
+#include "newline_scan.h"
+#include "pager.h"
+#include "pool.h"
 #include "text_editor_functions.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// iovecs handed to each writev when saving; Linux's IOV_MAX
+#define SAVE_IOV_BATCH 1024
+// Lines either side of a line in use that buffer_page_out() keeps resident
+#define PAGE_OUT_HOT_LINES 1024
+
+static Pool line_pool = POOL_INITIALIZER ("lines", sizeof (Line));
+
+// Shifts the cached cursor position when a line lands above it.
+static void
+track_inserted_line (TextBuffer *buffer, Line *new_line)
+{
+  if (buffer->cursor_line == NULL || new_line->next == NULL)
+    return;
+
+  if (new_line->next == buffer->cursor_line
+      || line_index_position (new_line) <= buffer->cursor_line_number)
+    {
+      buffer->cursor_line_number++;
+      buffer->cursor_line_offset += line_get_length (new_line) + 1;
+    }
+}
+
+static void
+track_removed_line (TextBuffer *buffer, Line *line)
+{
+  if (buffer->cursor_line == NULL)
+    return;
+
+  if (line == buffer->cursor_line)
+    {
+      buffer->cursor_line = NULL;
+    }
+  else if (line->next == buffer->cursor_line
+           || line_index_position (line) < buffer->cursor_line_number)
+    {
+      buffer->cursor_line_number--;
+      buffer->cursor_line_offset -= line_get_length (line) + 1;
+    }
+}
 
 void
 insert_line_after (TextBuffer *buffer, Line *prev_line, Line *new_line)
@@ -35,6 +91,10 @@ insert_line_after (TextBuffer *buffer, Line *prev_line, Line *new_line)
     {
       buffer->tail = new_line;
     }
+
+  line_index_insert_after (buffer, prev_line, new_line);
+  track_inserted_line (buffer, new_line);
+  buffer->lines_changed = 1;
 }
 
 void
@@ -63,6 +123,10 @@ insert_line_at_beginning (TextBuffer *buffer, Line *new_line)
 
   buffer->head = new_line;
   buffer->num_lines++;
+
+  line_index_insert_after (buffer, NULL, new_line);
+  track_inserted_line (buffer, new_line);
+  buffer->lines_changed = 1;
 }
 
 void
@@ -73,40 +137,69 @@ init_editor_buffer (TextBuffer *buffer)
 
   buffer->head = NULL;
   buffer->tail = NULL;
+  buffer->index_root = NULL;
   buffer->num_lines = 0;
   buffer->current_line_node = NULL;
   buffer->current_col_offset = 0;
+  buffer->cursor_line = NULL;
+  buffer->cursor_line_number = 0;
+  buffer->cursor_line_offset = 0;
+  buffer->storage_mode = STORAGE_GAP_BUFFER;
+  buffer->lazy_load = 0;
+  buffer->async_load = 0;
+  buffer->load_threads = 0;
+  buffer->store = NULL;
+  buffer->scan_offset = 0;
+  buffer->loader = NULL;
+  buffer->pager = NULL;
+  buffer->compressed = 0;
+  buffer->lines_changed = 0;
+  buffer->load_error = 0;
+  buffer->disk.valid = 0;
+  buffer->partial.valid = 0;
 }
 
 Line *
 create_new_line (const char *content)
 {
-  Line *new_line = (Line *)malloc (sizeof (Line));
+  return create_new_line_bytes (content, strlen (content));
+}
+
+Line *
+create_new_line_bytes (const char *content, size_t length)
+{
+  Line *new_line = pool_alloc (&line_pool);
   if (new_line == NULL)
     {
       perror ("Memory allocation failed");
       exit (EXIT_FAILURE);
     }
 
-  new_line->gb = gap_buffer_create (strlen (content) + 16);
+  new_line->gb = gap_buffer_create (length);
   if (new_line->gb == NULL)
     {
-      free (new_line);
+      pool_free (&line_pool, new_line);
       perror ("Gap buffer creation failed");
       exit (EXIT_FAILURE);
     }
 
-  gap_buffer_insert_string (new_line->gb, content);
+  gap_buffer_insert_bytes (new_line->gb, content, length);
 
+  new_line->pt = NULL;
+  new_line->text = NULL;
+  new_line->text_length = 0;
   new_line->next = NULL;
   new_line->prev = NULL;
+  new_line->flags = LINE_OWNS_STORAGE;
+  new_line->saved_length = 0;
+  line_index_init_node (new_line);
   return new_line;
 }
 
 Line *
 create_new_line_empty ()
 {
-  Line *new_line = (Line *)malloc (sizeof (Line));
+  Line *new_line = pool_alloc (&line_pool);
   if (new_line == NULL)
     {
       perror ("Memory allocation failed");
@@ -116,22 +209,93 @@ create_new_line_empty ()
   new_line->gb = gap_buffer_create (16);
   if (new_line->gb == NULL)
     {
-      free (new_line);
+      pool_free (&line_pool, new_line);
       perror ("Gap buffer creation failed");
       exit (EXIT_FAILURE);
     }
 
+  new_line->pt = NULL;
+  new_line->text = NULL;
+  new_line->text_length = 0;
   new_line->next = NULL;
   new_line->prev = NULL;
+  new_line->flags = LINE_OWNS_STORAGE;
+  new_line->saved_length = 0;
+  line_index_init_node (new_line);
+  return new_line;
+}
+
+// Sets up a line over `length` bytes of the file: a piece table when `pt` is
+// given, else a slice at `text`. The index node is left to the caller.
+static void
+init_store_line (Line *line, PieceTable *pt, const char *text, size_t length)
+{
+  line->gb = NULL;
+  line->pt = pt;
+  line->text = pt ? NULL : text;
+  line->text_length = pt ? 0 : length;
+  line->next = NULL;
+  line->prev = NULL;
+  line->flags = pt ? LINE_OWNS_STORAGE : 0;
+  line->saved_length = 0;
+}
+
+Line *
+create_new_line_from_store (PieceStore *store, size_t start, size_t length)
+{
+  Line *new_line = pool_alloc (&line_pool);
+  if (new_line == NULL)
+    {
+      perror ("Memory allocation failed");
+      exit (EXIT_FAILURE);
+    }
+
+  PieceTable *pt = piece_table_create (store, start, length);
+  if (pt == NULL)
+    {
+      pool_free (&line_pool, new_line);
+      perror ("Piece table creation failed");
+      exit (EXIT_FAILURE);
+    }
+
+  init_store_line (new_line, pt, NULL, length);
+  line_index_init_node (new_line);
+  return new_line;
+}
+
+// The slice is not copied: `text` must outlive the line or be replaced by a
+// gap buffer first (see line_make_writable).
+Line *
+create_new_line_slice (const char *text, size_t length)
+{
+  Line *new_line = pool_alloc (&line_pool);
+  if (new_line == NULL)
+    {
+      perror ("Memory allocation failed");
+      exit (EXIT_FAILURE);
+    }
+
+  init_store_line (new_line, NULL, text, length);
+  line_index_init_node (new_line);
   return new_line;
 }
 
 void
-insert_line_at_end (TextBuffer *buffer, Line *new_line)
+free_line (Line *line)
 {
-  if (!buffer || !new_line)
+  if (!line)
     return;
 
+  gap_buffer_destroy (line->gb);
+  piece_table_destroy (line->pt);
+  pool_free (&line_pool, line);
+}
+
+// Links a line behind the tail without touching the line index; loaders
+// append a whole file this way and build the index once at the end.
+static void
+append_line (TextBuffer *buffer, Line *new_line)
+{
   if (buffer->tail == NULL)
     {
       buffer->head = new_line;
@@ -146,6 +310,119 @@ insert_line_at_end (TextBuffer *buffer, Line *new_line)
   buffer->num_lines++;
 }
 
+void
+insert_line_at_end (TextBuffer *buffer, Line *new_line)
+{
+  if (!buffer || !new_line)
+    return;
+
+  append_line (buffer, new_line);
+  line_index_insert_after (buffer, new_line->prev, new_line);
+  buffer->lines_changed = 1;
+}
+
+void
+remove_line (TextBuffer *buffer, Line *line)
+{
+  if (!buffer || !line)
+    return;
+
+  track_removed_line (buffer, line);
+  line_index_remove (buffer, line);
+
+  if (line->prev != NULL)
+    {
+      line->prev->next = line->next;
+    }
+  else
+    {
+      buffer->head = line->next;
+    }
+
+  if (line->next != NULL)
+    {
+      line->next->prev = line->prev;
+    }
+  else
+    {
+      buffer->tail = line->prev;
+    }
+
+  line->next = NULL;
+  line->prev = NULL;
+  buffer->num_lines--;
+  buffer->lines_changed = 1;
+}
+
+// Moves the cached position onto current_line_node. Stepping to a neighbour
+// is O(1); anything else falls back to an O(log n) index lookup.
+void
+sync_cursor_position (TextBuffer *buffer)
+{
+  if (!buffer)
+    return;
+
+  Line *current = buffer->current_line_node;
+  Line *cached = buffer->cursor_line;
+
+  if (current == cached)
+    return;
+
+  if (current != NULL && cached != NULL && current == cached->next)
+    {
+      buffer->cursor_line_number++;
+      buffer->cursor_line_offset += line_get_length (cached) + 1;
+    }
+  else if (current != NULL && cached != NULL && current == cached->prev)
+    {
+      buffer->cursor_line_number--;
+      buffer->cursor_line_offset -= line_get_length (current) + 1;
+    }
+  else if (current != NULL)
+    {
+      buffer->cursor_line_number = line_index_position (current);
+      buffer->cursor_line_offset = line_index_byte_offset (current);
+    }
+
+  buffer->cursor_line = current;
+}
+
+// For edits that may have changed lines above the cursor (undo, redo)
+void
+refresh_cursor_position (TextBuffer *buffer)
+{
+  if (!buffer)
+    return;
+
+  buffer->cursor_line = NULL;
+  sync_cursor_position (buffer);
+}
+
+size_t
+get_cursor_line_number (const TextBuffer *buffer)
+{
+  if (buffer->current_line_node == NULL)
+    return 0;
+
+  if (buffer->cursor_line == buffer->current_line_node)
+    return buffer->cursor_line_number;
+
+  return line_index_position (buffer->current_line_node);
+}
+
+size_t
+get_cursor_byte_offset (const TextBuffer *buffer)
+{
+  if (buffer->current_line_node == NULL)
+    return 0;
+
+  size_t line_offset = buffer->cursor_line == buffer->current_line_node
+                           ? buffer->cursor_line_offset
+                           : line_index_byte_offset (buffer->current_line_node);
+
+  return line_offset + buffer->current_col_offset;
+}
+
 void
 free_editor_buffer (TextBuffer *buffer)
 {
@@ -157,149 +434,1897 @@ free_editor_buffer (TextBuffer *buffer)
     {
       Line *temp = current;
       current = current->next;
-      gap_buffer_destroy (temp->gb);
-      free (temp);
+      free_line (temp);
     }
+  // Spilled lines pointed into the pager's segments
+  pager_destroy (buffer->pager);
+  buffer->pager = NULL;
+  // The loader may still be writing into the store
+  file_loader_destroy (buffer->loader);
+  buffer->loader = NULL;
+  piece_store_destroy (buffer->store);
+  buffer->store = NULL;
+  buffer->scan_offset = 0;
+  buffer->lines_changed = 0;
+  buffer->load_error = 0;
+  buffer->disk.valid = 0;
+  buffer->partial.valid = 0;
   buffer->head = NULL;
   buffer->tail = NULL;
+  buffer->index_root = NULL;
   buffer->num_lines = 0;
   buffer->current_line_node = NULL;
   buffer->current_col_offset = 0;
+  buffer->cursor_line = NULL;
+  buffer->cursor_line_number = 0;
+  buffer->cursor_line_offset = 0;
 }
 
-void
-saveToFile (const char *filename, TextBuffer *buffer)
+// Writes all of iov, carrying on after short writes.
+static int
+write_iov (int fd, struct iovec *iov, int count)
 {
-  if (!filename || !buffer)
-    return;
+  while (count > 0)
+    {
+      ssize_t written = writev (fd, iov, count);
+      if (written < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          return -1;
+        }
 
-  FILE *file = fopen (filename, "w");
-  if (file == NULL)
+      while (count > 0 && (size_t)written >= iov->iov_len)
+        {
+          written -= iov->iov_len;
+          iov++;
+          count--;
+        }
+      if (count > 0)
+        {
+          iov->iov_base = (char *)iov->iov_base + written;
+          iov->iov_len -= written;
+        }
+    }
+
+  return 0;
+}
+
+// Grows `last` to cover the next chunk when the chunk's bytes already follow
+// it in memory. Unedited lines are slices of the store, where each one is
+// followed by its newline and then by the next line, so runs of them become
+// one write straight from the file contents.
+static int
+extend_iov (struct iovec *last, const char *chunk, size_t length,
+            const PieceStore *store)
+{
+  const char *end = (const char *)last->iov_base + last->iov_len;
+
+  if (chunk == end)
     {
-      return;
+      last->iov_len += length;
+      return 1;
     }
 
-  Line *current_line = buffer->head;
-  while (current_line != NULL)
+  if (store != NULL && length == 1 && *chunk == '\n'
+      && end >= store->original
+      && end < store->original + store->original_length && *end == '\n')
     {
-      char *line_text = line_to_string (current_line);
-      if (line_text)
-        {
-          fprintf (file, "%s\n", line_text);
-          free (line_text);
-        }
-      current_line = current_line->next;
+      last->iov_len++;
+      return 1;
     }
 
-  fclose (file);
+  return 0;
 }
 
-void
-loadFromFile (const char *filename, TextBuffer *buffer)
+// Makes a rename in the directory holding `path` durable.
+static void
+sync_parent_directory (const char *path)
 {
-  if (!filename || !buffer)
-    return;
+  char directory[4096] = ".";
+  const char *slash = strrchr (path, '/');
+  if (slash == path)
+    {
+      strcpy (directory, "/");
+    }
+  else if (slash != NULL && (size_t)(slash - path) < sizeof (directory))
+    {
+      memcpy (directory, path, slash - path);
+      directory[slash - path] = '\0';
+    }
 
-  FILE *file = fopen (filename, "r");
-  if (file == NULL)
+  int fd = open (directory, O_RDONLY);
+  if (fd >= 0)
     {
-      init_editor_buffer (buffer);
-      Line *initial_line = create_new_line_empty ();
-      insert_line_at_end (buffer, initial_line);
-      buffer->current_line_node = initial_line;
-      buffer->current_col_offset = 0;
-      return;
+      fsync (fd);
+      close (fd);
     }
+}
 
-  free_editor_buffer (buffer);
+static void
+record_identity (FileIdentity *identity, const struct stat *st,
+                 int compressed)
+{
+  identity->valid = 1;
+  identity->compressed = compressed;
+  identity->device = st->st_dev;
+  identity->inode = st->st_ino;
+  identity->size = st->st_size;
+  identity->mtime_sec = st->st_mtim.tv_sec;
+  identity->mtime_nsec = st->st_mtim.tv_nsec;
+}
+
+// Whether `st` is still the file the buffer last loaded or saved, untouched
+// by anyone else since.
+static int
+identity_matches (const FileIdentity *identity, const struct stat *st)
+{
+  return identity->valid && identity->device == (unsigned long long)st->st_dev
+         && identity->inode == (unsigned long long)st->st_ino
+         && identity->size == (unsigned long long)st->st_size
+         && identity->mtime_sec == st->st_mtim.tv_sec
+         && identity->mtime_nsec == st->st_mtim.tv_nsec;
+}
+
+static Line *
+next_dirty_line (const TextBuffer *buffer, const Line *line)
+{
+  size_t from = line ? line_index_position (line) + 1 : 0;
+  return line_index_find_flagged (buffer, from, LINE_DIRTY);
+}
+
+// Number of bytes a full save would write: every line plus its newline,
+// with text that has not been split yet counted as it is in the store.
+static unsigned long long
+saved_size (const TextBuffer *buffer)
+{
+  unsigned long long size = line_index_total_bytes (buffer);
+  if (buffer->store != NULL
+      && buffer->scan_offset < buffer->store->original_length)
+    {
+      const char *contents = buffer->store->original;
+      size_t length = buffer->store->original_length;
+      size += length - buffer->scan_offset;
+      if (contents[length - 1] != '\n')
+        size++;
+    }
+  return size;
+}
+
+// A save can overwrite just the dirty lines when every line still has its
+// length on disk and no line was added or removed: then each line sits at
+// the same offset it has in the file. Compressed files never line up.
+static int
+can_patch (const TextBuffer *buffer)
+{
+  if (buffer->lines_changed || buffer->compressed)
+    return 0;
+
+  // Bytes the loader has not read yet cannot be looked at
+  if (buffer->loader != NULL)
+    return 0;
+
+  for (Line *line = next_dirty_line (buffer, NULL); line != NULL;
+       line = next_dirty_line (buffer, line))
+    {
+      if (line_get_length (line) != line->saved_length)
+        return 0;
+    }
 
-  char *line_buffer = NULL;
-  size_t len = 0;
-  ssize_t read;
+  return saved_size (buffer) == buffer->disk.size;
+}
 
-  while ((read = getline (&line_buffer, &len, file)) != -1)
+static int
+pwrite_all (int fd, const char *bytes, size_t length, off_t offset)
+{
+  while (length > 0)
     {
-      if (line_buffer[read - 1] == '\n')
+      ssize_t written = pwrite (fd, bytes, length, offset);
+      if (written < 0)
         {
-          line_buffer[read - 1] = '\0';
+          if (errno == EINTR)
+            continue;
+          return -1;
         }
-      Line *new_line = create_new_line (line_buffer);
-      insert_line_at_end (buffer, new_line);
+      bytes += written;
+      length -= written;
+      offset += written;
     }
+  return 0;
+}
 
-  free (line_buffer);
-  fclose (file);
+// Overwrites the dirty lines of `target` where they are and syncs it. The
+// cost is the size of the edits; unlike a full save it is not atomic.
+static int
+patch_in_place (const char *target, TextBuffer *buffer, struct stat *st)
+{
+  int fd = open (target, O_WRONLY);
+  if (fd < 0)
+    return -1;
 
-  if (buffer->head == NULL)
+  int status = 0;
+  for (Line *line = next_dirty_line (buffer, NULL);
+       line != NULL && status == 0; line = next_dirty_line (buffer, line))
     {
-      Line *initial_line = create_new_line_empty ();
-      insert_line_at_end (buffer, initial_line);
-      buffer->current_line_node = initial_line;
-      buffer->current_col_offset = 0;
+      off_t offset = (off_t)line_index_byte_offset (line);
+      size_t length = line_get_length (line);
+      for (size_t col = 0; col < length && status == 0;)
+        {
+          const char *span;
+          size_t count = line_span_at (line, col, &span);
+          status = pwrite_all (fd, span, count, offset + (off_t)col);
+          col += count;
+        }
     }
-  else
+
+  if (status == 0)
+    status = fsync (fd);
+  if (status == 0)
+    status = fstat (fd, st);
+  if (close (fd) != 0)
+    status = -1;
+  return status;
+}
+
+// Hands line storage to writev directly, SAVE_IOV_BATCH runs of contiguous
+// bytes at a time.
+static int
+write_lines (int fd, TextBuffer *buffer)
+{
+  struct iovec iov[SAVE_IOV_BATCH];
+  int count = 0;
+  int status = 0;
+
+  BufferIterator it;
+  const char *chunk;
+  size_t length;
+
+  buffer_iterator_init (&it, buffer);
+  while (status == 0 && (length = buffer_iterator_next (&it, &chunk)) > 0)
     {
-      buffer->current_line_node = buffer->head;
-      buffer->current_col_offset = 0;
+      if (count > 0
+          && extend_iov (&iov[count - 1], chunk, length, buffer->store))
+        continue;
+
+      iov[count].iov_base = (void *)chunk;
+      iov[count].iov_len = length;
+      if (++count == SAVE_IOV_BATCH)
+        {
+          status = write_iov (fd, iov, count);
+          count = 0;
+        }
     }
+
+  if (status == 0)
+    status = write_iov (fd, iov, count);
+  return status;
 }
 
-size_t
-line_get_length (const Line *line)
+static int
+write_compressed (int fd, TextBuffer *buffer)
 {
-  if (!line || !line->gb)
-    return 0;
-  return gap_buffer_length (line->gb);
+  GzipWriter writer;
+  if (gzip_writer_init (&writer, fd) != 0)
+    return -1;
+
+  BufferIterator it;
+  const char *chunk;
+  size_t length;
+  int status = 0;
+
+  buffer_iterator_init (&it, buffer);
+  while (status == 0 && (length = buffer_iterator_next (&it, &chunk)) > 0)
+    {
+      status = gzip_writer_write (&writer, chunk, length);
+    }
+
+  if (gzip_writer_finish (&writer) != 0)
+    status = -1;
+  return status;
 }
 
-char
-line_get_char_at (const Line *line, size_t position)
+static int
+write_buffer (int fd, void *arg)
 {
-  if (!line || !line->gb)
-    return '\0';
-  return gap_buffer_get_char_at (line->gb, position);
+  TextBuffer *buffer = arg;
+  return buffer->compressed ? write_compressed (fd, buffer)
+                            : write_lines (fd, buffer);
 }
 
-char *
-line_to_string (const Line *line)
+// Writes the new contents to a temporary file next to the target through
+// `write_contents`, syncs it and renames it over the target, so a crash
+// leaves either the old file or the new one and never a truncated mix.
+static int
+replace_file (const char *target, int (*write_contents) (int fd, void *arg),
+              void *arg, struct stat *st)
 {
-  if (!line || !line->gb)
-    return NULL;
-  return gap_buffer_to_string (line->gb);
+  char temp_name[4096];
+  if (snprintf (temp_name, sizeof (temp_name), "%s.XXXXXX", target)
+      >= (int)sizeof (temp_name))
+    {
+      errno = ENAMETOOLONG;
+      return -1;
+    }
+
+  int fd = mkstemp (temp_name);
+  if (fd < 0)
+    return -1;
+
+  // Keep the permissions of the file being replaced; a new file gets the
+  // usual 0666 less the umask instead of mkstemp's 0600
+  mode_t mode;
+  if (stat (target, st) == 0)
+    {
+      mode = st->st_mode & 07777;
+    }
+  else
+    {
+      mode_t mask = umask (0);
+      umask (mask);
+      mode = 0666 & ~mask;
+    }
+
+  int status = fchmod (fd, mode);
+  if (status == 0)
+    status = write_contents (fd, arg);
+  if (status == 0)
+    status = fsync (fd);
+  if (status == 0)
+    status = fstat (fd, st);
+  if (close (fd) != 0)
+    status = -1;
+  if (status == 0)
+    status = rename (temp_name, target);
+
+  if (status == 0)
+    {
+      sync_parent_directory (target);
+    }
+  else
+    {
+      int saved_errno = errno;
+      unlink (temp_name);
+      errno = saved_errno;
+    }
+
+  return status;
 }
 
-void
-line_insert_char_at (Line *line, size_t position, char c)
+// Whether saving to `target` would replace the file a failed load only read
+// part of, cutting off what the buffer never got
+static int
+overwrites_partial_load (const char *target, const TextBuffer *buffer)
 {
-  if (!line || !line->gb)
-    return;
-  gap_buffer_move_cursor_to (line->gb, position);
-  gap_buffer_insert_char (line->gb, c);
+  struct stat st;
+  return buffer->partial.valid && stat (target, &st) == 0
+         && buffer->partial.device == (unsigned long long)st.st_dev
+         && buffer->partial.inode == (unsigned long long)st.st_ino;
 }
 
-void
-line_insert_string_at (Line *line, size_t position, const char *str)
+// Whether `target` is the file the buffer was last loaded from or saved to,
+// unchanged since; `st` is filled in either way when it exists.
+static int
+is_saved_file (const char *target, const TextBuffer *buffer, struct stat *st)
 {
-  if (!line || !line->gb || !str)
-    return;
-  gap_buffer_move_cursor_to (line->gb, position);
-  gap_buffer_insert_string (line->gb, str);
+  return stat (target, st) == 0 && identity_matches (&buffer->disk, st)
+         && buffer->disk.compressed == buffer->compressed;
 }
 
-void
-line_delete_char_at (Line *line, size_t position)
+static int
+has_changes (const TextBuffer *buffer)
 {
-  if (!line || !line->gb)
-    return;
-  gap_buffer_move_cursor_to (line->gb, position);
-  gap_buffer_delete_char (line->gb);
+  return buffer->lines_changed || next_dirty_line (buffer, NULL) != NULL;
 }
 
-void
-line_delete_char_before (Line *line, size_t position)
+// Makes every line clean: the file on disk holds the buffer as it is.
+static void
+mark_saved (TextBuffer *buffer)
 {
-  if (!line || !line->gb || position == 0)
-    return;
-  gap_buffer_move_cursor_to (line->gb, position);
-  gap_buffer_delete_char_before (line->gb);
+  for (Line *line = next_dirty_line (buffer, NULL); line != NULL;
+       line = next_dirty_line (buffer, NULL))
+    {
+      line->flags &= ~LINE_DIRTY;
+      line_index_update (line);
+    }
+  buffer->lines_changed = 0;
+}
+
+// Saves the buffer to `filename`. Nothing is written when the file is the
+// one last loaded or saved and the buffer has not changed since; same-length
+// edits to that file are patched in place; anything else replaces the file
+// atomically. Returns 0 on success and -1 with errno set on failure, in
+// which case a replaced file is left untouched.
+int
+saveToFile (const char *filename, TextBuffer *buffer)
+{
+  if (!filename || !buffer)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+
+  // Write next to the file a symlink points at rather than replacing the
+  // link itself
+  char *resolved = realpath (filename, NULL);
+  const char *target = resolved ? resolved : filename;
+
+  // Whether the load failed is only known once it is over
+  if (buffer->loader != NULL)
+    buffer_load_all (buffer);
+
+  if (overwrites_partial_load (target, buffer))
+    {
+      free (resolved);
+      errno = buffer->load_error;
+      return -1;
+    }
+
+  struct stat st;
+  int status;
+  int same_file = is_saved_file (target, buffer, &st);
+
+  if (same_file && !has_changes (buffer))
+    {
+      free (resolved);
+      return 0;
+    }
+
+  if (same_file && can_patch (buffer))
+    {
+      status = patch_in_place (target, buffer, &st);
+    }
+  else
+    {
+      buffer_load_all (buffer);
+      status = replace_file (target, write_buffer, buffer, &st);
+    }
+
+  if (status == 0)
+    {
+      mark_saved (buffer);
+      record_identity (&buffer->disk, &st, buffer->compressed);
+    }
+
+  free (resolved);
+  return status;
+}
+
+// Adds `length` bytes at `bytes` to the end of the snapshot. Text the file
+// was loaded with is referenced; anything else is copied, since the editor
+// may change or free it while the save runs.
+static int
+snapshot_add (BackgroundSave *save, const char *bytes, size_t length,
+              const PieceStore *store)
+{
+  int stable = store != NULL && bytes >= store->original
+               && bytes + length <= store->original + store->original_length;
+  if (!stable)
+    {
+      SnapshotBlock *block = save->blocks;
+      if (block == NULL || block->size - block->used < length)
+        {
+          size_t size = length > SAVE_SNAPSHOT_BLOCK ? length
+                                                     : SAVE_SNAPSHOT_BLOCK;
+          block = malloc (sizeof (SnapshotBlock) + size);
+          if (!block)
+            return -1;
+          block->next = save->blocks;
+          block->used = 0;
+          block->size = size;
+          save->blocks = block;
+        }
+
+      char *copy = block->data + block->used;
+      memcpy (copy, bytes, length);
+      block->used += length;
+      bytes = copy;
+    }
+
+  save->total += length;
+  if (save->num_spans > 0
+      && extend_iov (&save->spans[save->num_spans - 1], bytes, length, store))
+    return 0;
+
+  if (save->num_spans == save->span_capacity)
+    {
+      size_t capacity = save->span_capacity ? save->span_capacity * 2 : 64;
+      struct iovec *grown
+          = realloc (save->spans, capacity * sizeof (struct iovec));
+      if (!grown)
+        return -1;
+      save->spans = grown;
+      save->span_capacity = capacity;
+    }
+
+  save->spans[save->num_spans].iov_base = (void *)bytes;
+  save->spans[save->num_spans].iov_len = length;
+  save->num_spans++;
+  return 0;
+}
+
+// Lists what a save of the buffer would write: every line and its newline,
+// then whatever of a lazily loaded file has not been split into lines yet.
+static int
+take_snapshot (BackgroundSave *save, TextBuffer *buffer)
+{
+  const PieceStore *store = buffer->store;
+  BufferIterator it;
+  const char *chunk;
+  size_t length;
+
+  buffer_iterator_init (&it, buffer);
+  while ((length = buffer_iterator_next (&it, &chunk)) > 0)
+    {
+      if (snapshot_add (save, chunk, length, store) != 0)
+        return -1;
+    }
+
+  if (store != NULL && buffer->scan_offset < store->original_length)
+    {
+      const char *rest = store->original + buffer->scan_offset;
+      size_t rest_length = store->original_length - buffer->scan_offset;
+      if (snapshot_add (save, rest, rest_length, store) != 0)
+        return -1;
+      if (rest[rest_length - 1] != '\n'
+          && snapshot_add (save, "\n", 1, store) != 0)
+        return -1;
+    }
+
+  return 0;
+}
+
+static int
+write_snapshot (int fd, void *arg)
+{
+  BackgroundSave *save = arg;
+
+  if (save->compressed)
+    {
+      GzipWriter writer;
+      if (gzip_writer_init (&writer, fd) != 0)
+        return -1;
+
+      int status = 0;
+      for (size_t i = 0; i < save->num_spans && status == 0; i++)
+        {
+          status = gzip_writer_write (&writer, save->spans[i].iov_base,
+                                      save->spans[i].iov_len);
+          atomic_fetch_add (&save->written, save->spans[i].iov_len);
+        }
+      if (gzip_writer_finish (&writer) != 0)
+        status = -1;
+      return status;
+    }
+
+  for (size_t i = 0; i < save->num_spans; i += SAVE_IOV_BATCH)
+    {
+      size_t count = save->num_spans - i;
+      if (count > SAVE_IOV_BATCH)
+        count = SAVE_IOV_BATCH;
+
+      size_t bytes = 0;
+      for (size_t j = 0; j < count; j++)
+        {
+          bytes += save->spans[i + j].iov_len;
+        }
+      if (write_iov (fd, save->spans + i, count) != 0)
+        return -1;
+      atomic_fetch_add (&save->written, bytes);
+    }
+  return 0;
+}
+
+static void *
+background_save_thread (void *arg)
+{
+  BackgroundSave *save = arg;
+
+  save->status = replace_file (save->target, write_snapshot, save, &save->st);
+  save->error = errno;
+  atomic_store (&save->done, 1);
+  return NULL;
+}
+
+void
+background_save_free (BackgroundSave *save)
+{
+  while (save->blocks != NULL)
+    {
+      SnapshotBlock *next = save->blocks->next;
+      free (save->blocks);
+      save->blocks = next;
+    }
+  free (save->spans);
+  free (save->filename);
+  free (save->target);
+  free (save);
+}
+
+// Saves `buffer` to `filename` like saveToFile(), but writes the file on a
+// background thread when that is a large job: the snapshot only copies
+// edited text, so the editor can go on at once. Returns the running save,
+// or NULL when the save was done on the spot (small, unchanged or patched
+// in place) or could not be started, with its result in *status.
+BackgroundSave *
+background_save_start (const char *filename, TextBuffer *buffer, int *status)
+{
+  char *resolved = realpath (filename, NULL);
+  const char *target = resolved ? resolved : filename;
+
+  // Bytes the loader has not read yet are not there to point at, and
+  // whether it failed is only known once it is over
+  if (buffer->loader != NULL)
+    buffer_load_all (buffer);
+
+  struct stat st;
+  int same_file = is_saved_file (target, buffer, &st);
+  BackgroundSave *save = NULL;
+  if (!(same_file && (!has_changes (buffer) || can_patch (buffer)))
+      && !overwrites_partial_load (target, buffer)
+      && saved_size (buffer) >= BACKGROUND_SAVE_MIN_BYTES)
+    {
+      save = calloc (1, sizeof (BackgroundSave));
+    }
+  if (save)
+    {
+      save->filename = strdup (filename);
+      save->target = strdup (target);
+      save->compressed = buffer->compressed;
+
+      if (!save->filename || !save->target
+          || take_snapshot (save, buffer) != 0)
+        {
+          background_save_free (save);
+          save = NULL;
+        }
+    }
+  free (resolved);
+
+  if (!save)
+    {
+      *status = saveToFile (filename, buffer);
+      return NULL;
+    }
+
+  // The snapshot has every edit so far; edits from now on are changes to
+  // what is being saved
+  mark_saved (buffer);
+
+  save->threaded = pthread_create (&save->thread, NULL,
+                                   background_save_thread, save)
+                   == 0;
+  if (!save->threaded)
+    background_save_thread (save);
+
+  *status = 0;
+  return save;
+}
+
+int
+background_save_done (BackgroundSave *save)
+{
+  return atomic_load (&save->done);
+}
+
+// Percentage of the file written so far.
+int
+background_save_progress (BackgroundSave *save)
+{
+  if (save->total == 0)
+    return 100;
+  return (int)(atomic_load (&save->written) * 100 / save->total);
+}
+
+// Waits for the save to end. On success the buffer now belongs to the
+// saved file; on failure it counts as changed all over, so the next save
+// writes everything. Returns 0, or -1 with errno set.
+int
+background_save_finish (BackgroundSave *save, TextBuffer *buffer)
+{
+  if (save->threaded)
+    {
+      pthread_join (save->thread, NULL);
+      save->threaded = 0;
+    }
+
+  if (save->status == 0)
+    record_identity (&buffer->disk, &save->st, save->compressed);
+  else
+    buffer->lines_changed = 1;
+
+  errno = save->error;
+  return save->status;
+}
+
+static void
+finish_load (TextBuffer *buffer)
+{
+  line_index_build (buffer);
+
+  if (buffer->head == NULL)
+    {
+      Line *initial_line = create_new_line_empty ();
+      insert_line_at_end (buffer, initial_line);
+      buffer->current_line_node = initial_line;
+      buffer->current_col_offset = 0;
+    }
+  else
+    {
+      buffer->current_line_node = buffer->head;
+      buffer->current_col_offset = 0;
+    }
+}
+
+// Reads the whole file into one allocation. The size reported by ftell is
+// only a hint so that pipes and files that grow while loading still work.
+// Returns NULL with errno set when the file cannot be read to its end.
+static char *
+read_file_contents (FILE *file, size_t *size)
+{
+  size_t capacity = 64 * 1024;
+  size_t length = 0;
+
+  if (fseek (file, 0, SEEK_END) == 0)
+    {
+      long file_size = ftell (file);
+      if (file_size > 0)
+        capacity = (size_t)file_size + 1;
+      rewind (file);
+    }
+
+  char *contents = malloc (capacity);
+  if (!contents)
+    return NULL;
+
+  for (;;)
+    {
+      length += fread (contents + length, 1, capacity - length, file);
+      if (length < capacity)
+        break;
+
+      char *grown = realloc (contents, capacity * 2);
+      if (!grown)
+        {
+          free (contents);
+          errno = ENOMEM;
+          return NULL;
+        }
+      contents = grown;
+      capacity *= 2;
+    }
+
+  if (ferror (file))
+    {
+      free (contents);
+      if (errno == 0)
+        errno = EIO;
+      return NULL;
+    }
+
+  *size = length;
+  return contents;
+}
+
+// Maps a regular file read-only. Returns NULL for pipes, empty files or when
+// mmap fails, so the caller can fall back to reading.
+static char *
+map_file (FILE *file, size_t *size)
+{
+  struct stat st;
+  if (fstat (fileno (file), &st) != 0 || !S_ISREG (st.st_mode)
+      || st.st_size <= 0)
+    return NULL;
+
+  void *mapping = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+                        fileno (file), 0);
+  if (mapping == MAP_FAILED)
+    return NULL;
+
+  *size = st.st_size;
+  return mapping;
+}
+
+// Appends what a gzip loader inflated past the size the trailer claimed.
+// The contents may move, so the slices into them are moved along.
+static int
+take_overflow (TextBuffer *buffer, FileLoader *loader)
+{
+  PieceStore *store = buffer->store;
+  size_t length = store->original_length;
+  uintptr_t old = (uintptr_t)store->original;
+
+  char *grown = realloc (store->original, length + loader->overflow_length);
+  if (grown == NULL)
+    return ENOMEM;
+  memcpy (grown + length, loader->overflow, loader->overflow_length);
+  store->original = grown;
+  store->original_length = length + loader->overflow_length;
+
+  if ((uintptr_t)grown != old)
+    {
+      for (Line *line = buffer->head; line != NULL; line = line->next)
+        {
+          uintptr_t text = (uintptr_t)line->text;
+          if (!line->gb && !line->pt && line->text != NULL && text >= old
+              && text <= old + length)
+            line->text = grown + (text - old);
+        }
+    }
+  return 0;
+}
+
+// Drops the loader once it has finished. A file that shrank while it was
+// being read ends where the reads stopped; one whose reads failed does too,
+// but is kept from being saved over like any other partial load.
+static void
+reap_loader (TextBuffer *buffer)
+{
+  if (buffer->loader == NULL || !file_loader_done (buffer->loader))
+    return;
+
+  buffer->store->original_length = file_loader_available (buffer->loader);
+  int error = file_loader_error (buffer->loader);
+  if (!error && buffer->loader->overflow_length > 0)
+    error = take_overflow (buffer, buffer->loader);
+  if (error)
+    {
+      buffer->load_error = error;
+      buffer->partial = buffer->disk;
+    }
+  file_loader_destroy (buffer->loader);
+  buffer->loader = NULL;
+}
+
+// One thread's share of a parallel load: the lines of store[start, end),
+// allocated from pools of its own and linked into a run that is spliced
+// onto the buffer once every thread is done.
+typedef struct {
+    pthread_t thread;
+    int threaded;               // Whether `thread` has to be joined
+    PieceStore *store;
+    int piece_tables;           // Lines get piece tables, not slices
+    size_t start;
+    size_t end;
+    Pool lines;
+    PieceTableArena tables;
+    Line *head;
+    Line *tail;
+    size_t num_lines;
+    int failed;
+} LoadRun;
+
+static void *
+load_run (void *arg)
+{
+  LoadRun *run = arg;
+  const char *contents = run->store->original;
+  NewlineScanner scanner;
+  newline_scanner_init (&scanner, contents, run->start, run->end);
+
+  size_t start = run->start;
+  while (start < run->end)
+    {
+      size_t end = newline_scanner_next (&scanner);
+      Line *line = pool_alloc (&run->lines);
+      PieceTable *pt = NULL;
+      if (line != NULL && run->piece_tables)
+        {
+          pt = piece_table_create_in (&run->tables, run->store, start,
+                                      end - start);
+        }
+      if (line == NULL || (run->piece_tables && pt == NULL))
+        {
+          run->failed = 1;
+          break;
+        }
+
+      init_store_line (line, pt, contents + start, end - start);
+      if (run->tail != NULL)
+        {
+          run->tail->next = line;
+          line->prev = run->tail;
+        }
+      else
+        {
+          run->head = line;
+        }
+      run->tail = line;
+      run->num_lines++;
+      start = end + 1;
+    }
+
+  return NULL;
+}
+
+// Threads worth splitting `bytes` of a file with.
+static size_t
+load_thread_count (const TextBuffer *buffer, size_t bytes)
+{
+  long threads = buffer->load_threads;
+  if (threads <= 0)
+    {
+      threads = sysconf (_SC_NPROCESSORS_ONLN);
+    }
+
+  size_t most = bytes / PARALLEL_LOAD_MIN_BYTES;
+  if (most > PARALLEL_LOAD_MAX_THREADS)
+    most = PARALLEL_LOAD_MAX_THREADS;
+  if (threads < 1)
+    threads = 1;
+  return (size_t)threads < most ? (size_t)threads : most;
+}
+
+// Splits all of store[start, size) on `threads` threads, each taking a run
+// of whole lines, and links the runs behind the tail in file order. Returns
+// the number of lines added; the index is left for the caller to build.
+static size_t
+scan_lines_parallel (TextBuffer *buffer, size_t start, size_t size,
+                     size_t threads)
+{
+  LoadRun runs[PARALLEL_LOAD_MAX_THREADS];
+  const char *contents = buffer->store->original;
+  size_t run_start = start;
+
+  for (size_t i = 0; i < threads; i++)
+    {
+      // A run ends just past a newline so no line is split between two
+      size_t run_end = size;
+      if (i + 1 < threads)
+        {
+          size_t target = start + (size - start) / threads * (i + 1);
+          if (target < run_start)
+            target = run_start;
+          const char *newline
+              = memchr (contents + target, '\n', size - target);
+          run_end = newline ? (size_t)(newline - contents) + 1 : size;
+        }
+
+      LoadRun *run = &runs[i];
+      memset (run, 0, sizeof (*run));
+      run->store = buffer->store;
+      run->piece_tables = buffer->storage_mode == STORAGE_PIECE_TABLE;
+      run->start = run_start;
+      run->end = run_end;
+      pool_init (&run->lines, "lines", sizeof (Line));
+      piece_table_arena_init (&run->tables);
+      run_start = run_end;
+    }
+
+  // The first run is split on this thread, as is any run whose thread
+  // could not be started
+  for (size_t i = 1; i < threads; i++)
+    {
+      runs[i].threaded
+          = pthread_create (&runs[i].thread, NULL, load_run, &runs[i]) == 0;
+    }
+  load_run (&runs[0]);
+
+  size_t added = 0;
+  for (size_t i = 0; i < threads; i++)
+    {
+      LoadRun *run = &runs[i];
+      if (run->threaded)
+        pthread_join (run->thread, NULL);
+      else if (i > 0)
+        load_run (run);
+
+      if (run->failed)
+        {
+          perror ("Memory allocation failed");
+          exit (EXIT_FAILURE);
+        }
+
+      if (run->head != NULL)
+        {
+          if (buffer->tail != NULL)
+            {
+              buffer->tail->next = run->head;
+              run->head->prev = buffer->tail;
+            }
+          else
+            {
+              buffer->head = run->head;
+            }
+          buffer->tail = run->tail;
+          buffer->num_lines += run->num_lines;
+          added += run->num_lines;
+        }
+
+      pool_adopt (&line_pool, &run->lines);
+      piece_table_arena_merge (&run->tables);
+    }
+
+  buffer->scan_offset = size;
+  return added;
+}
+
+// Splits up to max_lines more lines off the part of buffer->store that has
+// not been scanned yet and links them behind the tail. Every line starts out
+// pointing into the store: a read-only slice in gap-buffer mode or a single
+// piece in piece-table mode, so nothing is copied per line until it is
+// edited. Only indexes the new lines when update_index is set. While the
+// file is still being read, only lines whose newline has arrived are split.
+static size_t
+scan_lines (TextBuffer *buffer, size_t max_lines, int update_index)
+{
+  if (buffer->store == NULL)
+    return 0;
+
+  reap_loader (buffer);
+
+  const char *contents = buffer->store->original;
+  size_t size = buffer->store->original_length;
+  int complete = 1;
+  if (buffer->loader != NULL)
+    {
+      size = file_loader_available (buffer->loader);
+      complete = 0;
+    }
+
+  size_t start = buffer->scan_offset;
+
+  // A whole file that is already in memory is split on every core
+  if (max_lines == (size_t)-1 && complete && !update_index)
+    {
+      size_t threads = load_thread_count (buffer, size - start);
+      if (threads > 1)
+        {
+          if (buffer->pager != NULL)
+            pager_touch (buffer->pager, contents + start, size - start);
+          return scan_lines_parallel (buffer, start, size, threads);
+        }
+    }
+
+  size_t first = start;
+  size_t added = 0;
+  NewlineScanner scanner;
+  newline_scanner_init (&scanner, contents, start, size);
+
+  while (start < size && added < max_lines)
+    {
+      // `size` when the rest has no newline
+      size_t end = newline_scanner_next (&scanner);
+      if (end == size && !complete)
+        break;
+
+      Line *new_line;
+      if (buffer->storage_mode == STORAGE_PIECE_TABLE)
+        new_line = create_new_line_from_store (buffer->store, start,
+                                               end - start);
+      else
+        new_line = create_new_line_slice (contents + start, end - start);
+
+      append_line (buffer, new_line);
+      if (update_index)
+        line_index_insert_after (buffer, new_line->prev, new_line);
+
+      start = end + 1;
+      added++;
+    }
+
+  // Splitting read these pages of a mapped file in
+  if (buffer->pager != NULL && start > first)
+    pager_touch (buffer->pager, contents + first, start - first);
+
+  buffer->scan_offset = start;
+  return added;
+}
+
+int
+buffer_is_loaded (const TextBuffer *buffer)
+{
+  return buffer->store == NULL
+         || (buffer->loader == NULL
+             && buffer->scan_offset >= buffer->store->original_length);
+}
+
+// Makes sure at least `count` lines exist, scanning more of a lazily loaded
+// file if needed. Text that has not been scanned always follows the tail.
+void
+buffer_ensure_lines (TextBuffer *buffer, size_t count)
+{
+  if (buffer->num_lines < count && !buffer_is_loaded (buffer))
+    {
+      scan_lines (buffer, count - buffer->num_lines, 1);
+    }
+}
+
+void
+buffer_load_all (TextBuffer *buffer)
+{
+  if (buffer_is_loaded (buffer))
+    return;
+
+  if (buffer->loader != NULL)
+    {
+      file_loader_wait (buffer->loader);
+    }
+
+  // Appending everything and rebuilding the index is O(n), cheaper than
+  // indexing each line as it comes
+  scan_lines (buffer, (size_t)-1, 0);
+  line_index_build (buffer);
+  buffer->cursor_line = NULL;
+  sync_cursor_position (buffer);
+}
+
+// line->next, scanning one more line first when line is the tail of a
+// buffer that is still being loaded lazily.
+Line *
+buffer_next_line (TextBuffer *buffer, Line *line)
+{
+  if (line->next == NULL && line == buffer->tail)
+    {
+      buffer_ensure_lines (buffer, buffer->num_lines + 1);
+    }
+  return line->next;
+}
+
+// Idle work for a file that is still loading: splits up to max_lines of what
+// the background loader has read so far. Mapped files stay split on demand.
+// Returns nonzero while there is loading left to do.
+int
+buffer_poll_load (TextBuffer *buffer, size_t max_lines)
+{
+  if (buffer->store == NULL)
+    return 0;
+
+  if (buffer->store->mapped)
+    return 0;
+
+  scan_lines (buffer, max_lines, 1);
+  return !buffer_is_loaded (buffer);
+}
+
+// Percentage of a file being read in the background that is already split
+// into lines, or -1 when nothing is loading. Mapped files are split on
+// demand and never count as loading.
+int
+buffer_load_progress (const TextBuffer *buffer)
+{
+  if (buffer->store == NULL || buffer->store->original_length == 0
+      || buffer->store->mapped || buffer_is_loaded (buffer))
+    return -1;
+
+  return (int)(buffer->scan_offset * 100 / buffer->store->original_length);
+}
+
+// Heap bytes behind a line that owns its storage.
+static size_t
+line_storage_bytes (const Line *line)
+{
+  if (line->gb)
+    return sizeof (GapBuffer)
+           + (gap_buffer_is_inline (line->gb) ? 0 : line->gb->capacity);
+  if (line->pt)
+    return sizeof (PieceTable) + line->pt->capacity * sizeof (Piece);
+  return 0;
+}
+
+// Turns a line that owns its storage back into a slice: of the file when it
+// is still one unedited piece of it, of the spill file otherwise.
+static int
+line_spill (TextBuffer *buffer, Line *line)
+{
+  size_t length;
+  const char *text;
+
+  if (line->pt && line->pt->num_pieces == 1
+      && line->pt->pieces[0].source == PIECE_ORIGINAL)
+    {
+      text = buffer->store->original + line->pt->pieces[0].start;
+      length = line->pt->pieces[0].length;
+    }
+  else
+    {
+      char *current = line_to_string (line);
+      if (current == NULL)
+        return 0;
+      length = line_get_length (line);
+      text = pager_spill (buffer->pager, current, length);
+      free (current);
+      if (text == NULL)
+        return 0;
+    }
+
+  gap_buffer_destroy (line->gb);
+  piece_table_destroy (line->pt);
+  line->gb = NULL;
+  line->pt = NULL;
+  line->text = text;
+  line->text_length = length;
+  line->flags &= ~(LINE_OWNS_STORAGE | LINE_NEEDS_COMPACT);
+  line_index_update (line);
+  return 1;
+}
+
+static int
+is_hot_line (size_t line_num, const size_t *hot_lines, size_t num_hot)
+{
+  for (size_t i = 0; i < num_hot; i++)
+    {
+      size_t distance = line_num > hot_lines[i] ? line_num - hot_lines[i]
+                                                : hot_lines[i] - line_num;
+      if (distance <= PAGE_OUT_HOT_LINES)
+        return 1;
+    }
+  return 0;
+}
+
+// Keeps a mapped buffer within its pager's memory budget. Lines within
+// PAGE_OUT_HOT_LINES of any of `hot_lines` (the viewport, the cursor, the
+// current search match) are in use: their pages are stamped and their
+// edits stay on the heap. When the budget is exceeded, edited lines
+// elsewhere are spilled and the least recently used windows of the file
+// and the spill file are dropped. Returns the bytes in use afterwards, or 0
+// for buffers without a pager.
+size_t
+buffer_page_out (TextBuffer *buffer, const size_t *hot_lines, size_t num_hot)
+{
+  Pager *pager = buffer->pager;
+  if (pager == NULL)
+    return 0;
+
+  pager_begin_tick (pager);
+  for (size_t i = 0; i < num_hot; i++)
+    {
+      size_t first = hot_lines[i] > PAGE_OUT_HOT_LINES
+                         ? hot_lines[i] - PAGE_OUT_HOT_LINES
+                         : 0;
+      Line *line = line_index_find (buffer, first);
+      for (size_t n = 0; line != NULL && n <= 2 * PAGE_OUT_HOT_LINES;
+           line = line->next, n++)
+        {
+          if (!line->gb && !line->pt)
+            pager_touch (pager, line->text, line->text_length);
+        }
+    }
+
+  size_t owned = 0;
+  for (Line *line = line_index_find_flagged (buffer, 0, LINE_OWNS_STORAGE);
+       line != NULL; line = line_index_find_flagged (
+                         buffer, line_index_position (line) + 1,
+                         LINE_OWNS_STORAGE))
+    {
+      owned += line_storage_bytes (line);
+    }
+
+  size_t resident = pager_resident_bytes (pager);
+  if (owned + resident <= pager->budget)
+    return owned + resident;
+
+  Line *line = line_index_find_flagged (buffer, 0, LINE_OWNS_STORAGE);
+  while (line != NULL)
+    {
+      size_t line_num = line_index_position (line);
+      size_t bytes = line_storage_bytes (line);
+      if (line != buffer->current_line_node
+          && !is_hot_line (line_num, hot_lines, num_hot)
+          && line_spill (buffer, line))
+        {
+          owned -= bytes;
+        }
+      line = line_index_find_flagged (buffer, line_num + 1,
+                                      LINE_OWNS_STORAGE);
+    }
+
+  size_t allowed = pager->budget > owned ? pager->budget - owned : 0;
+  return owned + pager_evict (pager, allowed);
+}
+
+void
+loadFromFile (const char *filename, TextBuffer *buffer)
+{
+  if (!filename || !buffer)
+    return;
+
+  FILE *file = fopen (filename, "r");
+  if (file == NULL)
+    {
+      init_editor_buffer (buffer);
+      Line *initial_line = create_new_line_empty ();
+      insert_line_at_end (buffer, initial_line);
+      buffer->current_line_node = initial_line;
+      buffer->current_col_offset = 0;
+      return;
+    }
+
+  free_editor_buffer (buffer);
+
+  size_t size = 0;
+  char *contents = NULL;
+  int mapped = 0;
+  int streamed = 0;
+
+  struct stat st;
+  size_t file_size = 0;
+  int regular = fstat (fileno (file), &st) == 0 && S_ISREG (st.st_mode);
+  if (regular)
+    {
+      file_size = st.st_size;
+    }
+
+  // A gzip file is inflated as it is read; one that turns out to be damaged
+  // is shown as it is. Large ones are inflated in the background like
+  // other large files, into room for what the trailer claims; a damaged
+  // one is only found out then, and is reported like a failed read.
+  int compressed = regular && gzip_detect (file);
+  if (compressed && buffer->async_load)
+    {
+      size_t expanded = gzip_size_hint (file);
+      if (expanded >= ASYNC_LOAD_THRESHOLD)
+        {
+          contents = malloc (expanded);
+          size = expanded;
+          streamed = contents != NULL;
+        }
+    }
+  if (compressed && !streamed)
+    {
+      contents = gzip_read_contents (file, &size);
+      compressed = contents != NULL;
+    }
+
+  if (!compressed
+      && (buffer->lazy_load || file_size >= LAZY_LOAD_THRESHOLD))
+    {
+      contents = map_file (file, &size);
+      mapped = contents != NULL;
+    }
+  if (!mapped && !compressed && buffer->async_load
+      && file_size >= ASYNC_LOAD_THRESHOLD)
+    {
+      contents = malloc (file_size);
+      size = file_size;
+      streamed = contents != NULL;
+    }
+  if (!mapped && !streamed && !compressed)
+    {
+      errno = 0;
+      contents = read_file_contents (file, &size);
+      if (!contents)
+        buffer->load_error = errno ? errno : EIO;
+    }
+  buffer->compressed = compressed;
+
+  if (size >= PIECE_TABLE_THRESHOLD)
+    {
+      buffer->storage_mode = STORAGE_PIECE_TABLE;
+    }
+
+  if (contents)
+    {
+      buffer->store = piece_store_create (contents, size);
+      if (buffer->store)
+        {
+          buffer->store->mapped = mapped;
+          if (mapped)
+            {
+              buffer->pager
+                  = pager_create (contents, size, PAGER_DEFAULT_BUDGET);
+            }
+          if (streamed)
+            {
+              buffer->loader
+                  = compressed
+                        ? file_loader_start_gzip (fileno (file), contents,
+                                                  size)
+                        : file_loader_start (fileno (file), contents, size);
+              if (buffer->loader == NULL && compressed)
+                {
+                  buffer->store->original_length = 0;
+                  buffer->load_error = ENOMEM;
+                }
+              else if (buffer->loader == NULL)
+                {
+                  errno = 0;
+                  buffer->store->original_length
+                      = fread (contents, 1, size, file);
+                  if (ferror (file))
+                    buffer->load_error = errno ? errno : EIO;
+                }
+            }
+
+          // A mapped file is split on demand and never read ahead, so only
+          // the pages looked at are read; the first screenful is scanned by
+          // the caller through buffer_ensure_lines(). A streamed
+          // one gets whatever lines the first chunk holds, and the idle loop
+          // splits the rest as it arrives.
+          scan_lines (buffer, mapped ? 1 : (size_t)-1, 0);
+          if (buffer->head == NULL && buffer->loader != NULL)
+            {
+              // Not even one whole line yet: finish the load instead of
+              // leaving the buffer empty
+              file_loader_wait (buffer->loader);
+              scan_lines (buffer, mapped ? 1 : (size_t)-1, 0);
+            }
+        }
+      else if (mapped)
+        munmap (contents, size);
+      else
+        free (contents);
+    }
+  fclose (file);
+
+  finish_load (buffer);
+
+  // The line finish_load gives an empty file is not an edit
+  buffer->lines_changed = 0;
+  if (regular)
+    {
+      record_identity (&buffer->disk, &st, compressed);
+      if (buffer->load_error)
+        buffer->partial = buffer->disk;
+    }
+}
+
+// Gives a slice line its own gap buffer so it can be edited. Lines that are
+// already writable are left alone.
+static void
+line_make_writable (Line *line)
+{
+  if (line->gb || line->pt)
+    return;
+
+  GapBuffer *gb = gap_buffer_create (line->text_length);
+  if (gb == NULL)
+    {
+      perror ("Gap buffer creation failed");
+      exit (EXIT_FAILURE);
+    }
+
+  gap_buffer_insert_bytes (gb, line->text, line->text_length);
+  line->gb = gb;
+  line->text = NULL;
+  line->text_length = 0;
+  line->flags |= LINE_OWNS_STORAGE;
+}
+
+// Remembers the length a clean line has on disk before its first change
+// since the last save; in-place saves rely on it. Called before every line
+// edit.
+static void
+line_will_change (Line *line)
+{
+  if (!(line->flags & LINE_DIRTY))
+    {
+      line->saved_length = line_get_length (line);
+      line->flags |= LINE_DIRTY;
+    }
+}
+
+// Flags lines whose gap buffer has slack for the idle compaction sweep and
+// brings the line index up to date; called after every line edit.
+static void
+line_edited (Line *line)
+{
+  if (line->gb && gap_buffer_wants_compact (line->gb))
+    {
+      line->flags |= LINE_NEEDS_COMPACT;
+    }
+  line_index_update (line);
+}
+
+size_t
+line_get_length (const Line *line)
+{
+  if (!line)
+    return 0;
+  if (line->pt)
+    return piece_table_length (line->pt);
+  if (!line->gb)
+    return line->text_length;
+  return gap_buffer_length (line->gb);
+}
+
+char
+line_get_char_at (const Line *line, size_t position)
+{
+  if (!line)
+    return '\0';
+  if (line->pt)
+    return piece_table_get_char_at (line->pt, position);
+  if (!line->gb)
+    return position < line->text_length ? line->text[position] : '\0';
+  return gap_buffer_get_char_at (line->gb, position);
+}
+
+char *
+line_to_string (const Line *line)
+{
+  if (!line)
+    return NULL;
+  if (line->pt)
+    return piece_table_to_string (line->pt);
+  if (!line->gb)
+    {
+      char *result = malloc (line->text_length + 1);
+      if (!result)
+        return NULL;
+      memcpy (result, line->text, line->text_length);
+      result[line->text_length] = '\0';
+      return result;
+    }
+  return gap_buffer_to_string (line->gb);
+}
+
+// The run of bytes starting at `col` that is contiguous in storage.
+size_t
+line_span_at (const Line *line, size_t col, const char **span)
+{
+  if (line->pt)
+    return piece_table_span_at (line->pt, col, span);
+
+  if (line->gb)
+    {
+      const char *first, *second;
+      size_t first_length, second_length;
+      gap_buffer_get_spans (line->gb, &first, &first_length, &second,
+                            &second_length);
+      if (col < first_length)
+        {
+          *span = first + col;
+          return first_length - col;
+        }
+      *span = second + (col - first_length);
+      return second_length - (col - first_length);
+    }
+
+  *span = line->text + col;
+  return line->text_length - col;
+}
+
+// The run of bytes ending at `col` that is contiguous in storage.
+size_t
+line_span_before (const Line *line, size_t col, const char **span)
+{
+  if (line->pt)
+    return piece_table_span_before (line->pt, col, span);
+
+  if (line->gb)
+    {
+      const char *first, *second;
+      size_t first_length, second_length;
+      gap_buffer_get_spans (line->gb, &first, &first_length, &second,
+                            &second_length);
+      if (col <= first_length)
+        {
+          *span = first;
+          return col;
+        }
+      *span = second;
+      return col - first_length;
+    }
+
+  *span = line->text;
+  return col;
+}
+
+void
+line_insert_char_at (Line *line, size_t position, char c)
+{
+  if (!line)
+    return;
+  line_will_change (line);
+  line_make_writable (line);
+  if (line->pt)
+    {
+      piece_table_insert_char (line->pt, position, c);
+    }
+  else
+    {
+      gap_buffer_move_cursor_to (line->gb, position);
+      gap_buffer_insert_char (line->gb, c);
+    }
+  line_edited (line);
+}
+
+void
+line_insert_string_at (Line *line, size_t position, const char *str)
+{
+  if (!line || !str)
+    return;
+  line_will_change (line);
+  line_make_writable (line);
+  if (line->pt)
+    {
+      piece_table_insert_string (line->pt, position, str);
+    }
+  else
+    {
+      gap_buffer_move_cursor_to (line->gb, position);
+      gap_buffer_insert_string (line->gb, str);
+    }
+  line_edited (line);
+}
+
+void
+line_delete_char_at (Line *line, size_t position)
+{
+  if (!line)
+    return;
+  line_will_change (line);
+  line_make_writable (line);
+  if (line->pt)
+    {
+      piece_table_delete_char (line->pt, position);
+    }
+  else
+    {
+      gap_buffer_move_cursor_to (line->gb, position);
+      gap_buffer_delete_char (line->gb);
+    }
+  line_edited (line);
+}
+
+void
+line_delete_char_before (Line *line, size_t position)
+{
+  if (!line || position == 0)
+    return;
+  line_will_change (line);
+  line_make_writable (line);
+  if (line->pt)
+    {
+      size_t length = piece_table_length (line->pt);
+      piece_table_delete_char (line->pt,
+                               (position > length ? length : position) - 1);
+    }
+  else
+    {
+      gap_buffer_move_cursor_to (line->gb, position);
+      gap_buffer_delete_char_before (line->gb);
+    }
+  line_edited (line);
+}
+
+void
+line_truncate (Line *line, size_t position)
+{
+  if (!line)
+    return;
+  line_will_change (line);
+  if (!line->gb && !line->pt)
+    {
+      // Truncating a slice only shortens it, no copy needed
+      if (position < line->text_length)
+        line->text_length = position;
+    }
+  else if (line->pt)
+    {
+      piece_table_truncate (line->pt, position);
+    }
+  else
+    {
+      gap_buffer_truncate (line->gb, position);
+    }
+  line_edited (line);
+}
+
+// Deletes `delete_count` bytes at `position` and inserts `length` bytes in
+// their place with a single gap move.
+void
+line_replace_bytes (Line *line, size_t position, size_t delete_count,
+                    const char *bytes, size_t length)
+{
+  if (!line)
+    return;
+
+  size_t line_length = line_get_length (line);
+  if (position > line_length)
+    {
+      position = line_length;
+    }
+  if (delete_count > line_length - position)
+    {
+      delete_count = line_length - position;
+    }
+
+  if (length == 0)
+    {
+      if (position + delete_count == line_length)
+        {
+          line_truncate (line, position);
+          return;
+        }
+      if (delete_count == 0)
+        return;
+    }
+
+  line_will_change (line);
+  line_make_writable (line);
+  if (line->pt)
+    {
+      piece_table_delete_range (line->pt, position, delete_count);
+      piece_table_insert_bytes (line->pt, position, bytes, length);
+    }
+  else
+    {
+      gap_buffer_move_cursor_to (line->gb, position);
+      gap_buffer_delete_bytes (line->gb, delete_count);
+      gap_buffer_insert_bytes (line->gb, bytes, length);
+    }
+  line_edited (line);
+}
+
+// Unlinks first..last from the list in one splice and frees them. A cursor
+// on one of them moves to the line before the run.
+static void
+remove_line_run (TextBuffer *buffer, Line *first, Line *last)
+{
+  Line *before = first->prev;
+  Line *after = last->next;
+
+  before->next = after;
+  if (after != NULL)
+    {
+      after->prev = before;
+    }
+  else
+    {
+      buffer->tail = before;
+    }
+  last->next = NULL;
+  buffer->lines_changed = 1;
+
+  Line *line = first;
+  while (line != NULL)
+    {
+      Line *next = line->next;
+      if (buffer->current_line_node == line)
+        {
+          buffer->current_line_node = before;
+          buffer->current_col_offset = line_get_length (before);
+        }
+      line_index_remove (buffer, line);
+      free_line (line);
+      buffer->num_lines--;
+      line = next;
+    }
+}
+
+// Replaces the text from (start_line, start_col) up to (end_line, end_col)
+// with `length` bytes of `text`, which may contain newlines. The two end
+// lines are edited in place, the lines between them are spliced out as one
+// run and only lines for the new text in between are allocated, so the cost
+// is proportional to the size of the change. Removed lines are freed; callers
+// must drop other references to them (e.g. undo) first. Returns the line
+// holding the end of the new text and stores its column in *end_col_out.
+Line *
+buffer_replace_range (TextBuffer *buffer, Line *start_line, size_t start_col,
+                      Line *end_line, size_t end_col, const char *text,
+                      size_t length, size_t *end_col_out)
+{
+  if (!buffer || !start_line || !end_line)
+    return NULL;
+
+  if (text == NULL)
+    {
+      text = "";
+      length = 0;
+    }
+
+  size_t start_length = line_get_length (start_line);
+  if (start_col > start_length)
+    {
+      start_col = start_length;
+    }
+  size_t end_length = line_get_length (end_line);
+  if (end_col > end_length)
+    {
+      end_col = end_length;
+    }
+  if (start_line == end_line && end_col < start_col)
+    {
+      end_col = start_col;
+    }
+
+  // Byte offsets above the cursor may change; resynced at the end
+  buffer->cursor_line = NULL;
+
+  if (start_line != end_line && start_line->next != end_line)
+    {
+      remove_line_run (buffer, start_line->next, end_line->prev);
+    }
+
+  const char *newline = memchr (text, '\n', length);
+  Line *last_line;
+  size_t last_col;
+
+  if (newline == NULL)
+    {
+      if (start_line == end_line)
+        {
+          line_replace_bytes (start_line, start_col, end_col - start_col,
+                              text, length);
+        }
+      else
+        {
+          // Join the head of start_line, the text and the tail of end_line
+          char *end_text = line_to_string (end_line);
+          line_replace_bytes (start_line, start_col, start_length - start_col,
+                              text, length);
+          if (end_text)
+            {
+              line_replace_bytes (start_line, start_col + length, 0,
+                                  end_text + end_col, end_length - end_col);
+              free (end_text);
+            }
+          remove_line_run (buffer, end_line, end_line);
+        }
+      last_line = start_line;
+      last_col = start_col + length;
+    }
+  else
+    {
+      if (start_line == end_line)
+        {
+          // The tail after end_col moves down to a new last line
+          char *line_text = line_to_string (start_line);
+          last_line = create_new_line_bytes (line_text ? line_text + end_col
+                                                       : "",
+                                             line_text ? start_length - end_col
+                                                       : 0);
+          free (line_text);
+          insert_line_after (buffer, start_line, last_line);
+          end_col = 0;
+        }
+      else
+        {
+          last_line = end_line;
+        }
+
+      line_replace_bytes (start_line, start_col, start_length - start_col,
+                          text, newline - text);
+
+      Line *prev = start_line;
+      const char *segment = newline + 1;
+      const char *text_end = text + length;
+      while ((newline = memchr (segment, '\n', text_end - segment)) != NULL)
+        {
+          Line *new_line = create_new_line_bytes (segment, newline - segment);
+          insert_line_after (buffer, prev, new_line);
+          prev = new_line;
+          segment = newline + 1;
+        }
+
+      last_col = text_end - segment;
+      line_replace_bytes (last_line, 0, end_col, segment, last_col);
+    }
+
+  sync_cursor_position (buffer);
+
+  if (end_col_out)
+    *end_col_out = last_col;
+  return last_line;
+}
+
+// Compacts up to max_lines flagged lines other than the cursor line, which
+// is likely to be edited again. Returns the number of lines compacted.
+size_t
+buffer_compact_lines (TextBuffer *buffer, size_t max_lines)
+{
+  size_t compacted = 0;
+  size_t from = 0;
+
+  while (compacted < max_lines)
+    {
+      Line *line = line_index_find_flagged (buffer, from, LINE_NEEDS_COMPACT);
+      if (line == NULL)
+        break;
+
+      if (line == buffer->current_line_node)
+        {
+          from = line_index_position (line) + 1;
+          continue;
+        }
+
+      if (line->gb)
+        gap_buffer_compact (line->gb);
+      line->flags &= ~LINE_NEEDS_COMPACT;
+      line_index_update (line);
+      compacted++;
+    }
+
+  return compacted;
 }
@@ -0,0 +1,223 @@
+#define _DEFAULT_SOURCE
+
+#include "follow.h"
+#include "line_index.h"
+#include "newline_scan.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#define FOLLOW_EVENTS (IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF)
+#endif
+
+// Starts following `filename`, whose contents as of its last load or save
+// are in `buffer`. Anything written since then is appended on the first
+// poll once the buffer holds every line of the file. Returns NULL with
+// errno set when the file cannot be read, or with ESTALE when it was
+// replaced or cut short since.
+FileFollower *
+follower_start (const char *filename, TextBuffer *buffer)
+{
+  int fd = open (filename, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+
+  struct stat st;
+  if (fstat (fd, &st) != 0)
+    {
+      close (fd);
+      return NULL;
+    }
+
+  const FileIdentity *disk = &buffer->disk;
+  off_t offset = disk->valid ? (off_t)disk->size : 0;
+  if (!S_ISREG (st.st_mode)
+      || (disk->valid
+          && (st.st_dev != disk->device || st.st_ino != disk->inode))
+      || st.st_size < offset)
+    {
+      close (fd);
+      errno = ESTALE;
+      return NULL;
+    }
+
+  FileFollower *follower = malloc (sizeof (FileFollower));
+  if (!follower)
+    {
+      close (fd);
+      return NULL;
+    }
+
+  char last = '\n';
+  follower->fd = fd;
+  follower->offset = offset;
+  follower->tail_open = offset == 0
+                        || pread (fd, &last, 1, offset - 1) != 1
+                        || last != '\n';
+  follower->pending = 1;
+
+  follower->inotify_fd = -1;
+#ifdef __linux__
+  follower->inotify_fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+  if (follower->inotify_fd >= 0
+      && inotify_add_watch (follower->inotify_fd, filename, FOLLOW_EVENTS)
+             < 0)
+    {
+      close (follower->inotify_fd);
+      follower->inotify_fd = -1;
+    }
+#endif
+
+  return follower;
+}
+
+// Reads every queued event. Returns 0 when nothing happened to the file;
+// sets *gone when it was deleted or renamed.
+static int
+drain_events (FileFollower *follower, int *gone)
+{
+  int changed = 0;
+#ifdef __linux__
+  char events[4096]
+      __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+  ssize_t length;
+
+  while ((length = read (follower->inotify_fd, events, sizeof (events))) > 0)
+    {
+      for (char *next = events; next < events + length;)
+        {
+          const struct inotify_event *event = (void *)next;
+          if (event->mask & (IN_MOVE_SELF | IN_DELETE_SELF))
+            *gone = 1;
+          changed = 1;
+          next += sizeof (struct inotify_event) + event->len;
+        }
+    }
+#else
+  (void)follower;
+  (void)gone;
+#endif
+  return changed;
+}
+
+// Splits `bytes` at its newlines onto the end of the buffer. Text before the
+// first newline finishes the last line when that was left open. The text is
+// in the file already, so it is not an edit: the lines it adds and a last
+// line that had no edits of its own stay clean.
+static void
+append_bytes (FileFollower *follower, TextBuffer *buffer, const char *bytes,
+              size_t length)
+{
+  int lines_changed = buffer->lines_changed;
+  NewlineScanner scanner;
+  newline_scanner_init (&scanner, bytes, 0, length);
+
+  size_t start = 0;
+  while (start < length)
+    {
+      // `length` when the rest has no newline
+      size_t end = newline_scanner_next (&scanner);
+      if (follower->tail_open)
+        {
+          Line *tail = buffer->tail;
+          int dirty = tail->flags & LINE_DIRTY;
+          line_replace_bytes (tail, line_get_length (tail), 0, bytes + start,
+                              end - start);
+          if (!dirty)
+            {
+              tail->flags &= ~LINE_DIRTY;
+              line_index_update (tail);
+            }
+        }
+      else
+        {
+          insert_line_at_end (buffer,
+                              create_new_line_bytes (bytes + start,
+                                                     end - start));
+        }
+
+      follower->tail_open = end == length;
+      start = end + 1;
+    }
+
+  buffer->lines_changed = lines_changed;
+}
+
+// Appends up to FOLLOW_CHUNK bytes written to the file since the last poll
+// and sets *appended to their number. `pending` is left set when more is
+// waiting.
+FollowStatus
+follower_poll (FileFollower *follower, TextBuffer *buffer, size_t *appended)
+{
+  *appended = 0;
+
+  // New text goes behind every line of the file. While part of a lazily
+  // loaded file is still unsplit, it waits rather than splitting the whole
+  // file; inotify keeps the events until then.
+  if (!buffer_is_loaded (buffer))
+    return FOLLOW_OK;
+
+  int gone = 0;
+  if (follower->inotify_fd >= 0 && !follower->pending
+      && !drain_events (follower, &gone))
+    return FOLLOW_OK;
+
+  struct stat st;
+  if (fstat (follower->fd, &st) != 0)
+    return FOLLOW_ERROR;
+  if (st.st_nlink == 0)
+    gone = 1;
+  if (st.st_size < follower->offset)
+    return FOLLOW_TRUNCATED;
+
+  size_t length = st.st_size - follower->offset;
+  if (length > FOLLOW_CHUNK)
+    length = FOLLOW_CHUNK;
+  follower->pending = (off_t)length < st.st_size - follower->offset;
+
+  if (length > 0)
+    {
+      char *bytes = malloc (length);
+      if (!bytes)
+        return FOLLOW_ERROR;
+
+      ssize_t count = pread (follower->fd, bytes, length, follower->offset);
+      if (count < 0)
+        {
+          free (bytes);
+          return FOLLOW_ERROR;
+        }
+
+      append_bytes (follower, buffer, bytes, count);
+      follower->offset += count;
+      *appended = count;
+      free (bytes);
+
+      // The buffer holds the file up to here now, as if it had been loaded
+      // that way
+      if (buffer->disk.valid)
+        {
+          buffer->disk.size = follower->offset;
+          buffer->disk.mtime_sec = st.st_mtim.tv_sec;
+          buffer->disk.mtime_nsec = st.st_mtim.tv_nsec;
+        }
+    }
+
+  return gone && !follower->pending ? FOLLOW_GONE : FOLLOW_OK;
+}
+
+void
+follower_stop (FileFollower *follower)
+{
+  if (!follower)
+    return;
+
+  if (follower->inotify_fd >= 0)
+    close (follower->inotify_fd);
+  close (follower->fd);
+  free (follower);
+}
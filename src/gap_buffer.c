@@ -1,10 +1,15 @@
 #include "gap_buffer.h"
+#include "pool.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #define MIN_GAP_SIZE 16
 #define GROWTH_FACTOR 2
+// Deletions shrink a buffer once the gap outgrows the text by this factor
+#define SHRINK_FACTOR 4
+
+static Pool gap_buffer_pool = POOL_INITIALIZER ("gapbufs", sizeof (GapBuffer));
 
 GapBuffer *
 gap_buffer_create (size_t initial_capacity)
@@ -14,15 +19,22 @@ gap_buffer_create (size_t initial_capacity)
       initial_capacity = MIN_GAP_SIZE;
     }
 
-  GapBuffer *gb = malloc (sizeof (GapBuffer));
+  GapBuffer *gb = pool_alloc (&gap_buffer_pool);
   if (!gb)
     return NULL;
 
-  gb->buffer = malloc (initial_capacity);
-  if (!gb->buffer)
+  if (initial_capacity <= GAP_BUFFER_INLINE_SIZE)
     {
-      free (gb);
-      return NULL;
+      gb->buffer = gb->inline_data;
+    }
+  else
+    {
+      gb->buffer = pool_alloc_block (&initial_capacity);
+      if (!gb->buffer)
+        {
+          pool_free (&gap_buffer_pool, gb);
+          return NULL;
+        }
     }
 
   gb->capacity = initial_capacity;
@@ -37,11 +49,18 @@ gap_buffer_destroy (GapBuffer *gb)
 {
   if (gb)
     {
-      free (gb->buffer);
-      free (gb);
+      if (!gap_buffer_is_inline (gb))
+        pool_free_block (gb->buffer, gb->capacity);
+      pool_free (&gap_buffer_pool, gb);
     }
 }
 
+int
+gap_buffer_is_inline (const GapBuffer *gb)
+{
+  return gb->buffer == gb->inline_data;
+}
+
 size_t
 gap_buffer_gap_size (const GapBuffer *gb)
 {
@@ -66,28 +85,111 @@ gap_buffer_ensure_capacity (GapBuffer *gb, size_t needed_capacity)
   if (gb->capacity >= needed_capacity)
     return;
 
+  size_t after_gap_size = gb->capacity - gb->gap_end;
+
+  // Use the rest of the inline storage before going to the heap
+  if (gap_buffer_is_inline (gb) && needed_capacity <= GAP_BUFFER_INLINE_SIZE)
+    {
+      size_t new_gap_end = GAP_BUFFER_INLINE_SIZE - after_gap_size;
+      memmove (gb->buffer + new_gap_end, gb->buffer + gb->gap_end,
+               after_gap_size);
+      gb->gap_end = new_gap_end;
+      gb->capacity = GAP_BUFFER_INLINE_SIZE;
+      return;
+    }
+
   size_t new_capacity = gb->capacity * GROWTH_FACTOR;
   if (new_capacity < needed_capacity)
     {
       new_capacity = needed_capacity;
     }
 
-  char *new_buffer = malloc (new_capacity);
+  char *new_buffer = pool_alloc_block (&new_capacity);
   if (!new_buffer)
     return;
 
   memcpy (new_buffer, gb->buffer, gb->gap_start);
 
+  size_t new_gap_end = new_capacity - after_gap_size;
+  memcpy (new_buffer + new_gap_end, gb->buffer + gb->gap_end, after_gap_size);
+
+  if (!gap_buffer_is_inline (gb))
+    pool_free_block (gb->buffer, gb->capacity);
+  gb->buffer = new_buffer;
+  gb->gap_end = new_gap_end;
+  gb->capacity = new_capacity;
+}
+
+// Reallocates the buffer to the text plus MIN_GAP_SIZE of gap, moving it
+// back inline when it fits. The gap stays at the cursor.
+void
+gap_buffer_compact (GapBuffer *gb)
+{
+  if (gap_buffer_is_inline (gb))
+    return;
+
+  size_t length = gap_buffer_length (gb);
   size_t after_gap_size = gb->capacity - gb->gap_end;
+  size_t new_capacity = length + MIN_GAP_SIZE;
+  char *new_buffer;
+
+  if (new_capacity <= GAP_BUFFER_INLINE_SIZE)
+    {
+      new_capacity = GAP_BUFFER_INLINE_SIZE;
+      new_buffer = gb->inline_data;
+    }
+  else
+    {
+      if (new_capacity >= gb->capacity)
+        return;
+      new_buffer = pool_alloc_block (&new_capacity);
+      if (!new_buffer || new_capacity >= gb->capacity)
+        {
+          pool_free_block (new_buffer, new_capacity);
+          return;
+        }
+    }
+
   size_t new_gap_end = new_capacity - after_gap_size;
+  memcpy (new_buffer, gb->buffer, gb->gap_start);
   memcpy (new_buffer + new_gap_end, gb->buffer + gb->gap_end, after_gap_size);
 
-  free (gb->buffer);
+  pool_free_block (gb->buffer, gb->capacity);
   gb->buffer = new_buffer;
   gb->gap_end = new_gap_end;
   gb->capacity = new_capacity;
 }
 
+// True when compacting would free memory: the gap is more than the slack
+// compaction leaves and a smaller block (or the inline storage) would do.
+// Freshly grown buffers qualify too, so idle sweeps trim growth slack.
+int
+gap_buffer_wants_compact (const GapBuffer *gb)
+{
+  if (gap_buffer_is_inline (gb))
+    return 0;
+
+  size_t length = gap_buffer_length (gb);
+  size_t target = length + MIN_GAP_SIZE;
+  size_t gap = gap_buffer_gap_size (gb);
+
+  return gap > MIN_GAP_SIZE
+         && (target <= GAP_BUFFER_INLINE_SIZE
+             || pool_block_size (target) < gb->capacity);
+}
+
+// Deleting never needs more room, so a buffer whose gap dwarfs its text is
+// shrunk right away; the factor keeps repeated deletes amortised O(1).
+static void
+shrink_if_sparse (GapBuffer *gb)
+{
+  if (gap_buffer_gap_size (gb)
+      > SHRINK_FACTOR * (gap_buffer_length (gb) + MIN_GAP_SIZE))
+    {
+      gap_buffer_compact (gb);
+    }
+}
+
 void
 gap_buffer_move_cursor_to (GapBuffer *gb, size_t position)
 {
@@ -119,7 +221,9 @@ gap_buffer_insert_char (GapBuffer *gb, char c)
 {
   if (gap_buffer_gap_size (gb) == 0)
     {
-      gap_buffer_ensure_capacity (gb, gb->capacity + MIN_GAP_SIZE);
+      gap_buffer_ensure_capacity (gb, gb->capacity + 1);
+      if (gap_buffer_gap_size (gb) == 0)
+        return;
     }
 
   gb->buffer[gb->gap_start] = c;
@@ -132,19 +236,24 @@ gap_buffer_insert_string (GapBuffer *gb, const char *str)
   if (!str)
     return;
 
-  size_t str_len = strlen (str);
-  if (str_len == 0)
+  gap_buffer_insert_bytes (gb, str, strlen (str));
+}
+
+void
+gap_buffer_insert_bytes (GapBuffer *gb, const char *bytes, size_t length)
+{
+  if (length == 0)
     return;
 
-  if (gap_buffer_gap_size (gb) < str_len)
+  if (gap_buffer_gap_size (gb) < length)
     {
-      gap_buffer_ensure_capacity (gb, gb->capacity + str_len + MIN_GAP_SIZE);
+      gap_buffer_ensure_capacity (gb, gap_buffer_length (gb) + length);
+      if (gap_buffer_gap_size (gb) < length)
+        return;
     }
 
-  for (size_t i = 0; i < str_len; i++)
-    {
-      gap_buffer_insert_char (gb, str[i]);
-    }
+  memcpy (gb->buffer + gb->gap_start, bytes, length);
+  gb->gap_start += length;
 }
 
 void
@@ -153,18 +262,37 @@ gap_buffer_delete_char (GapBuffer *gb)
   if (gb->gap_end < gb->capacity)
     {
       gb->gap_end++;
+      shrink_if_sparse (gb);
     }
 }
 
+// Deletes up to `count` bytes after the cursor by widening the gap.
+void
+gap_buffer_delete_bytes (GapBuffer *gb, size_t count)
+{
+  size_t after_gap_size = gb->capacity - gb->gap_end;
+  gb->gap_end += count < after_gap_size ? count : after_gap_size;
+  shrink_if_sparse (gb);
+}
+
 void
 gap_buffer_delete_char_before (GapBuffer *gb)
 {
   if (gb->gap_start > 0)
     {
       gb->gap_start--;
+      shrink_if_sparse (gb);
     }
 }
 
+void
+gap_buffer_truncate (GapBuffer *gb, size_t position)
+{
+  gap_buffer_move_cursor_to (gb, position);
+  gb->gap_end = gb->capacity;
+  shrink_if_sparse (gb);
+}
+
 char
 gap_buffer_get_char_at (const GapBuffer *gb, size_t position)
 {
@@ -183,6 +311,28 @@ gap_buffer_get_char_at (const GapBuffer *gb, size_t position)
     }
 }
 
+// The text before and after the gap, without copying. Valid until the next
+// edit.
+void
+gap_buffer_get_spans (const GapBuffer *gb, const char **first,
+                      size_t *first_length, const char **second,
+                      size_t *second_length)
+{
+  *first = gb->buffer;
+  *first_length = gb->gap_start;
+  *second = gb->buffer + gb->gap_end;
+  *second_length = gb->capacity - gb->gap_end;
+}
+
+// Moves the gap behind the text so it can be read as one span. Repeated
+// calls without edits in between cost nothing.
+const char *
+gap_buffer_get_text (GapBuffer *gb)
+{
+  gap_buffer_move_cursor_to (gb, gap_buffer_length (gb));
+  return gb->buffer;
+}
+
 char *
 gap_buffer_to_string (const GapBuffer *gb)
 {
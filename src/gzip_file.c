@@ -0,0 +1,288 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "gzip_file.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// A gzip header is at least this long; a member that fails inside it is
+// junk after the last real member rather than a damaged one
+#define GZIP_HEADER_SIZE 10
+// zlib counts input and output in a uInt, so buffers bigger than this are
+// handed over a part at a time. The test build sets it lower.
+#ifndef GZIP_MAX_INPUT
+#define GZIP_MAX_INPUT (1u << 30)
+#endif
+// deflate cannot expand data more than this, so a trailer that claims more
+// is not believed
+#define GZIP_MAX_RATIO 1032
+
+// Whether a seekable file starts with the gzip magic. Leaves the file at
+// the start either way.
+int
+gzip_detect (FILE *file)
+{
+  unsigned char magic[2];
+  size_t count = fread (magic, 1, sizeof (magic), file);
+  rewind (file);
+  return count == 2 && magic[0] == 0x1f && magic[1] == 0x8b;
+}
+
+// Size the last member says it expands to, modulo 4G. Only a hint: files
+// with several members or over 4G expand to more, and a damaged or crafted
+// trailer can claim anything, so it is capped at what the compressed size
+// could possibly expand to. Leaves the file at the start.
+size_t
+gzip_size_hint (FILE *file)
+{
+  unsigned char trailer[4];
+  size_t hint = 0;
+
+  if (fseek (file, -4, SEEK_END) == 0 && fread (trailer, 1, 4, file) == 4)
+    {
+      hint = (size_t)trailer[0] | (size_t)trailer[1] << 8
+             | (size_t)trailer[2] << 16 | (size_t)trailer[3] << 24;
+
+      long compressed = ftell (file);
+      if (compressed > 0 && hint / GZIP_MAX_RATIO > (size_t)compressed)
+        hint = (size_t)compressed * GZIP_MAX_RATIO;
+    }
+  rewind (file);
+  return hint;
+}
+
+// Reads `fd` from its start with pread, so it does not matter where
+// anything else sharing the descriptor has left the offset.
+int
+gzip_reader_init (GzipReader *reader, int fd)
+{
+  memset (reader, 0, sizeof (GzipReader));
+  reader->fd = fd;
+  reader->in = malloc (GZIP_CHUNK);
+  // 16 + MAX_WBITS: expect a gzip header and trailer around the data
+  if (!reader->in || inflateInit2 (&reader->stream, 16 + MAX_WBITS) != Z_OK)
+    {
+      free (reader->in);
+      reader->in = NULL;
+      errno = ENOMEM;
+      return -1;
+    }
+  return 0;
+}
+
+// Inflates up to `space` bytes into `out`, reading GZIP_CHUNK of input at a
+// time. Concatenated members are read one after another, as gzip does.
+// Returns how many bytes were inflated, 0 after the last member, or -1 with
+// errno set when the file is damaged, cut short or cannot be read.
+ssize_t
+gzip_reader_read (GzipReader *reader, char *out, size_t space)
+{
+  z_stream *stream = &reader->stream;
+  if (space > GZIP_MAX_INPUT)
+    space = GZIP_MAX_INPUT;
+
+  size_t produced = 0;
+  while (produced == 0 && !reader->finished)
+    {
+      if (stream->avail_in == 0)
+        {
+          ssize_t count = pread (reader->fd, reader->in, GZIP_CHUNK,
+                                 reader->offset);
+          if (count < 0 && errno == EINTR)
+            continue;
+          if (count < 0)
+            return -1;
+          if (count == 0)
+            {
+              // total_in restarts with each member, so anything left in it
+              // is a member that was cut short
+              if (reader->members == 0 || stream->total_in > 0)
+                {
+                  errno = EIO;
+                  return -1;
+                }
+              reader->finished = 1;
+              break;
+            }
+          reader->offset += count;
+          stream->next_in = reader->in;
+          stream->avail_in = count;
+        }
+
+      stream->next_out = (unsigned char *)out;
+      stream->avail_out = space;
+      int status = inflate (stream, Z_NO_FLUSH);
+      produced = space - stream->avail_out;
+
+      if (status == Z_STREAM_END)
+        {
+          reader->members++;
+          inflateReset (stream);
+        }
+      else if (status == Z_DATA_ERROR && reader->members > 0
+               && stream->total_in < GZIP_HEADER_SIZE)
+        {
+          // Trailing junk such as zero padding
+          reader->finished = 1;
+        }
+      else if (status != Z_OK && status != Z_BUF_ERROR)
+        {
+          errno = EIO;
+          return -1;
+        }
+    }
+  return produced;
+}
+
+void
+gzip_reader_end (GzipReader *reader)
+{
+  inflateEnd (&reader->stream);
+  free (reader->in);
+  reader->in = NULL;
+}
+
+// Inflates a whole gzip file into one allocation, so the compressed file is
+// never held in memory. Returns NULL when the file is damaged or cut short,
+// so the caller can show the raw bytes instead.
+char *
+gzip_read_contents (FILE *file, size_t *size)
+{
+  size_t capacity = gzip_size_hint (file) + 1;
+  if (capacity < GZIP_CHUNK)
+    capacity = GZIP_CHUNK;
+
+  GzipReader reader;
+  if (gzip_reader_init (&reader, fileno (file)) != 0)
+    return NULL;
+
+  size_t length = 0;
+  int failed = 0;
+  char *contents = malloc (capacity);
+  if (!contents)
+    failed = 1;
+
+  while (!failed)
+    {
+      if (length == capacity)
+        {
+          char *grown = realloc (contents, capacity * 2);
+          if (!grown)
+            {
+              failed = 1;
+              break;
+            }
+          contents = grown;
+          capacity *= 2;
+        }
+
+      ssize_t count = gzip_reader_read (&reader, contents + length,
+                                        capacity - length);
+      if (count < 0)
+        failed = 1;
+      else if (count == 0)
+        break;
+      else
+        length += count;
+    }
+
+  gzip_reader_end (&reader);
+  if (failed)
+    {
+      free (contents);
+      return NULL;
+    }
+
+  *size = length;
+  return contents;
+}
+
+static int
+write_all (int fd, const unsigned char *bytes, size_t length)
+{
+  while (length > 0)
+    {
+      ssize_t written = write (fd, bytes, length);
+      if (written < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          return -1;
+        }
+      bytes += written;
+      length -= written;
+    }
+  return 0;
+}
+
+int
+gzip_writer_init (GzipWriter *writer, int fd)
+{
+  memset (&writer->stream, 0, sizeof (writer->stream));
+  writer->fd = fd;
+  writer->out = malloc (GZIP_CHUNK);
+  if (!writer->out
+      || deflateInit2 (&writer->stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                       16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY)
+             != Z_OK)
+    {
+      free (writer->out);
+      writer->out = NULL;
+      errno = ENOMEM;
+      return -1;
+    }
+  return 0;
+}
+
+// Runs deflate over whatever input is pending and writes out everything it
+// produces.
+static int
+deflate_pending (GzipWriter *writer, int flush)
+{
+  do
+    {
+      writer->stream.next_out = writer->out;
+      writer->stream.avail_out = GZIP_CHUNK;
+      if (deflate (&writer->stream, flush) == Z_STREAM_ERROR)
+        {
+          errno = EIO;
+          return -1;
+        }
+      if (write_all (writer->fd, writer->out,
+                     GZIP_CHUNK - writer->stream.avail_out)
+          != 0)
+        return -1;
+    }
+  while (writer->stream.avail_out == 0);
+
+  return 0;
+}
+
+int
+gzip_writer_write (GzipWriter *writer, const char *bytes, size_t length)
+{
+  while (length > 0)
+    {
+      size_t part = length < GZIP_MAX_INPUT ? length : GZIP_MAX_INPUT;
+      writer->stream.next_in = (unsigned char *)bytes;
+      writer->stream.avail_in = part;
+      if (deflate_pending (writer, Z_NO_FLUSH) != 0)
+        return -1;
+      bytes += part;
+      length -= part;
+    }
+  return 0;
+}
+
+// Writes the gzip trailer and releases the writer, which is released even
+// when writing fails.
+int
+gzip_writer_finish (GzipWriter *writer)
+{
+  int status = deflate_pending (writer, Z_FINISH);
+  deflateEnd (&writer->stream);
+  free (writer->out);
+  writer->out = NULL;
+  return status;
+}
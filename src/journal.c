@@ -0,0 +1,524 @@
+#define _DEFAULT_SOURCE
+
+#include "journal.h"
+#include "line_index.h"
+#include "undo.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#define JOURNAL_SUFFIX ".ben-journal"
+#define JOURNAL_MIN_PENDING 4096
+
+// .name.ben-journal in the directory of `filename`.
+static char *
+journal_path (const char *filename)
+{
+  const char *slash = strrchr (filename, '/');
+  int directory_length = slash ? (int)(slash - filename) + 1 : 0;
+  size_t size = strlen (filename) + sizeof ("." JOURNAL_SUFFIX);
+
+  char *path = malloc (size);
+  if (path)
+    {
+      snprintf (path, size, "%.*s.%s" JOURNAL_SUFFIX, directory_length,
+                filename, filename + directory_length);
+    }
+  return path;
+}
+
+static void
+fill_header (JournalHeader *header, const FileIdentity *disk)
+{
+  memset (header, 0, sizeof (*header));
+  memcpy (header->magic, JOURNAL_MAGIC, sizeof (header->magic));
+  if (disk->valid)
+    {
+      header->device = disk->device;
+      header->inode = disk->inode;
+      header->size = disk->size;
+      header->mtime_sec = disk->mtime_sec;
+      header->mtime_nsec = disk->mtime_nsec;
+    }
+}
+
+static uint32_t
+record_checksum (const JournalRecord *record, const char *data)
+{
+  uLong crc = crc32 (0L, (const Bytef *)&record->length,
+                     sizeof (*record) - sizeof (record->checksum));
+  // crc32() of a NULL buffer is the initial value, not `crc`
+  if (record->length == 0)
+    return crc;
+  return crc32 (crc, (const Bytef *)data, record->length);
+}
+
+static int
+write_all (int fd, const void *bytes, size_t length)
+{
+  const char *next = bytes;
+  while (length > 0)
+    {
+      ssize_t written = write (fd, next, length);
+      if (written < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          return -1;
+        }
+      next += written;
+      length -= written;
+    }
+  return 0;
+}
+
+// Makes one logged edit the way the editor made it, undo entry included.
+// Undos and redos were logged as the edits they made. Returns 0 when the
+// record does not fit the buffer.
+static int
+replay_record (TextBuffer *buffer, const JournalRecord *record,
+               const char *data)
+{
+  Line *line = NULL;
+  if (record->line != JOURNAL_NO_LINE)
+    {
+      line = line_index_find (buffer, record->line);
+      if (line == NULL)
+        return 0;
+    }
+  else if (record->type != UNDO_INSERT_LINE
+           && record->type != UNDO_DELETE_LINE)
+    {
+      return 0;
+    }
+
+  size_t column = record->column;
+  size_t length = line ? line_get_length (line) : 0;
+
+  switch (record->type)
+    {
+    case UNDO_INSERT_CHAR:
+      if (column > length || record->length != 1)
+        return 0;
+      push_undo_operation (UNDO_INSERT_CHAR, line, column, data, 1);
+      line_insert_char_at (line, column, data[0]);
+      column++;
+      break;
+
+    case UNDO_DELETE_CHAR:
+      if (column >= length)
+        return 0;
+      push_undo_operation (UNDO_DELETE_CHAR, line, column, data,
+                           record->length);
+      line_delete_char_at (line, column);
+      break;
+
+    case UNDO_SPLIT_LINE:
+      if (column > length)
+        return 0;
+      push_undo_operation (UNDO_SPLIT_LINE, line, column, NULL, 0);
+      line = buffer_replace_range (buffer, line, column, line, column, "\n", 1,
+                                   &column);
+      break;
+
+    case UNDO_MERGE_LINES:
+      if (column != length || line->next == NULL)
+        return 0;
+      push_undo_operation (UNDO_MERGE_LINES, line, column, NULL, 0);
+      invalidate_undo_operations_for_line (line->next);
+      buffer_replace_range (buffer, line, column, line->next, 0, NULL, 0,
+                            NULL);
+      break;
+
+    case UNDO_INSERT_LINE:
+      {
+        push_undo_operation (UNDO_INSERT_LINE, line, 0, data, record->length);
+        Line *new_line = create_new_line_empty ();
+        if (line)
+          insert_line_after (buffer, line, new_line);
+        else
+          insert_line_at_beginning (buffer, new_line);
+        if (record->length > 0)
+          line_replace_bytes (new_line, 0, 0, data, record->length);
+        line = new_line;
+        column = 0;
+        break;
+      }
+
+    case UNDO_DELETE_LINE:
+      {
+        // Logged with the text of the line it removes, so a record that
+        // has drifted onto another line is not applied
+        Line *removed = line ? line->next : buffer->head;
+        if (removed == NULL || buffer->num_lines < 2
+            || line_get_length (removed) != record->length)
+          return 0;
+        char *text = line_to_string (removed);
+        int same = text && memcmp (text, data, record->length) == 0;
+        free (text);
+        if (!same)
+          return 0;
+
+        push_undo_operation (UNDO_DELETE_LINE, line, 0, data, record->length);
+        invalidate_undo_operations_for_line (removed);
+        remove_line (buffer, removed);
+        free_line (removed);
+        line = line ? line : buffer->head;
+        column = 0;
+        break;
+      }
+
+    default:
+      return 0;
+    }
+
+  buffer->current_line_node = line;
+  buffer->current_col_offset = column;
+  return 1;
+}
+
+// Replays the log in `fd` if it was written against the contents described
+// by `expected`. A record that does not fit the buffer is skipped, not
+// dropped: it stays in the log, which replays the same way the next time.
+// Returns the offset just past the last whole record, or -1 when the log is
+// empty or belongs to other contents.
+static off_t
+replay_log (int fd, const JournalHeader *expected, TextBuffer *buffer,
+            size_t *replayed)
+{
+  struct stat st;
+  if (fstat (fd, &st) != 0 || (size_t)st.st_size < sizeof (JournalHeader))
+    return -1;
+
+  size_t size = st.st_size;
+  char *log = malloc (size);
+  if (!log || pread (fd, log, size, 0) != (ssize_t)size
+      || memcmp (log, expected, sizeof (*expected)) != 0)
+    {
+      free (log);
+      return -1;
+    }
+
+  size_t offset = sizeof (JournalHeader);
+  if (offset < size)
+    {
+      // Logged line numbers count every line of the file
+      buffer_load_all (buffer);
+    }
+
+  while (size - offset >= sizeof (JournalRecord))
+    {
+      JournalRecord record;
+      memcpy (&record, log + offset, sizeof (record));
+      const char *data = log + offset + sizeof (record);
+
+      // A record cut short by a crash ends the log
+      if (record.length > size - offset - sizeof (record)
+          || record_checksum (&record, data) != record.checksum)
+        break;
+
+      if (replay_record (buffer, &record, data))
+        (*replayed)++;
+      offset += sizeof (record) + record.length;
+    }
+
+  if (*replayed > 0)
+    refresh_cursor_position (buffer);
+
+  free (log);
+  return offset;
+}
+
+static void *
+journal_thread (void *arg)
+{
+  Journal *journal = arg;
+  char *batch = NULL;
+  size_t batch_capacity = 0;
+
+  pthread_mutex_lock (&journal->lock);
+  for (;;)
+    {
+      while (journal->pending_length == 0 && !journal->stop)
+        {
+          pthread_cond_wait (&journal->wake, &journal->lock);
+        }
+      if (journal->pending_length == 0)
+        break;
+
+      // Trade buffers so edits keep queuing while this batch is written
+      char *bytes = journal->pending;
+      size_t length = journal->pending_length;
+      size_t capacity = journal->pending_capacity;
+      journal->pending = batch;
+      journal->pending_capacity = batch_capacity;
+      journal->pending_length = 0;
+      batch = bytes;
+      batch_capacity = capacity;
+
+      int failed = journal->failed;
+      journal->writing = 1;
+      pthread_mutex_unlock (&journal->lock);
+
+      if (!failed)
+        {
+          failed = write_all (journal->fd, bytes, length) != 0
+                   || fdatasync (journal->fd) != 0;
+        }
+
+      pthread_mutex_lock (&journal->lock);
+      journal->failed = failed;
+      journal->writing = 0;
+      pthread_cond_broadcast (&journal->idle);
+    }
+  pthread_mutex_unlock (&journal->lock);
+
+  free (batch);
+  return NULL;
+}
+
+// Opens the log for `filename`, whose contents are already in `buffer`. A
+// log left behind by a crash is replayed into the buffer first when it was
+// written against the same file, and *replayed counts the edits it made.
+// Returns NULL when there is nowhere to log or another ben is logging edits
+// to the same file; editing works as before then, without the log.
+Journal *
+journal_open (const char *filename, TextBuffer *buffer, size_t *replayed)
+{
+  *replayed = 0;
+
+  char *path = journal_path (filename);
+  if (!path)
+    return NULL;
+
+  int fd = open (path, O_RDWR | O_CREAT | O_APPEND, 0600);
+  if (fd < 0)
+    {
+      free (path);
+      return NULL;
+    }
+
+  // The lock goes away with its owner, crashed or not
+  if (flock (fd, LOCK_EX | LOCK_NB) != 0)
+    {
+      close (fd);
+      free (path);
+      return NULL;
+    }
+
+  JournalHeader header;
+  fill_header (&header, &buffer->disk);
+  off_t end = replay_log (fd, &header, buffer, replayed);
+
+  int status;
+  if (end >= 0)
+    {
+      // Drop a record torn by the crash so new records follow on
+      status = ftruncate (fd, end);
+    }
+  else
+    {
+      status = ftruncate (fd, 0);
+      if (status == 0)
+        status = write_all (fd, &header, sizeof (header));
+    }
+  if (status == 0)
+    status = fdatasync (fd);
+
+  Journal *journal = calloc (1, sizeof (Journal));
+  if (status != 0 || !journal)
+    {
+      free (journal);
+      close (fd);
+      free (path);
+      return NULL;
+    }
+
+  journal->fd = fd;
+  journal->path = path;
+  journal->logged = end >= 0 ? (uint64_t)end - sizeof (header) : 0;
+  pthread_mutex_init (&journal->lock, NULL);
+  pthread_cond_init (&journal->wake, NULL);
+  pthread_cond_init (&journal->idle, NULL);
+
+  if (pthread_create (&journal->thread, NULL, journal_thread, journal) != 0)
+    {
+      pthread_mutex_destroy (&journal->lock);
+      pthread_cond_destroy (&journal->wake);
+      pthread_cond_destroy (&journal->idle);
+      close (fd);
+      free (path);
+      free (journal);
+      return NULL;
+    }
+
+  return journal;
+}
+
+// Queues one edit for the log. Never waits for the disk.
+void
+journal_record (Journal *journal, int type, uint64_t line, uint64_t column,
+                const char *data, size_t length)
+{
+  JournalRecord record;
+  memset (&record, 0, sizeof (record));
+  record.length = length;
+  record.line = line;
+  record.column = column;
+  record.type = type;
+  record.checksum = record_checksum (&record, data);
+
+  pthread_mutex_lock (&journal->lock);
+
+  size_t needed = journal->pending_length + sizeof (record) + length;
+  if (needed > journal->pending_capacity)
+    {
+      size_t capacity = journal->pending_capacity ? journal->pending_capacity
+                                                  : JOURNAL_MIN_PENDING;
+      while (capacity < needed)
+        {
+          capacity *= 2;
+        }
+
+      char *grown = realloc (journal->pending, capacity);
+      if (!grown)
+        {
+          journal->failed = 1;
+          pthread_mutex_unlock (&journal->lock);
+          return;
+        }
+      journal->pending = grown;
+      journal->pending_capacity = capacity;
+    }
+
+  memcpy (journal->pending + journal->pending_length, &record,
+          sizeof (record));
+  if (length > 0)
+    {
+      memcpy (journal->pending + journal->pending_length + sizeof (record),
+              data, length);
+    }
+  journal->pending_length = needed;
+  journal->logged += sizeof (record) + length;
+
+  pthread_cond_signal (&journal->wake);
+  pthread_mutex_unlock (&journal->lock);
+}
+
+// Where the next record will go, for journal_checkpoint_at().
+uint64_t
+journal_position (Journal *journal)
+{
+  pthread_mutex_lock (&journal->lock);
+  uint64_t position = journal->logged;
+  pthread_mutex_unlock (&journal->lock);
+  return position;
+}
+
+// Starts the log over once the buffer has been saved as `disk`: every edit
+// logged so far is in the file now.
+int
+journal_checkpoint (Journal *journal, const FileIdentity *disk)
+{
+  return journal_checkpoint_at (journal, disk, UINT64_MAX);
+}
+
+// Starts the log over once the edits logged before `position` have been
+// saved as `disk`. Those after it were made to the contents being saved, so
+// they stay and replay on top of the new file.
+int
+journal_checkpoint_at (Journal *journal, const FileIdentity *disk,
+                       uint64_t position)
+{
+  JournalHeader header;
+  fill_header (&header, disk);
+
+  pthread_mutex_lock (&journal->lock);
+  while (journal->writing)
+    {
+      pthread_cond_wait (&journal->idle, &journal->lock);
+    }
+
+  if (position > journal->logged)
+    position = journal->logged;
+
+  // Records still to keep: the end of the file, then all of `pending`, or
+  // only the end of `pending` when the position has not been written yet
+  uint64_t in_file = journal->logged - journal->pending_length;
+  char *kept = NULL;
+  size_t kept_length = 0;
+  int lost = 0;
+  if (position < in_file)
+    {
+      kept_length = in_file - position;
+      kept = malloc (kept_length);
+      if (!kept
+          || pread (journal->fd, kept, kept_length,
+                    sizeof (header) + position)
+                 != (ssize_t)kept_length)
+        {
+          // Later records cannot replay without these; stop logging
+          kept_length = 0;
+          journal->pending_length = 0;
+          lost = 1;
+        }
+    }
+  else
+    {
+      size_t dropped = position - in_file;
+      if (dropped > 0)
+        {
+          memmove (journal->pending, journal->pending + dropped,
+                   journal->pending_length - dropped);
+          journal->pending_length -= dropped;
+        }
+    }
+
+  int status = ftruncate (journal->fd, 0);
+  if (status == 0)
+    status = write_all (journal->fd, &header, sizeof (header));
+  if (status == 0 && kept_length > 0)
+    status = write_all (journal->fd, kept, kept_length);
+  if (status == 0)
+    status = fdatasync (journal->fd);
+  journal->failed = status != 0 || lost;
+  journal->logged = kept_length + journal->pending_length;
+
+  pthread_mutex_unlock (&journal->lock);
+  free (kept);
+  return status;
+}
+
+// Flushes and closes the log. With `discard` the edits are being thrown
+// away on purpose, so the log is deleted instead of left for recovery.
+void
+journal_close (Journal *journal, int discard)
+{
+  if (!journal)
+    return;
+
+  pthread_mutex_lock (&journal->lock);
+  journal->stop = 1;
+  if (discard)
+    journal->pending_length = 0;
+  pthread_cond_signal (&journal->wake);
+  pthread_mutex_unlock (&journal->lock);
+  pthread_join (journal->thread, NULL);
+
+  if (discard)
+    unlink (journal->path);
+  close (journal->fd);
+
+  pthread_mutex_destroy (&journal->lock);
+  pthread_cond_destroy (&journal->wake);
+  pthread_cond_destroy (&journal->idle);
+  free (journal->pending);
+  free (journal->path);
+  free (journal);
+}
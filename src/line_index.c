@@ -0,0 +1,332 @@
+#include "line_index.h"
+#include <stdlib.h>
+
+static unsigned int priority_state = 2463534242u;
+
+static unsigned int
+next_priority (void)
+{
+  // xorshift32: cheap and good enough to keep the treap balanced
+  priority_state ^= priority_state << 13;
+  priority_state ^= priority_state >> 17;
+  priority_state ^= priority_state << 5;
+  return priority_state;
+}
+
+static size_t
+subtree_lines (const Line *node)
+{
+  return node ? node->subtree_lines : 0;
+}
+
+static size_t
+subtree_bytes (const Line *node)
+{
+  return node ? node->subtree_bytes : 0;
+}
+
+static unsigned int
+subtree_flags (const Line *node)
+{
+  return node ? node->subtree_flags : 0;
+}
+
+static void
+recompute (Line *node)
+{
+  node->subtree_lines
+      = subtree_lines (node->left) + subtree_lines (node->right) + 1;
+  // Every line accounts for its trailing newline
+  node->subtree_bytes = subtree_bytes (node->left)
+                        + subtree_bytes (node->right) + line_get_length (node)
+                        + 1;
+  node->subtree_flags = subtree_flags (node->left)
+                        | subtree_flags (node->right) | node->flags;
+}
+
+static void
+recompute_to_root (Line *node)
+{
+  while (node != NULL)
+    {
+      recompute (node);
+      node = node->parent;
+    }
+}
+
+static void
+replace_child (TextBuffer *buffer, Line *parent, Line *old_child,
+               Line *new_child)
+{
+  if (parent == NULL)
+    {
+      buffer->index_root = new_child;
+    }
+  else if (parent->left == old_child)
+    {
+      parent->left = new_child;
+    }
+  else
+    {
+      parent->right = new_child;
+    }
+
+  if (new_child != NULL)
+    {
+      new_child->parent = parent;
+    }
+}
+
+// Rotates `node` above its parent, keeping in-order position intact.
+static void
+rotate_up (TextBuffer *buffer, Line *node)
+{
+  Line *parent = node->parent;
+  Line *grandparent = parent->parent;
+
+  if (parent->left == node)
+    {
+      parent->left = node->right;
+      if (node->right)
+        node->right->parent = parent;
+      node->right = parent;
+    }
+  else
+    {
+      parent->right = node->left;
+      if (node->left)
+        node->left->parent = parent;
+      node->left = parent;
+    }
+
+  parent->parent = node;
+  replace_child (buffer, grandparent, parent, node);
+
+  recompute (parent);
+  recompute (node);
+}
+
+void
+line_index_init_node (Line *line)
+{
+  line->parent = NULL;
+  line->left = NULL;
+  line->right = NULL;
+  line->priority = next_priority ();
+  line->subtree_lines = 1;
+  line->subtree_bytes = line_get_length (line) + 1;
+  line->subtree_flags = line->flags;
+}
+
+// Must be called after new_line has been linked into the list behind
+// prev_line (or at the head when prev_line is NULL).
+void
+line_index_insert_after (TextBuffer *buffer, Line *prev_line, Line *new_line)
+{
+  line_index_init_node (new_line);
+
+  if (buffer->index_root == NULL)
+    {
+      buffer->index_root = new_line;
+      return;
+    }
+
+  // The in-order successor of prev_line is the list successor of new_line,
+  // and it has no left child whenever prev_line has a right subtree.
+  if (prev_line != NULL && prev_line->right == NULL)
+    {
+      prev_line->right = new_line;
+      new_line->parent = prev_line;
+    }
+  else
+    {
+      Line *successor = new_line->next;
+      successor->left = new_line;
+      new_line->parent = successor;
+    }
+
+  while (new_line->parent != NULL
+         && new_line->parent->priority < new_line->priority)
+    {
+      rotate_up (buffer, new_line);
+    }
+  recompute_to_root (new_line);
+}
+
+void
+line_index_remove (TextBuffer *buffer, Line *line)
+{
+  while (line->left != NULL && line->right != NULL)
+    {
+      Line *child = line->left->priority > line->right->priority
+                        ? line->left
+                        : line->right;
+      rotate_up (buffer, child);
+    }
+
+  Line *child = line->left ? line->left : line->right;
+  Line *parent = line->parent;
+  replace_child (buffer, parent, line, child);
+  recompute_to_root (parent);
+
+  line->parent = NULL;
+  line->left = NULL;
+  line->right = NULL;
+  line->subtree_lines = 1;
+  line->subtree_bytes = line_get_length (line) + 1;
+  line->subtree_flags = line->flags;
+}
+
+// Builds the tree for the whole list in O(n) by keeping the right spine of
+// the tree built so far (a Cartesian-tree construction over the priorities).
+void
+line_index_build (TextBuffer *buffer)
+{
+  Line *rightmost = NULL;
+  buffer->index_root = NULL;
+
+  for (Line *line = buffer->head; line != NULL; line = line->next)
+    {
+      line_index_init_node (line);
+
+      Line *child = NULL;
+      Line *top = rightmost;
+      while (top != NULL && top->priority < line->priority)
+        {
+          // top's subtree is complete once it leaves the right spine
+          recompute (top);
+          child = top;
+          top = top->parent;
+        }
+
+      line->left = child;
+      if (child != NULL)
+        child->parent = line;
+
+      line->parent = top;
+      if (top != NULL)
+        top->right = line;
+      else
+        buffer->index_root = line;
+
+      rightmost = line;
+    }
+
+  recompute_to_root (rightmost);
+}
+
+void
+line_index_update (Line *line)
+{
+  recompute_to_root (line);
+}
+
+Line *
+line_index_find (const TextBuffer *buffer, size_t line_num)
+{
+  Line *node = buffer->index_root;
+
+  while (node != NULL)
+    {
+      size_t left_lines = subtree_lines (node->left);
+      if (line_num < left_lines)
+        {
+          node = node->left;
+        }
+      else if (line_num == left_lines)
+        {
+          return node;
+        }
+      else
+        {
+          line_num -= left_lines + 1;
+          node = node->right;
+        }
+    }
+
+  return NULL;
+}
+
+static Line *
+find_flagged (Line *node, size_t from, unsigned int flags)
+{
+  if (node == NULL || !(node->subtree_flags & flags))
+    return NULL;
+
+  size_t left_lines = subtree_lines (node->left);
+  if (from < left_lines)
+    {
+      Line *found = find_flagged (node->left, from, flags);
+      if (found != NULL)
+        return found;
+    }
+
+  if (from <= left_lines && (node->flags & flags))
+    return node;
+
+  size_t right_from = from > left_lines ? from - left_lines - 1 : 0;
+  return find_flagged (node->right, right_from, flags);
+}
+
+// Returns the first line numbered `from` or later with any of `flags` set.
+Line *
+line_index_find_flagged (const TextBuffer *buffer, size_t from,
+                         unsigned int flags)
+{
+  return find_flagged (buffer->index_root, from, flags);
+}
+
+size_t
+line_index_position (const Line *line)
+{
+  size_t position = subtree_lines (line->left);
+
+  while (line->parent != NULL)
+    {
+      if (line->parent->right == line)
+        {
+          position += subtree_lines (line->parent->left) + 1;
+        }
+      line = line->parent;
+    }
+
+  return position;
+}
+
+size_t
+line_index_byte_offset (const Line *line)
+{
+  size_t offset = subtree_bytes (line->left);
+
+  while (line->parent != NULL)
+    {
+      if (line->parent->right == line)
+        {
+          offset += subtree_bytes (line->parent->left)
+                    + line_get_length (line->parent) + 1;
+        }
+      line = line->parent;
+    }
+
+  return offset;
+}
+
+size_t
+line_index_total_bytes (const TextBuffer *buffer)
+{
+  return subtree_bytes (buffer->index_root);
+}
+
+int
+line_index_contains (const TextBuffer *buffer, const Line *line)
+{
+  if (!buffer || !line)
+    return 0;
+
+  while (line->parent != NULL)
+    {
+      line = line->parent;
+    }
+
+  return line == buffer->index_root;
+}
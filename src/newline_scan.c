@@ -0,0 +1,158 @@
+#include "newline_scan.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86 1
+#endif
+
+typedef uint64_t (*BlockMaskFn) (const char *block);
+
+#if defined(HAVE_X86) && defined(__SSE2__)
+static uint64_t
+block_mask_sse2 (const char *block)
+{
+  const __m128i newline = _mm_set1_epi8 ('\n');
+  uint64_t mask = 0;
+
+  for (int i = 0; i < NEWLINE_SCAN_BLOCK; i += 16)
+    {
+      __m128i bytes = _mm_loadu_si128 ((const __m128i *)(block + i));
+      uint32_t bits
+          = (uint32_t)_mm_movemask_epi8 (_mm_cmpeq_epi8 (bytes, newline));
+      mask |= (uint64_t)bits << i;
+    }
+
+  return mask;
+}
+#endif
+
+#if defined(HAVE_X86) && defined(__GNUC__)
+__attribute__ ((target ("avx2"))) static uint64_t
+block_mask_avx2 (const char *block)
+{
+  const __m256i newline = _mm256_set1_epi8 ('\n');
+  __m256i low = _mm256_loadu_si256 ((const __m256i *)block);
+  __m256i high = _mm256_loadu_si256 ((const __m256i *)(block + 32));
+  uint32_t low_bits
+      = (uint32_t)_mm256_movemask_epi8 (_mm256_cmpeq_epi8 (low, newline));
+  uint32_t high_bits
+      = (uint32_t)_mm256_movemask_epi8 (_mm256_cmpeq_epi8 (high, newline));
+  return (uint64_t)high_bits << 32 | low_bits;
+}
+#endif
+
+// Portable fallback: flags the zero bytes of each word XOR-ed with
+// "\n\n\n\n\n\n\n\n" and gathers the flags into one bit per byte.
+static uint64_t
+block_mask_swar (const char *block)
+{
+  const uint64_t newlines = 0x0a0a0a0a0a0a0a0aULL;
+  const uint64_t low7 = 0x7f7f7f7f7f7f7f7fULL;
+  uint64_t mask = 0;
+
+  for (int i = 0; i < NEWLINE_SCAN_BLOCK; i += 8)
+    {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+      uint64_t word;
+      memcpy (&word, block + i, sizeof (word));
+      word ^= newlines;
+      uint64_t zero = ~(((word & low7) + low7) | word | low7);
+      uint64_t bits = ((zero >> 7) * 0x0102040810204080ULL) >> 56;
+      mask |= bits << i;
+#else
+      for (int j = 0; j < 8; j++)
+        {
+          if (block[i + j] == '\n')
+            mask |= (uint64_t)1 << (i + j);
+        }
+#endif
+    }
+
+  return mask;
+}
+
+static BlockMaskFn block_mask = NULL;
+static const char *method_name = "swar";
+
+static void
+choose_block_mask (void)
+{
+  block_mask = block_mask_swar;
+#if defined(HAVE_X86) && defined(__SSE2__)
+  block_mask = block_mask_sse2;
+  method_name = "sse2";
+#endif
+#if defined(HAVE_X86) && defined(__GNUC__)
+  if (__builtin_cpu_supports ("avx2"))
+    {
+      block_mask = block_mask_avx2;
+      method_name = "avx2";
+    }
+#endif
+}
+
+const char *
+newline_scan_method (void)
+{
+  if (block_mask == NULL)
+    choose_block_mask ();
+  return method_name;
+}
+
+// Fills scanner->mask for the block at scanner->block. The last, partial
+// block is checked byte by byte so nothing past `length` is read.
+static void
+load_block (NewlineScanner *scanner)
+{
+  size_t remaining = scanner->length - scanner->block;
+  const char *block = scanner->data + scanner->block;
+
+  if (remaining >= NEWLINE_SCAN_BLOCK)
+    {
+      scanner->mask = block_mask (block);
+      return;
+    }
+
+  scanner->mask = 0;
+  for (size_t i = 0; i < remaining; i++)
+    {
+      if (block[i] == '\n')
+        scanner->mask |= (uint64_t)1 << i;
+    }
+}
+
+void
+newline_scanner_init (NewlineScanner *scanner, const char *data, size_t start,
+                      size_t length)
+{
+  if (block_mask == NULL)
+    choose_block_mask ();
+
+  scanner->data = data;
+  scanner->length = length;
+  scanner->block = start;
+  scanner->mask = 0;
+  if (start < length)
+    load_block (scanner);
+}
+
+// Returns the offset of the next newline, or `length` when there is none.
+size_t
+newline_scanner_next (NewlineScanner *scanner)
+{
+  while (scanner->mask == 0)
+    {
+      scanner->block += NEWLINE_SCAN_BLOCK;
+      if (scanner->block >= scanner->length)
+        {
+          scanner->block = scanner->length;
+          return scanner->length;
+        }
+      load_block (scanner);
+    }
+
+  size_t offset = scanner->block + (size_t)__builtin_ctzll (scanner->mask);
+  scanner->mask &= scanner->mask - 1;
+  return offset;
+}
@@ -0,0 +1,342 @@
+#define _DEFAULT_SOURCE
+
+#include "pager.h"
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static size_t
+page_size (void)
+{
+  static size_t size = 0;
+  if (size == 0)
+    size = (size_t)sysconf (_SC_PAGESIZE);
+  return size;
+}
+
+static int
+add_region (Pager *pager, char *base, size_t length)
+{
+  PagerRegion *regions = realloc (
+      pager->regions, (pager->num_regions + 1) * sizeof (PagerRegion));
+  if (!regions)
+    return 0;
+  pager->regions = regions;
+
+  PagerRegion *region = &regions[pager->num_regions];
+  region->base = base;
+  region->length = length;
+  region->num_windows = (length + PAGER_WINDOW_SIZE - 1) / PAGER_WINDOW_SIZE;
+  region->windows = calloc (region->num_windows ? region->num_windows : 1,
+                            sizeof (PagerWindow));
+  if (!region->windows)
+    return 0;
+  for (size_t w = 0; w < region->num_windows; w++)
+    {
+      region->windows[w].region = pager->num_regions;
+    }
+
+  pager->num_regions++;
+  return 1;
+}
+
+// `mapping` must be a page-aligned, read-only mapping of a file, so that
+// dropped pages read back the same bytes.
+Pager *
+pager_create (char *mapping, size_t length, size_t budget)
+{
+  Pager *pager = calloc (1, sizeof (Pager));
+  if (!pager)
+    return NULL;
+
+  pager->budget = budget;
+  pager->spill_fd = -1;
+  pager->pagemap_fd = open ("/proc/self/pagemap", O_RDONLY);
+  if (!add_region (pager, mapping, length))
+    {
+      pager_destroy (pager);
+      return NULL;
+    }
+  return pager;
+}
+
+// Unmaps the spill segments; the file mapping belongs to the store.
+void
+pager_destroy (Pager *pager)
+{
+  if (!pager)
+    return;
+
+  for (size_t i = 0; i < pager->num_regions; i++)
+    {
+      if (i > 0)
+        munmap (pager->regions[i].base, pager->regions[i].length);
+      free (pager->regions[i].windows);
+    }
+  free (pager->regions);
+  if (pager->spill_fd >= 0)
+    close (pager->spill_fd);
+  if (pager->pagemap_fd >= 0)
+    close (pager->pagemap_fd);
+  free (pager);
+}
+
+void
+pager_begin_tick (Pager *pager)
+{
+  pager->tick++;
+}
+
+static void
+unlist_window (Pager *pager, PagerWindow *window)
+{
+  if (!window->listed)
+    return;
+
+  if (window->prev)
+    window->prev->next = window->next;
+  else
+    pager->lru_head = window->next;
+  if (window->next)
+    window->next->prev = window->prev;
+  else
+    pager->lru_tail = window->prev;
+
+  window->prev = window->next = NULL;
+  window->listed = 0;
+  pager->num_listed--;
+}
+
+// Puts a window on the LRU list, at the most recently used end or, for
+// windows that start out cold, at the other.
+static void
+list_window (Pager *pager, PagerWindow *window, int cold)
+{
+  unlist_window (pager, window);
+
+  if (cold)
+    {
+      window->prev = pager->lru_tail;
+      if (pager->lru_tail)
+        pager->lru_tail->next = window;
+      else
+        pager->lru_head = window;
+      pager->lru_tail = window;
+    }
+  else
+    {
+      window->next = pager->lru_head;
+      if (pager->lru_head)
+        pager->lru_head->prev = window;
+      else
+        pager->lru_tail = window;
+      pager->lru_head = window;
+    }
+
+  window->listed = 1;
+  pager->num_listed++;
+}
+
+// Marks the windows holding [address, address + length) as used in the
+// current tick, and as possibly in memory. Anything that reads the mapping
+// should say so here, or its pages are neither counted nor dropped.
+// Addresses outside the pager's regions are ignored.
+void
+pager_touch (Pager *pager, const char *address, size_t length)
+{
+  for (size_t i = 0; i < pager->num_regions; i++)
+    {
+      PagerRegion *region = &pager->regions[i];
+      if (address < region->base || address >= region->base + region->length)
+        continue;
+
+      size_t offset = address - region->base;
+      size_t last = offset + (length ? length - 1 : 0);
+      if (last >= region->length)
+        last = region->length - 1;
+      size_t first = offset / PAGER_WINDOW_SIZE;
+      for (size_t w = first; w <= last / PAGER_WINDOW_SIZE; w++)
+        {
+          PagerWindow *window = &region->windows[w];
+          window->last_used = pager->tick;
+          if (pager->lru_head != window)
+            list_window (pager, window, 0);
+        }
+      return;
+    }
+}
+
+static int
+open_spill_file (Pager *pager)
+{
+  const char *directory = getenv ("TMPDIR");
+  char name[4096];
+  snprintf (name, sizeof (name), "%s/ben-spill-XXXXXX",
+            directory ? directory : "/tmp");
+
+  pager->spill_fd = mkstemp (name);
+  if (pager->spill_fd < 0)
+    return 0;
+  // Nobody else needs to see it, and it goes away with the editor
+  unlink (name);
+  return 1;
+}
+
+static int
+add_spill_segment (Pager *pager)
+{
+  if (pager->spill_fd < 0 && !open_spill_file (pager))
+    return 0;
+
+  size_t segments = pager->num_regions - 1;
+  off_t offset = (off_t)segments * PAGER_SPILL_SEGMENT_SIZE;
+  if (ftruncate (pager->spill_fd, offset + PAGER_SPILL_SEGMENT_SIZE) != 0)
+    return 0;
+
+  char *base = mmap (NULL, PAGER_SPILL_SEGMENT_SIZE, PROT_READ | PROT_WRITE,
+                     MAP_SHARED, pager->spill_fd, offset);
+  if (base == MAP_FAILED)
+    return 0;
+
+  if (!add_region (pager, base, PAGER_SPILL_SEGMENT_SIZE))
+    {
+      munmap (base, PAGER_SPILL_SEGMENT_SIZE);
+      return 0;
+    }
+  pager->spill_used = 0;
+  return 1;
+}
+
+// Copies `length` bytes into the spill file and returns where they can be
+// read from, or NULL if they do not fit. Spilled text is never freed; it
+// starts out cold so it is the first to be dropped.
+const char *
+pager_spill (Pager *pager, const char *bytes, size_t length)
+{
+  if (length > PAGER_SPILL_SEGMENT_SIZE)
+    return NULL;
+
+  if (pager->num_regions == 1
+      || pager->spill_used + length > PAGER_SPILL_SEGMENT_SIZE)
+    {
+      if (!add_spill_segment (pager))
+        return NULL;
+    }
+
+  PagerRegion *segment = &pager->regions[pager->num_regions - 1];
+  char *copy = segment->base + pager->spill_used;
+  memcpy (copy, bytes, length);
+
+  size_t first = pager->spill_used / PAGER_WINDOW_SIZE;
+  size_t last = (pager->spill_used + (length ? length - 1 : 0))
+                / PAGER_WINDOW_SIZE;
+  for (size_t w = first; w <= last; w++)
+    {
+      if (!segment->windows[w].listed)
+        list_window (pager, &segment->windows[w], 1);
+    }
+  pager->spill_used += length;
+  pager->spilled_bytes += length;
+  return copy;
+}
+
+// Bytes of one window mapped into this process right now. The page map
+// tells what this process has mapped; mincore, the fallback, reports the
+// page cache instead for files the user can write, so dropped pages of such
+// files still count there.
+static size_t
+window_resident (const Pager *pager, const PagerRegion *region, size_t window)
+{
+  size_t page = page_size ();
+  size_t offset = window * PAGER_WINDOW_SIZE;
+  size_t length = region->length - offset;
+  if (length > PAGER_WINDOW_SIZE)
+    length = PAGER_WINDOW_SIZE;
+
+  size_t num_pages = (length + page - 1) / page;
+  size_t resident = 0;
+
+  if (pager->pagemap_fd >= 0 && num_pages <= PAGER_WINDOW_SIZE / 4096)
+    {
+      uint64_t entries[PAGER_WINDOW_SIZE / 4096];
+      off_t entry = (off_t)((uintptr_t)(region->base + offset) / page)
+                    * (off_t)sizeof (uint64_t);
+      ssize_t bytes = num_pages * sizeof (uint64_t);
+      if (pread (pager->pagemap_fd, entries, bytes, entry) == bytes)
+        {
+          for (size_t i = 0; i < num_pages; i++)
+            {
+              if (entries[i] >> 63)
+                resident += page;
+            }
+          return resident;
+        }
+    }
+
+  unsigned char pages[PAGER_WINDOW_SIZE / 4096];
+  if (num_pages > sizeof (pages)
+      || mincore (region->base + offset, length, pages) != 0)
+    return length;
+
+  for (size_t i = 0; i < num_pages; i++)
+    {
+      if (pages[i] & 1)
+        resident += page;
+    }
+  return resident;
+}
+
+// Bytes in memory of the windows on the LRU list.
+size_t
+pager_resident_bytes (const Pager *pager)
+{
+  size_t resident = 0;
+  for (const PagerWindow *window = pager->lru_head; window != NULL;
+       window = window->next)
+    {
+      const PagerRegion *region = &pager->regions[window->region];
+      resident += window_resident (pager, region, window - region->windows);
+    }
+  return resident;
+}
+
+// Drops the least recently used windows not used in the current tick until
+// at most max_resident bytes are left in memory, walking the LRU list from
+// its cold end. Dropped windows, and ones the kernel already dropped, leave
+// the list until they are touched again. Returns what is left.
+size_t
+pager_evict (Pager *pager, size_t max_resident)
+{
+  size_t resident = pager_resident_bytes (pager);
+
+  PagerWindow *window = pager->lru_tail;
+  while (window != NULL && resident > max_resident
+         && window->last_used != pager->tick)
+    {
+      PagerWindow *prev = window->prev;
+      PagerRegion *region = &pager->regions[window->region];
+      size_t index = window - region->windows;
+      size_t offset = index * PAGER_WINDOW_SIZE;
+      size_t length = region->length - offset;
+      if (length > PAGER_WINDOW_SIZE)
+        length = PAGER_WINDOW_SIZE;
+
+      size_t bytes = window_resident (pager, region, index);
+      // Clean file pages and shared spill pages both read back from their
+      // file after this
+      if (bytes == 0)
+        unlist_window (pager, window);
+      else if (madvise (region->base + offset, length, MADV_DONTNEED) == 0)
+        {
+          resident -= bytes;
+          unlist_window (pager, window);
+        }
+      window = prev;
+    }
+
+  return resident;
+}
@@ -0,0 +1,440 @@
+#include "piece_table.h"
+#include "pool.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define INITIAL_PIECES 4
+#define MIN_ADD_CAPACITY 4096
+#define GROWTH_FACTOR 2
+
+static Pool piece_table_pool
+    = POOL_INITIALIZER ("piecetables", sizeof (PieceTable));
+
+PieceStore *
+piece_store_create (char *original, size_t original_length)
+{
+  PieceStore *store = malloc (sizeof (PieceStore));
+  if (!store)
+    return NULL;
+
+  store->original = original;
+  store->original_length = original_length;
+  store->add = NULL;
+  store->add_length = 0;
+  store->add_capacity = 0;
+  store->mapped = 0;
+
+  return store;
+}
+
+void
+piece_store_destroy (PieceStore *store)
+{
+  if (store)
+    {
+      if (store->mapped)
+        munmap (store->original, store->original_length);
+      else
+        free (store->original);
+      free (store->add);
+      free (store);
+    }
+}
+
+static const char *
+piece_text (const PieceStore *store, const Piece *piece)
+{
+  if (piece->source == PIECE_ORIGINAL)
+    {
+      return store->original + piece->start;
+    }
+  return store->add + piece->start;
+}
+
+static int
+piece_store_reserve (PieceStore *store, size_t length)
+{
+  if (store->add_length + length <= store->add_capacity)
+    return 1;
+
+  size_t new_capacity = store->add_capacity * GROWTH_FACTOR;
+  if (new_capacity < MIN_ADD_CAPACITY)
+    new_capacity = MIN_ADD_CAPACITY;
+  if (new_capacity < store->add_length + length)
+    new_capacity = store->add_length + length;
+
+  char *new_add = realloc (store->add, new_capacity);
+  if (!new_add)
+    return 0;
+
+  store->add = new_add;
+  store->add_capacity = new_capacity;
+  return 1;
+}
+
+// Appends to the add buffer and returns the offset the bytes landed at, or
+// (size_t)-1 if the buffer could not grow.
+static size_t
+piece_store_append (PieceStore *store, const char *str, size_t length)
+{
+  if (!piece_store_reserve (store, length))
+    return (size_t)-1;
+
+  size_t start = store->add_length;
+  memcpy (store->add + start, str, length);
+  store->add_length += length;
+  return start;
+}
+
+static PieceTable *
+create_table (Pool *tables, Pool *pieces, PieceStore *store, size_t start,
+              size_t length)
+{
+  if (!store)
+    return NULL;
+
+  PieceTable *pt = pool_alloc (tables);
+  if (!pt)
+    return NULL;
+
+  size_t bytes = INITIAL_PIECES * sizeof (Piece);
+  pt->pieces = pieces ? pool_alloc (pieces) : pool_alloc_block (&bytes);
+  if (!pt->pieces)
+    {
+      pool_free (tables, pt);
+      return NULL;
+    }
+
+  pt->store = store;
+  pt->capacity = pool_block_size (bytes) / sizeof (Piece);
+  pt->num_pieces = 0;
+  pt->length = length;
+
+  if (length > 0)
+    {
+      pt->pieces[0].source = PIECE_ORIGINAL;
+      pt->pieces[0].start = start;
+      pt->pieces[0].length = length;
+      pt->num_pieces = 1;
+    }
+
+  return pt;
+}
+
+PieceTable *
+piece_table_create (PieceStore *store, size_t start, size_t length)
+{
+  return create_table (&piece_table_pool, NULL, store, start, length);
+}
+
+void
+piece_table_arena_init (PieceTableArena *arena)
+{
+  pool_init (&arena->tables, "piecetables", sizeof (PieceTable));
+  pool_init (&arena->pieces, "pieces",
+             pool_block_size (INITIAL_PIECES * sizeof (Piece)));
+}
+
+// Like piece_table_create(), allocating from `arena` instead of the shared
+// pools, which are not safe to use from more than one thread.
+PieceTable *
+piece_table_create_in (PieceTableArena *arena, PieceStore *store,
+                       size_t start, size_t length)
+{
+  return create_table (&arena->tables, &arena->pieces, store, start, length);
+}
+
+// Gives the tables made in `arena` to the shared pools, which free them
+// from then on.
+void
+piece_table_arena_merge (PieceTableArena *arena)
+{
+  pool_adopt (&piece_table_pool, &arena->tables);
+  pool_adopt_blocks (&arena->pieces);
+}
+
+void
+piece_table_destroy (PieceTable *pt)
+{
+  if (pt)
+    {
+      pool_free_block (pt->pieces, pt->capacity * sizeof (Piece));
+      pool_free (&piece_table_pool, pt);
+    }
+}
+
+size_t
+piece_table_length (const PieceTable *pt)
+{
+  return pt->length;
+}
+
+static int
+piece_table_reserve (PieceTable *pt, size_t needed)
+{
+  if (pt->capacity >= needed)
+    return 1;
+
+  size_t new_capacity = pt->capacity * GROWTH_FACTOR;
+  if (new_capacity < needed)
+    new_capacity = needed;
+
+  size_t bytes = new_capacity * sizeof (Piece);
+  Piece *new_pieces = pool_alloc_block (&bytes);
+  if (!new_pieces)
+    return 0;
+
+  memcpy (new_pieces, pt->pieces, pt->num_pieces * sizeof (Piece));
+  pool_free_block (pt->pieces, pt->capacity * sizeof (Piece));
+  pt->pieces = new_pieces;
+  pt->capacity = bytes / sizeof (Piece);
+  return 1;
+}
+
+static int
+piece_table_insert_piece (PieceTable *pt, size_t index, Piece piece)
+{
+  if (!piece_table_reserve (pt, pt->num_pieces + 1))
+    return 0;
+
+  memmove (&pt->pieces[index + 1], &pt->pieces[index],
+           (pt->num_pieces - index) * sizeof (Piece));
+  pt->pieces[index] = piece;
+  pt->num_pieces++;
+  return 1;
+}
+
+// Splits piece `index` so that a new piece begins `offset` bytes into it.
+static int
+piece_table_split (PieceTable *pt, size_t index, size_t offset)
+{
+  Piece tail = pt->pieces[index];
+  tail.start += offset;
+  tail.length -= offset;
+
+  if (!piece_table_insert_piece (pt, index + 1, tail))
+    return 0;
+
+  pt->pieces[index].length = offset;
+  return 1;
+}
+
+char
+piece_table_get_char_at (const PieceTable *pt, size_t position)
+{
+  if (position >= pt->length)
+    {
+      return '\0';
+    }
+
+  for (size_t i = 0; i < pt->num_pieces; i++)
+    {
+      const Piece *piece = &pt->pieces[i];
+      if (position < piece->length)
+        {
+          return piece_text (pt->store, piece)[position];
+        }
+      position -= piece->length;
+    }
+
+  return '\0';
+}
+
+// Sets *span to the run of text that starts at `position` and lies within one
+// piece, and returns its length (0 at the end).
+size_t
+piece_table_span_at (const PieceTable *pt, size_t position, const char **span)
+{
+  for (size_t i = 0; i < pt->num_pieces; i++)
+    {
+      const Piece *piece = &pt->pieces[i];
+      if (position < piece->length)
+        {
+          *span = piece_text (pt->store, piece) + position;
+          return piece->length - position;
+        }
+      position -= piece->length;
+    }
+
+  return 0;
+}
+
+// Like piece_table_span_at, but for the run that ends at `position`.
+size_t
+piece_table_span_before (const PieceTable *pt, size_t position,
+                         const char **span)
+{
+  for (size_t i = 0; i < pt->num_pieces; i++)
+    {
+      const Piece *piece = &pt->pieces[i];
+      if (position <= piece->length)
+        {
+          *span = piece_text (pt->store, piece);
+          return position;
+        }
+      position -= piece->length;
+    }
+
+  return 0;
+}
+
+char *
+piece_table_to_string (const PieceTable *pt)
+{
+  char *result = malloc (pt->length + 1);
+  if (!result)
+    return NULL;
+
+  size_t offset = 0;
+  for (size_t i = 0; i < pt->num_pieces; i++)
+    {
+      const Piece *piece = &pt->pieces[i];
+      memcpy (result + offset, piece_text (pt->store, piece), piece->length);
+      offset += piece->length;
+    }
+
+  result[pt->length] = '\0';
+  return result;
+}
+
+void
+piece_table_insert_bytes (PieceTable *pt, size_t position, const char *str,
+                          size_t length)
+{
+  if (length == 0)
+    return;
+
+  if (position > pt->length)
+    {
+      position = pt->length;
+    }
+
+  size_t start = piece_store_append (pt->store, str, length);
+  if (start == (size_t)-1)
+    return;
+
+  size_t index = 0;
+  size_t offset = position;
+  while (index < pt->num_pieces && offset > pt->pieces[index].length)
+    {
+      offset -= pt->pieces[index].length;
+      index++;
+    }
+
+  // Typing appends to the add buffer right behind the previous keystroke, so
+  // the piece that ends there can simply be extended.
+  if (index < pt->num_pieces && offset == pt->pieces[index].length)
+    {
+      Piece *piece = &pt->pieces[index];
+      if (piece->source == PIECE_ADD && piece->start + piece->length == start)
+        {
+          piece->length += length;
+          pt->length += length;
+          return;
+        }
+      index++;
+      offset = 0;
+    }
+
+  if (offset > 0)
+    {
+      if (!piece_table_split (pt, index, offset))
+        return;
+      index++;
+    }
+
+  Piece piece = { PIECE_ADD, start, length };
+  if (piece_table_insert_piece (pt, index, piece))
+    {
+      pt->length += length;
+    }
+}
+
+void
+piece_table_insert_char (PieceTable *pt, size_t position, char c)
+{
+  piece_table_insert_bytes (pt, position, &c, 1);
+}
+
+void
+piece_table_insert_string (PieceTable *pt, size_t position, const char *str)
+{
+  if (!str)
+    return;
+
+  piece_table_insert_bytes (pt, position, str, strlen (str));
+}
+
+void
+piece_table_delete_char (PieceTable *pt, size_t position)
+{
+  piece_table_delete_range (pt, position, 1);
+}
+
+// Splits the pieces at both ends of the range so that the deleted bytes
+// make up whole pieces, then drops those pieces in one memmove.
+void
+piece_table_delete_range (PieceTable *pt, size_t position, size_t count)
+{
+  if (position >= pt->length || count == 0)
+    return;
+
+  if (count > pt->length - position)
+    {
+      count = pt->length - position;
+    }
+
+  size_t index = 0;
+  size_t offset = position;
+  while (offset >= pt->pieces[index].length)
+    {
+      offset -= pt->pieces[index].length;
+      index++;
+    }
+
+  if (offset > 0)
+    {
+      if (!piece_table_split (pt, index, offset))
+        return;
+      index++;
+    }
+
+  size_t last = index;
+  size_t remaining = count;
+  while (last < pt->num_pieces && remaining >= pt->pieces[last].length)
+    {
+      remaining -= pt->pieces[last].length;
+      last++;
+    }
+
+  if (remaining > 0)
+    {
+      pt->pieces[last].start += remaining;
+      pt->pieces[last].length -= remaining;
+    }
+
+  memmove (&pt->pieces[index], &pt->pieces[last],
+           (pt->num_pieces - last) * sizeof (Piece));
+  pt->num_pieces -= last - index;
+  pt->length -= count;
+}
+
+void
+piece_table_truncate (PieceTable *pt, size_t position)
+{
+  if (position >= pt->length)
+    return;
+
+  size_t index = 0;
+  size_t offset = position;
+  while (offset >= pt->pieces[index].length)
+    {
+      offset -= pt->pieces[index].length;
+      index++;
+    }
+
+  pt->pieces[index].length = offset;
+  pt->num_pieces = offset > 0 ? index + 1 : index;
+  pt->length = position;
+}
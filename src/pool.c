@@ -0,0 +1,312 @@
+#include "pool.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MIN_BLOCK_SIZE 16
+#define NUM_BLOCK_CLASSES 5 // 16, 32, 64, 128, 256
+
+// Private pools grow on loader threads, so registering takes a lock
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static Pool *registered_pools = NULL;
+
+static Pool block_pools[NUM_BLOCK_CLASSES] = {
+  POOL_INITIALIZER ("text16", 16),   POOL_INITIALIZER ("text32", 32),
+  POOL_INITIALIZER ("text64", 64),   POOL_INITIALIZER ("text128", 128),
+  POOL_INITIALIZER ("text256", 256),
+};
+
+static size_t
+align_object_size (size_t size)
+{
+  size_t align = sizeof (void *);
+  if (size < sizeof (void *))
+    size = sizeof (void *);
+  return (size + align - 1) & ~(align - 1);
+}
+
+void
+pool_init (Pool *pool, const char *name, size_t object_size)
+{
+  if (!pool)
+    return;
+
+  Pool initial = POOL_INITIALIZER (name, object_size);
+  *pool = initial;
+}
+
+static void
+pool_register (Pool *pool)
+{
+  pool->object_size = align_object_size (pool->object_size);
+  pthread_mutex_lock (&registry_lock);
+  pool->next_registered = registered_pools;
+  registered_pools = pool;
+  pthread_mutex_unlock (&registry_lock);
+  pool->registered = 1;
+}
+
+static int
+pool_grow (Pool *pool)
+{
+  if (!pool->registered)
+    {
+      pool_register (pool);
+    }
+
+  PoolChunk *chunk = malloc (POOL_CHUNK_SIZE);
+  if (!chunk)
+    return 0;
+
+  chunk->next = pool->chunks;
+  pool->chunks = chunk;
+  pool->num_chunks++;
+
+  // Objects start after the chunk header, aligned like any other object
+  size_t header = align_object_size (sizeof (PoolChunk));
+  size_t usable = (POOL_CHUNK_SIZE - header) / pool->object_size;
+  pool->bump = (char *)chunk + header;
+  pool->bump_end = pool->bump + usable * pool->object_size;
+  return 1;
+}
+
+void *
+pool_alloc (Pool *pool)
+{
+  void *object;
+
+  if (pool->free_list != NULL)
+    {
+      object = pool->free_list;
+      pool->free_list = *(void **)object;
+    }
+  else
+    {
+      if (pool->bump == pool->bump_end && !pool_grow (pool))
+        return NULL;
+      object = pool->bump;
+      pool->bump += pool->object_size;
+    }
+
+  pool->objects_in_use++;
+  return object;
+}
+
+void
+pool_free (Pool *pool, void *object)
+{
+  if (!object)
+    return;
+
+  *(void **)object = pool->free_list;
+  pool->free_list = object;
+  pool->objects_in_use--;
+}
+
+static void
+pool_unregister (Pool *pool)
+{
+  pthread_mutex_lock (&registry_lock);
+  Pool **link = &registered_pools;
+  while (*link != NULL && *link != pool)
+    {
+      link = &(*link)->next_registered;
+    }
+
+  if (*link == pool)
+    {
+      *link = pool->next_registered;
+    }
+  pthread_mutex_unlock (&registry_lock);
+  pool->next_registered = NULL;
+  pool->registered = 0;
+}
+
+// Hands every object of `from` to `pool`, which must hold objects of the
+// same size. Objects in use are freed to `pool` from then on and the unused
+// ones join its free list, so a thread can fill a private pool without
+// locking and give it to a shared one when it is done. Leaves `from` empty.
+void
+pool_adopt (Pool *pool, Pool *from)
+{
+  if (from->chunks == NULL)
+    return;
+  if (!pool->registered)
+    {
+      pool_register (pool);
+    }
+
+  PoolChunk *last = from->chunks;
+  while (last->next != NULL)
+    {
+      last = last->next;
+    }
+  last->next = pool->chunks;
+  pool->chunks = from->chunks;
+  pool->num_chunks += from->num_chunks;
+  pool->objects_in_use += from->objects_in_use;
+
+  for (char *object = from->bump; object < from->bump_end;
+       object += from->object_size)
+    {
+      *(void **)object = pool->free_list;
+      pool->free_list = object;
+    }
+  void *object = from->free_list;
+  while (object != NULL)
+    {
+      void *next = *(void **)object;
+      *(void **)object = pool->free_list;
+      pool->free_list = object;
+      object = next;
+    }
+
+  from->chunks = NULL;
+  pool_release (from);
+}
+
+void
+pool_release (Pool *pool)
+{
+  PoolChunk *chunk = pool->chunks;
+  while (chunk != NULL)
+    {
+      PoolChunk *next = chunk->next;
+      free (chunk);
+      chunk = next;
+    }
+
+  pool->chunks = NULL;
+  pool->bump = NULL;
+  pool->bump_end = NULL;
+  pool->free_list = NULL;
+  pool->num_chunks = 0;
+  pool->objects_in_use = 0;
+
+  if (pool->registered)
+    {
+      pool_unregister (pool);
+    }
+}
+
+void
+pool_get_stats (const Pool *pool, PoolStats *stats)
+{
+  size_t header = align_object_size (sizeof (PoolChunk));
+  size_t object_size = align_object_size (pool->object_size);
+
+  stats->name = pool->name;
+  stats->object_size = object_size;
+  stats->objects_in_use = pool->objects_in_use;
+  stats->objects_reserved
+      = pool->num_chunks * ((POOL_CHUNK_SIZE - header) / object_size);
+  stats->bytes_reserved = pool->num_chunks * POOL_CHUNK_SIZE;
+}
+
+static int
+block_class (size_t size)
+{
+  int index = 0;
+  size_t class_size = MIN_BLOCK_SIZE;
+
+  while (class_size < size)
+    {
+      class_size *= 2;
+      index++;
+    }
+
+  return index;
+}
+
+size_t
+pool_block_size (size_t size)
+{
+  if (size > POOL_MAX_BLOCK_SIZE)
+    return size;
+
+  return (size_t)MIN_BLOCK_SIZE << block_class (size);
+}
+
+void *
+pool_alloc_block (size_t *size)
+{
+  if (*size > POOL_MAX_BLOCK_SIZE)
+    {
+      return malloc (*size);
+    }
+
+  int index = block_class (*size);
+  *size = (size_t)MIN_BLOCK_SIZE << index;
+  return pool_alloc (&block_pools[index]);
+}
+
+void
+pool_free_block (void *block, size_t size)
+{
+  if (!block)
+    return;
+
+  if (size > POOL_MAX_BLOCK_SIZE)
+    {
+      free (block);
+      return;
+    }
+
+  pool_free (&block_pools[block_class (size)], block);
+}
+
+// Gives a private pool of blocks of one size class to the shared pool of
+// that class; see pool_adopt().
+void
+pool_adopt_blocks (Pool *from)
+{
+  pool_adopt (&block_pools[block_class (from->object_size)], from);
+}
+
+size_t
+pool_collect_stats (PoolStats *stats, size_t max_stats)
+{
+  size_t count = 0;
+
+  pthread_mutex_lock (&registry_lock);
+  for (Pool *pool = registered_pools; pool != NULL && count < max_stats;
+       pool = pool->next_registered)
+    {
+      pool_get_stats (pool, &stats[count]);
+      count++;
+    }
+  pthread_mutex_unlock (&registry_lock);
+
+  return count;
+}
+
+void
+pool_format_stats (char *out, size_t out_size)
+{
+  PoolStats stats[16];
+  size_t count = pool_collect_stats (stats, 16);
+  size_t used = 0;
+  size_t total_bytes = 0;
+
+  if (out_size == 0)
+    return;
+  out[0] = '\0';
+
+  for (size_t i = 0; i < count; i++)
+    {
+      total_bytes += stats[i].bytes_reserved;
+      if (used < out_size)
+        {
+          used += snprintf (out + used, out_size - used, "%s %zu/%zu, ",
+                            stats[i].name, stats[i].objects_in_use,
+                            stats[i].objects_reserved);
+        }
+    }
+
+  if (used < out_size)
+    {
+      snprintf (out + used, out_size - used, "%zuK reserved",
+                total_bytes / 1024);
+    }
+}
@@ -0,0 +1,78 @@
+#include "screen_damage.h"
+#include <stdlib.h>
+
+void
+screen_damage_init (ScreenDamage *damage)
+{
+  damage->rows = NULL;
+  damage->num_rows = 0;
+  damage->frame = 0;
+  damage->full = 1;
+  damage->redraw = 1;
+}
+
+void
+screen_damage_free (ScreenDamage *damage)
+{
+  free (damage->rows);
+  screen_damage_init (damage);
+}
+
+// Redraws every row on the next frame, for when the terminal no longer
+// shows what was drawn
+void
+screen_damage_all (ScreenDamage *damage)
+{
+  damage->full = 1;
+}
+
+// Starts a frame of `num_rows` rows drawn with the settings summed up in
+// `frame`.
+void
+screen_damage_begin (ScreenDamage *damage, int num_rows, uint64_t frame)
+{
+  if (num_rows < 0)
+    num_rows = 0;
+
+  if (num_rows != damage->num_rows)
+    {
+      free (damage->rows);
+      damage->rows = calloc (num_rows ? num_rows : 1, sizeof (uint64_t));
+      damage->num_rows = damage->rows ? num_rows : 0;
+      damage->full = 1;
+    }
+  if (frame != damage->frame)
+    {
+      damage->frame = frame;
+      damage->full = 1;
+    }
+
+  damage->redraw = damage->full;
+  damage->full = 0;
+}
+
+// Records that `row` now shows `signature`. Returns nonzero when it has to
+// be drawn: it showed something else, or the whole frame is being redrawn.
+int
+screen_damage_row (ScreenDamage *damage, int row, uint64_t signature)
+{
+  if (row < 0 || row >= damage->num_rows)
+    return 1;
+
+  int dirty = damage->redraw || damage->rows[row] != signature;
+  damage->rows[row] = signature;
+  return dirty;
+}
+
+// FNV-1a over `data`, continuing from `hash`
+uint64_t
+screen_hash (uint64_t hash, const void *data, size_t length)
+{
+  const unsigned char *bytes = data;
+  for (size_t i = 0; i < length; i++)
+    {
+      hash ^= bytes[i];
+      hash *= 1099511628211ULL;
+    }
+  return hash;
+}
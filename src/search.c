@@ -4,9 +4,12 @@
 #include <ncurses.h>
 #endif
 
+#include "buffer_iterator.h"
 #include "data_structures.h"
+#include "line_index.h"
 #include "search.h"
 #include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -54,106 +57,250 @@ strncasecmp_custom (const char *s1, const char *s2, size_t n)
   return 0;
 }
 
-int
-search_in_line (const Line *line, const char *term, size_t start_col,
-                int case_sensitive, size_t *match_col)
-{
-  if (!line || !term || !match_col || strlen (term) == 0)
-    {
-      return 0;
-    }
+// Lines split per step when a forward search runs off the end of what a
+// lazily loaded file has split so far
+#define SEARCH_SCAN_LINES 65536
 
-  char *line_text = line_to_string (line);
-  if (!line_text)
-    return 0;
+typedef struct {
+    const char *term;
+    size_t length;
+    int case_sensitive;
+} Pattern;
 
-  size_t line_len = strlen (line_text);
-  size_t term_len = strlen (term);
+// Where a match starts
+typedef struct {
+    Line *line;
+    size_t col;
+} SearchHit;
 
-  if (start_col >= line_len || term_len > line_len)
-    {
-      free (line_text);
-      return 0;
-    }
+static int
+bytes_match (const char *text, const char *term, size_t n, int case_sensitive)
+{
+  if (case_sensitive)
+    return memcmp (text, term, n) == 0;
+  return strncasecmp_custom (text, term, n) == 0;
+}
 
-  for (size_t i = start_col; i <= line_len - term_len; i++)
+// Streams forward from `it`, which is at byte `offset` of the buffer, for
+// the first match starting in [from, to). A lazily loaded file is split
+// into more lines whenever the stream reaches its tail.
+static int
+scan_forward (TextBuffer *buffer, const Pattern *p, BufferIterator *it,
+              size_t offset, size_t from, size_t to, SearchHit *hit)
+{
+  // The last bytes streamed, where a match running into the next chunk
+  // starts, and where each of them is
+  char carry[MAX_SEARCH_TERM_LENGTH];
+  SearchHit carry_at[MAX_SEARCH_TERM_LENGTH];
+  size_t carried = 0;
+  size_t keep = p->length - 1;
+
+  for (;;)
     {
-      int match;
-      if (case_sensitive)
+      if (offset - carried >= to)
+        return 0;
+
+      Line *line = it->line;
+      size_t col = it->col;
+      const char *chunk;
+      size_t n = buffer_iterator_next (it, &chunk);
+      if (n == 0)
         {
-          match = (strncmp (line_text + i, term, term_len) == 0);
+          Line *tail = buffer->tail;
+          if (buffer_is_loaded (buffer))
+            return 0;
+          buffer_ensure_lines (buffer, buffer->num_lines + SEARCH_SCAN_LINES);
+          if (tail == NULL || tail->next == NULL)
+            return 0;
+          buffer_iterator_seek_line (it, tail->next, 0);
+          continue;
         }
-      else
+
+      // Matches that start in the carried bytes and end in this chunk
+      for (size_t i = 0; i < carried; i++)
         {
-          match = (strncasecmp_custom (line_text + i, term, term_len) == 0);
+          size_t head = carried - i;
+          size_t rest = p->length - head;
+          if (rest > n)
+            break;
+
+          size_t start = offset - head;
+          if (start >= from && start < to
+              && bytes_match (carry + i, p->term, head, p->case_sensitive)
+              && bytes_match (chunk, p->term + head, rest,
+                              p->case_sensitive))
+            {
+              *hit = carry_at[i];
+              return 1;
+            }
         }
 
-      if (match)
+      for (size_t k = 0; k + p->length <= n; k++)
         {
-          *match_col = i;
-          free (line_text);
-          return 1;
+          size_t start = offset + k;
+          if (start >= to)
+            return 0;
+          if (start >= from
+              && to_lower (chunk[k]) == to_lower (p->term[0])
+              && bytes_match (chunk + k, p->term, p->length,
+                              p->case_sensitive))
+            {
+              hit->line = line;
+              hit->col = col + k;
+              return 1;
+            }
         }
-    }
 
-  free (line_text);
-  return 0;
+      // Carry the last `keep` bytes over to the next chunk
+      size_t drop = carried + n > keep ? carried + n - keep : 0;
+      if (drop < carried)
+        {
+          carried -= drop;
+          memmove (carry, carry + drop, carried);
+          memmove (carry_at, carry_at + drop, carried * sizeof (SearchHit));
+          drop = 0;
+        }
+      else
+        {
+          drop -= carried;
+          carried = 0;
+        }
+      for (size_t j = drop; j < n; j++)
+        {
+          carry[carried] = chunk[j];
+          carry_at[carried].line = line;
+          carry_at[carried].col = col + j;
+          carried++;
+        }
+      offset += n;
+    }
 }
 
-int
-search_in_line_backward (const Line *line, const char *term, size_t start_col,
-                         int case_sensitive, size_t *match_col)
+// Streams backward from `it`, which is at byte `offset` of the buffer, for
+// the last match starting in [from, to).
+static int
+scan_backward (const Pattern *p, BufferIterator *it, size_t offset,
+               size_t from, size_t to, SearchHit *hit)
 {
-  if (!line || !term || !match_col || strlen (term) == 0)
-    {
-      return 0;
-    }
+  // The first bytes after the chunk, where a match starting in it ends
+  char carry[MAX_SEARCH_TERM_LENGTH];
+  size_t carried = 0;
+  size_t keep = p->length - 1;
 
-  char *line_text = line_to_string (line);
-  if (!line_text)
-    return 0;
-
-  size_t line_len = strlen (line_text);
-  size_t term_len = strlen (term);
-
-  if (term_len > line_len)
+  BufferIterator ahead = *it;
+  while (carried < keep)
     {
-      free (line_text);
-      return 0;
+      const char *chunk;
+      size_t n = buffer_iterator_next (&ahead, &chunk);
+      if (n == 0)
+        break;
+      if (n > keep - carried)
+        n = keep - carried;
+      memcpy (carry + carried, chunk, n);
+      carried += n;
     }
 
-  if (start_col >= line_len)
+  for (;;)
     {
-      start_col = line_len - 1;
-    }
+      const char *chunk;
+      size_t n = buffer_iterator_prev (it, &chunk);
+      if (n == 0)
+        return 0;
+      offset -= n;
 
-  for (size_t i = start_col; i != SIZE_MAX; i--)
-    {
-      if (i + term_len > line_len)
+      for (size_t k = n; k-- > 0;)
         {
-          continue;
+          size_t start = offset + k;
+          if (start < from)
+            return 0;
+          if (start >= to
+              || to_lower (chunk[k]) != to_lower (p->term[0]))
+            continue;
+
+          size_t head = n - k;
+          int match;
+          if (head >= p->length)
+            match = bytes_match (chunk + k, p->term, p->length,
+                                 p->case_sensitive);
+          else
+            match = carried >= p->length - head
+                    && bytes_match (chunk + k, p->term, head,
+                                    p->case_sensitive)
+                    && bytes_match (carry, p->term + head, p->length - head,
+                                    p->case_sensitive);
+          if (match)
+            {
+              hit->line = it->line;
+              hit->col = it->col + k;
+              return 1;
+            }
         }
 
-      int match;
-      if (case_sensitive)
+      // The chunk now comes first in what follows the next one
+      if (n >= keep)
         {
-          match = (strncmp (line_text + i, term, term_len) == 0);
+          memcpy (carry, chunk, keep);
+          carried = keep;
         }
       else
         {
-          match = (strncasecmp_custom (line_text + i, term, term_len) == 0);
+          size_t kept = carried < keep - n ? carried : keep - n;
+          memmove (carry + n, carry, kept);
+          memcpy (carry, chunk, n);
+          carried = kept + n;
         }
+    }
+}
+
+// Finds the first match of `term` after (line, col), or with `forward`
+// unset the last one before it, wrapping around the buffer. The buffer is
+// streamed through a BufferIterator, the path saves take too, with a '\n'
+// after every line, so a match can span lines.
+int
+search_buffer (TextBuffer *buffer, const char *term, int case_sensitive,
+               Line *line, size_t col, int forward, Line **match_line,
+               size_t *match_col)
+{
+  Pattern p = { term, term ? strlen (term) : 0, case_sensitive };
+  if (!buffer || !line || p.length == 0
+      || p.length >= MAX_SEARCH_TERM_LENGTH)
+    return 0;
+
+  BufferIterator it;
+  buffer_iterator_init (&it, buffer);
+  buffer_iterator_seek_line (&it, line, col);
+  size_t start = buffer_iterator_offset (&it);
 
-      if (match)
+  SearchHit hit;
+  int found;
+  if (forward)
+    {
+      found = scan_forward (buffer, &p, &it, start, start + 1, SIZE_MAX,
+                            &hit);
+      if (!found)
+        {
+          buffer_iterator_init (&it, buffer);
+          found = scan_forward (buffer, &p, &it, 0, 0, start, &hit);
+        }
+    }
+  else
+    {
+      found = scan_backward (&p, &it, start, 0, start, &hit);
+      if (!found)
         {
-          *match_col = i;
-          free (line_text);
-          return 1;
+          buffer_load_all (buffer);
+          buffer_iterator_seek_end (&it);
+          size_t end = line_index_total_bytes (buffer);
+          found = scan_backward (&p, &it, end, start + 1, end, &hit);
         }
     }
 
-  free (line_text);
-  return 0;
+  if (found)
+    {
+      *match_line = hit.line;
+      *match_col = hit.col;
+    }
+  return found;
 }
 
 void
@@ -189,6 +336,26 @@ jump_to_match (EditorState *state, SearchState *search_state)
     }
 }
 
+// Searches from (line, col) and moves the cursor to what is found.
+static int
+search_from (EditorState *state, SearchState *search_state, Line *line,
+             size_t col, int forward)
+{
+  Line *match_line;
+  size_t match_col;
+  if (!search_buffer (&state->buffer, search_state->search_term,
+                      search_state->case_sensitive, line, col, forward,
+                      &match_line, &match_col))
+    {
+      return 0;
+    }
+
+  search_state->current_match_line = match_line;
+  search_state->current_match_col = match_col;
+  jump_to_match (state, search_state);
+  return 1;
+}
+
 int
 perform_search (EditorState *state, SearchState *search_state,
                 const char *term, int forward)
@@ -205,126 +372,8 @@ perform_search (EditorState *state, SearchState *search_state,
   search_state->search_forward = forward;
   search_state->has_active_search = 1;
 
-  Line *start_line = state->buffer.current_line_node;
-  size_t start_col = state->buffer.current_col_offset;
-
-  if (forward)
-    {
-      start_col++;
-
-      size_t match_col;
-      if (search_in_line (start_line, term, start_col,
-                          search_state->case_sensitive, &match_col))
-        {
-          search_state->current_match_line = start_line;
-          search_state->current_match_col = match_col;
-          jump_to_match (state, search_state);
-          return 1;
-        }
-
-      Line *current_line = start_line->next;
-      while (current_line != NULL)
-        {
-          if (search_in_line (current_line, term, 0,
-                              search_state->case_sensitive, &match_col))
-            {
-              search_state->current_match_line = current_line;
-              search_state->current_match_col = match_col;
-              jump_to_match (state, search_state);
-              return 1;
-            }
-          current_line = current_line->next;
-        }
-
-      current_line = state->buffer.head;
-      while (current_line != start_line && current_line != NULL)
-        {
-          if (search_in_line (current_line, term, 0,
-                              search_state->case_sensitive, &match_col))
-            {
-              search_state->current_match_line = current_line;
-              search_state->current_match_col = match_col;
-              jump_to_match (state, search_state);
-              return 1;
-            }
-          current_line = current_line->next;
-        }
-
-      if (search_in_line (start_line, term, 0, search_state->case_sensitive,
-                          &match_col)
-          && match_col < state->buffer.current_col_offset)
-        {
-          search_state->current_match_line = start_line;
-          search_state->current_match_col = match_col;
-          jump_to_match (state, search_state);
-          return 1;
-        }
-    }
-  else
-    {
-      if (start_col > 0)
-        {
-          start_col--;
-        }
-
-      size_t match_col;
-      if (search_in_line_backward (start_line, term, start_col,
-                                   search_state->case_sensitive, &match_col))
-        {
-          search_state->current_match_line = start_line;
-          search_state->current_match_col = match_col;
-          jump_to_match (state, search_state);
-          return 1;
-        }
-
-      Line *current_line = start_line->prev;
-      while (current_line != NULL)
-        {
-          size_t line_len = line_get_length (current_line);
-          if (line_len > 0
-              && search_in_line_backward (current_line, term, line_len - 1,
-                                          search_state->case_sensitive,
-                                          &match_col))
-            {
-              search_state->current_match_line = current_line;
-              search_state->current_match_col = match_col;
-              jump_to_match (state, search_state);
-              return 1;
-            }
-          current_line = current_line->prev;
-        }
-
-      current_line = state->buffer.tail;
-      while (current_line != start_line && current_line != NULL)
-        {
-          size_t line_len = line_get_length (current_line);
-          if (line_len > 0
-              && search_in_line_backward (current_line, term, line_len - 1,
-                                          search_state->case_sensitive,
-                                          &match_col))
-            {
-              search_state->current_match_line = current_line;
-              search_state->current_match_col = match_col;
-              jump_to_match (state, search_state);
-              return 1;
-            }
-          current_line = current_line->prev;
-        }
-
-      size_t line_len = line_get_length (start_line);
-      if (line_len > state->buffer.current_col_offset
-          && search_in_line_backward (start_line, term, line_len - 1,
-                                      search_state->case_sensitive, &match_col)
-          && match_col > state->buffer.current_col_offset)
-        {
-          search_state->current_match_line = start_line;
-          search_state->current_match_col = match_col;
-          jump_to_match (state, search_state);
-          return 1;
-        }
-    }
-
-  return 0;
+  return search_from (state, search_state, state->buffer.current_line_node,
+                      state->buffer.current_col_offset, forward);
 }
 
 int
@@ -342,58 +391,8 @@ find_next_match (EditorState *state, SearchState *search_state)
                              1);
     }
 
-  Line *current_line = search_state->current_match_line;
-  size_t start_col = search_state->current_match_col + 1;
-  size_t match_col;
-
-  if (search_in_line (current_line, search_state->search_term, start_col,
-                      search_state->case_sensitive, &match_col))
-    {
-      search_state->current_match_col = match_col;
-      jump_to_match (state, search_state);
-      return 1;
-    }
-
-  current_line = current_line->next;
-  while (current_line != NULL)
-    {
-      if (search_in_line (current_line, search_state->search_term, 0,
-                          search_state->case_sensitive, &match_col))
-        {
-          search_state->current_match_line = current_line;
-          search_state->current_match_col = match_col;
-          jump_to_match (state, search_state);
-          return 1;
-        }
-      current_line = current_line->next;
-    }
-
-  current_line = state->buffer.head;
-  while (current_line != search_state->current_match_line
-         && current_line != NULL)
-    {
-      if (search_in_line (current_line, search_state->search_term, 0,
-                          search_state->case_sensitive, &match_col))
-        {
-          search_state->current_match_line = current_line;
-          search_state->current_match_col = match_col;
-          jump_to_match (state, search_state);
-          return 1;
-        }
-      current_line = current_line->next;
-    }
-
-  if (search_in_line (search_state->current_match_line,
-                      search_state->search_term, 0,
-                      search_state->case_sensitive, &match_col)
-      && match_col < search_state->current_match_col)
-    {
-      search_state->current_match_col = match_col;
-      jump_to_match (state, search_state);
-      return 1;
-    }
-
-  return 0;
+  return search_from (state, search_state, search_state->current_match_line,
+                      search_state->current_match_col, 1);
 }
 
 int
@@ -411,71 +410,8 @@ find_previous_match (EditorState *state, SearchState *search_state)
                              0);
     }
 
-  Line *current_line = search_state->current_match_line;
-  size_t start_col = (search_state->current_match_col > 0)
-                         ? search_state->current_match_col - 1
-                         : 0;
-  size_t match_col;
-
-  if (search_state->current_match_col > 0
-      && search_in_line_backward (current_line, search_state->search_term,
-                                  start_col, search_state->case_sensitive,
-                                  &match_col))
-    {
-      search_state->current_match_col = match_col;
-      jump_to_match (state, search_state);
-      return 1;
-    }
-
-  current_line = current_line->prev;
-  while (current_line != NULL)
-    {
-      size_t line_len = line_get_length (current_line);
-      if (line_len > 0
-          && search_in_line_backward (
-              current_line, search_state->search_term, line_len - 1,
-              search_state->case_sensitive, &match_col))
-        {
-          search_state->current_match_line = current_line;
-          search_state->current_match_col = match_col;
-          jump_to_match (state, search_state);
-          return 1;
-        }
-      current_line = current_line->prev;
-    }
-
-  current_line = state->buffer.tail;
-  while (current_line != search_state->current_match_line
-         && current_line != NULL)
-    {
-      size_t line_len = line_get_length (current_line);
-      if (line_len > 0
-          && search_in_line_backward (
-              current_line, search_state->search_term, line_len - 1,
-              search_state->case_sensitive, &match_col))
-        {
-          search_state->current_match_line = current_line;
-          search_state->current_match_col = match_col;
-          jump_to_match (state, search_state);
-          return 1;
-        }
-      current_line = current_line->prev;
-    }
-
-  size_t line_len = line_get_length (search_state->current_match_line);
-  if (line_len > search_state->current_match_col
-                     + strlen (search_state->search_term)
-      && search_in_line_backward (search_state->current_match_line,
-                                  search_state->search_term, line_len - 1,
-                                  search_state->case_sensitive, &match_col)
-      && match_col > search_state->current_match_col)
-    {
-      search_state->current_match_col = match_col;
-      jump_to_match (state, search_state);
-      return 1;
-    }
-
-  return 0;
+  return search_from (state, search_state, search_state->current_match_line,
+                      search_state->current_match_col, 0);
 }
 
 void
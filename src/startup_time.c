@@ -0,0 +1,55 @@
+#include "startup_time.h"
+#include <stdio.h>
+#include <time.h>
+
+static FILE *report = NULL;
+static struct timespec started;
+static struct timespec last;
+
+static double
+elapsed_ms (const struct timespec *from, const struct timespec *to)
+{
+  return (to->tv_sec - from->tv_sec) * 1e3
+         + (to->tv_nsec - from->tv_nsec) / 1e6;
+}
+
+// Creates the report at `path`. Returns 0, or -1 with errno set.
+int
+startup_time_open (const char *path)
+{
+  report = fopen (path, "w");
+  if (!report)
+    return -1;
+
+  clock_gettime (CLOCK_MONOTONIC, &started);
+  last = started;
+  fprintf (report, "times in msec\n");
+  fprintf (report, "  clock     self: event\n");
+  startup_time_mark ("--- ben starting ---");
+  return 0;
+}
+
+void
+startup_time_mark (const char *event)
+{
+  if (!report)
+    return;
+
+  struct timespec now;
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  fprintf (report, "%07.3f  %07.3f: %s\n", elapsed_ms (&started, &now),
+           elapsed_ms (&last, &now), event);
+  last = now;
+}
+
+// Marks the last step and closes the report; later marks are ignored.
+void
+startup_time_finish (const char *event)
+{
+  if (!report)
+    return;
+
+  startup_time_mark (event);
+  fclose (report);
+  report = NULL;
+}
@@ -5,31 +5,45 @@
 #include <ncurses.h>
 #endif
 
+#include "background_save.h"
 #include "color_config.h"
 #include "editor_state.h"
+#include "follow.h"
+#include "journal.h"
+#include "line_index.h"
+#include "pager.h"
+#include "pool.h"
+#include "screen_damage.h"
 #include "search.h"
 #include "text_editor_functions.h"
 #include "undo.h"
 #include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+// After this long without a key press the editor does background work
+#define IDLE_TIMEOUT_MS 250
+// Lines compacted per idle tick, small enough to keep typing responsive
+#define IDLE_COMPACT_LINES 256
+// Poll interval while a file is loading in the background, and the number of
+// its lines split into the buffer per poll
+#define LOAD_POLL_MS 20
+#define IDLE_LOAD_LINES 65536
+// Status bar refresh interval while a save runs in the background
+#define SAVE_POLL_MS 100
+
 static SearchState search_state;
 static int search_initialized = 0;
 
 int
 get_absolute_line_number (const TextBuffer *buffer, Line *target_line)
 {
-  int line_num = 0;
-  Line *current = buffer->head;
+  if (target_line == NULL)
+    return buffer->num_lines;
 
-  while (current != NULL && current != target_line)
-    {
-      line_num++;
-      current = current->next;
-    }
-
-  return line_num;
+  return line_index_position (target_line);
 }
 
 const char *
@@ -93,14 +107,14 @@ drawModeIndicator (EditorMode mode, int line_wrap_enabled)
 }
 
 int
-get_wrapped_line_count (const char *text, int max_width, int line_wrap_enabled)
+get_wrapped_line_count (size_t length, int max_width, int line_wrap_enabled)
 {
   if (!line_wrap_enabled)
     {
       return 1;
     }
 
-  int len = strlen (text);
+  int len = length;
   if (len == 0)
     {
       return 1;
@@ -110,18 +124,19 @@ get_wrapped_line_count (const char *text, int max_width, int line_wrap_enabled)
 }
 
 void
-draw_wrapped_line (int row, int col, const char *text, int max_width,
-                   int color_pair, int line_wrap_enabled)
+draw_wrapped_line (int row, int col, const char *text, size_t length,
+                   int max_width, int color_pair, int line_wrap_enabled)
 {
+  int len = length;
+
   if (!line_wrap_enabled)
     {
       attron (COLOR_PAIR (color_pair));
-      mvprintw (row, col, "%.*s", max_width, text);
+      mvprintw (row, col, "%.*s", len < max_width ? len : max_width, text);
       attroff (COLOR_PAIR (color_pair));
       return;
     }
 
-  int len = strlen (text);
   int current_row = row;
   int pos = 0;
 
@@ -138,26 +153,30 @@ draw_wrapped_line (int row, int col, const char *text, int max_width,
 
 void
 draw_line_with_search_highlight (int row, int col, const char *text,
-                                 int max_width, int color_pair,
-                                 int line_wrap_enabled, Line *line_node)
+                                 size_t length, int max_width, int max_rows,
+                                 int color_pair, int line_wrap_enabled,
+                                 Line *line_node)
 {
+  int rows = get_wrapped_line_count (length, max_width, line_wrap_enabled);
+  if (rows > max_rows)
+    rows = max_rows;
+
   if (!search_state.has_active_search || !text
       || strlen (search_state.search_term) == 0)
     {
-      draw_wrapped_line (row, col, text, max_width, color_pair,
-                         line_wrap_enabled);
+      size_t fits = (size_t)max_width * rows;
+      draw_wrapped_line (row, col, text, length < fits ? length : fits,
+                         max_width, color_pair, line_wrap_enabled);
       return;
     }
 
-  int len = strlen (text);
+  int len = length;
   int term_len = strlen (search_state.search_term);
   int current_row = row;
+  int end_row = row + rows;
   int pos = 0;
 
-  while (pos < len
-         && current_row < row
-                              + get_wrapped_line_count (text, max_width,
-                                                        line_wrap_enabled))
+  while (pos < len && current_row < end_row)
     {
       int line_end = pos + max_width;
       if (line_end > len)
@@ -178,7 +197,7 @@ draw_line_with_search_highlight (int row, int col, const char *text,
               if (search_state.case_sensitive)
                 {
                   match
-                      = (strncmp (text + i, search_state.search_term, term_len)
+                      = (memcmp (text + i, search_state.search_term, term_len)
                          == 0);
                 }
               else
@@ -236,90 +255,170 @@ draw_line_with_search_highlight (int row, int col, const char *text,
     }
 }
 
-void
-drawLineNumbers (int visible_lines, const TextBuffer *buffer, int top_line)
+// Sums up everything that shapes all of the text rows, so that a change in
+// any of it redraws the whole screen
+static uint64_t
+frame_signature (int visible_lines, int text_width, int line_wrap_enabled)
 {
-  Line *current_line_node = buffer->head;
-  int line_num = 1;
-  int screen_row = 1; // Start from row 1 to leave space for mode indicator
-  int max_col = getmaxx (stdscr);
-  int text_width = max_col - 8; // Available width for text content
+  int settings[] = { visible_lines, text_width, line_wrap_enabled,
+                     search_state.has_active_search,
+                     search_state.case_sensitive };
+  uint64_t frame = screen_hash (SCREEN_HASH_SEED, settings, sizeof (settings));
 
-  for (int i = 0; i < top_line && current_line_node != NULL; ++i)
+  if (search_state.has_active_search)
     {
-      current_line_node = current_line_node->next;
-      line_num++;
+      frame = screen_hash (frame, search_state.search_term,
+                           strlen (search_state.search_term));
+      frame = screen_hash (frame, &search_state.current_match_line,
+                           sizeof (search_state.current_match_line));
+      frame = screen_hash (frame, &search_state.current_match_col,
+                           sizeof (search_state.current_match_col));
     }
+  return frame;
+}
+
+static void
+draw_line_number (int row, int line_num, int is_cursor_line)
+{
+  attron (COLOR_PAIR (COLOR_PAIR_LINE_NUMBERS));
+  mvprintw (row, 1, "%4d", line_num);
+  attroff (COLOR_PAIR (COLOR_PAIR_LINE_NUMBERS));
 
-  while (screen_row <= visible_lines && current_line_node != NULL)
+  if (is_cursor_line)
     {
-      char *line_text = line_to_string (current_line_node);
-      int wrapped_lines
-          = line_text ? get_wrapped_line_count (line_text, text_width, 1) : 1;
-      if (line_text)
-        free (line_text);
+      attron (COLOR_PAIR (COLOR_PAIR_CURSOR_LINE));
+      mvprintw (row, 5, "->");
+      attroff (COLOR_PAIR (COLOR_PAIR_CURSOR_LINE));
+    }
+}
 
-      attron (COLOR_PAIR (COLOR_PAIR_LINE_NUMBERS));
-      mvprintw (screen_row, 1, "%4d", line_num);
+// The first *count bytes of `line` as one run: in place when they are
+// contiguous in storage, otherwise copied into a scratch buffer, so drawing
+// never rewrites the line. If the copy cannot be made, *count is cut down
+// to the first run.
+static const char *
+visible_text (const Line *line, size_t *count)
+{
+  static char *scratch;
+  static size_t scratch_size;
 
-      if (current_line_node == buffer->current_line_node)
-        {
-          attroff (COLOR_PAIR (COLOR_PAIR_LINE_NUMBERS));
-          attron (COLOR_PAIR (COLOR_PAIR_CURSOR_LINE));
-          mvprintw (screen_row, 5, "->");
-          attroff (COLOR_PAIR (COLOR_PAIR_CURSOR_LINE));
-        }
-      else
+  const char *span = NULL;
+  size_t first = line_span_at (line, 0, &span);
+  if (span == NULL)
+    span = "";
+  if (first >= *count)
+    return span;
+
+  if (*count > scratch_size)
+    {
+      char *grown = realloc (scratch, *count);
+      if (grown == NULL)
         {
-          mvprintw (screen_row, 5, "  ");
+          *count = first;
+          return span;
         }
-      attroff (COLOR_PAIR (COLOR_PAIR_LINE_NUMBERS));
+      scratch = grown;
+      scratch_size = *count;
+    }
 
-      for (int i = 1; i < wrapped_lines && screen_row + i <= visible_lines;
-           i++)
+  for (size_t copied = 0; copied < *count;)
+    {
+      size_t length = line_span_at (line, copied, &span);
+      if (length == 0)
         {
-          mvprintw (screen_row + i, 1, "    ");
-          mvprintw (screen_row + i, 5, "  ");
+          *count = copied;
+          break;
         }
-
-      screen_row += wrapped_lines;
-      current_line_node = current_line_node->next;
-      line_num++;
+      if (length > *count - copied)
+        length = *count - copied;
+      memcpy (scratch + copied, span, length);
+      copied += length;
     }
+  return scratch;
 }
 
+// Draws the line numbers and text of the rows that changed since the last
+// frame. A line's rows are redrawn together, so typing into a line repaints
+// only the rows it covers, and moving the cursor only the two lines the
+// arrow moves between.
 void
-drawTextContent (int visible_lines, const TextBuffer *buffer, int top_line,
-                 int line_wrap_enabled)
+drawTextRows (int visible_lines, EditorState *state)
 {
-  Line *current_line_node = buffer->head;
+  const TextBuffer *buffer = &state->buffer;
+  Line *current_line_node = line_index_find (buffer, state->top_line);
+  int line_num = state->top_line + 1;
   int screen_row = 1; // Start from row 1 to leave space for mode indicator
   int max_col = getmaxx (stdscr);
   int text_width = max_col - 8; // Available width for text content
+  int wrap = state->line_wrap_enabled;
 
-  for (int i = 0; i < top_line && current_line_node != NULL; ++i)
+  if (!search_initialized)
     {
-      current_line_node = current_line_node->next;
+      init_search_state (&search_state);
+      search_initialized = 1;
     }
+  size_t term_len = search_state.has_active_search
+                        ? strlen (search_state.search_term)
+                        : 0;
+
+  screen_damage_begin (&state->screen, visible_lines,
+                       frame_signature (visible_lines, text_width, wrap));
 
-  while (screen_row <= visible_lines && current_line_node != NULL)
+  while (screen_row <= visible_lines)
     {
-      char *line_text = line_to_string (current_line_node);
-      if (line_text)
+      if (current_line_node == NULL)
+        {
+          if (screen_damage_row (&state->screen, screen_row - 1,
+                                 SCREEN_HASH_SEED))
+            {
+              move (screen_row, 0);
+              clrtoeol ();
+            }
+          screen_row++;
+          continue;
+        }
+
+      size_t length = line_get_length (current_line_node);
+      int rows = get_wrapped_line_count (length, text_width, wrap);
+      if (rows > visible_lines - screen_row + 1)
+        rows = visible_lines - screen_row + 1;
+
+      // Only the text on screen counts, plus enough past it for a search
+      // match to start there
+      size_t shown = (size_t)text_width * (wrap ? rows : 1) + term_len;
+      if (shown > length)
+        shown = length;
+      const char *text = visible_text (current_line_node, &shown);
+
+      int is_cursor_line = current_line_node == buffer->current_line_node;
+      int header[] = { line_num, is_cursor_line, rows };
+      uint64_t signature
+          = screen_hash (SCREEN_HASH_SEED, header, sizeof (header));
+      signature = screen_hash (signature, text, shown);
+
+      int dirty = 0;
+      for (int i = 0; i < rows; i++)
         {
-          draw_line_with_search_highlight (
-              screen_row, 8, line_text, text_width, COLOR_PAIR_TEXT,
-              line_wrap_enabled, current_line_node);
-          int wrapped_lines = get_wrapped_line_count (line_text, text_width,
-                                                      line_wrap_enabled);
-          screen_row += wrapped_lines;
-          free (line_text);
+          dirty |= screen_damage_row (&state->screen, screen_row - 1 + i,
+                                      signature + i);
         }
-      else
+
+      if (dirty)
         {
-          screen_row++;
+          for (int i = 0; i < rows; i++)
+            {
+              move (screen_row + i, 0);
+              clrtoeol ();
+            }
+          draw_line_number (screen_row, line_num, is_cursor_line);
+          draw_line_with_search_highlight (screen_row, 8, text, shown,
+                                           text_width, rows, COLOR_PAIR_TEXT,
+                                           wrap, current_line_node);
         }
+
+      screen_row += rows;
       current_line_node = current_line_node->next;
+      line_num++;
     }
 }
 
@@ -327,38 +426,35 @@ int
 get_cursor_screen_row (const TextBuffer *buffer, int visible_lines,
                        int top_line, int line_wrap_enabled)
 {
-  Line *current_line_node = buffer->head;
-  int line_count = 0;
   int screen_row = 1; // Start from row 1 to account for mode indicator
   int max_col = getmaxx (stdscr);
   int text_width = max_col - 8;
 
-  for (int i = 0; i < top_line && current_line_node != NULL; ++i)
-    {
-      current_line_node = current_line_node->next;
-      line_count++;
-    }
+  if (buffer->current_line_node == NULL)
+    return screen_row;
 
-  while (current_line_node != NULL
-         && current_line_node != buffer->current_line_node)
+  int cursor_line = get_cursor_line_number (buffer);
+  if (cursor_line < top_line)
     {
-      char *line_text = line_to_string (current_line_node);
-      int wrapped_lines = line_text
-                              ? get_wrapped_line_count (line_text, text_width,
-                                                        line_wrap_enabled)
-                              : 1;
-      if (line_text)
-        free (line_text);
-
-      screen_row += wrapped_lines;
-      current_line_node = current_line_node->next;
-      line_count++;
+      return screen_row - (top_line - cursor_line);
     }
 
-  if (current_line_node == buffer->current_line_node && line_wrap_enabled)
+  if (line_wrap_enabled)
+    screen_row += buffer->current_col_offset / text_width;
+
+  // Every line takes at least one row, so a cursor this many lines down is
+  // past the screen whatever wraps in between. Where it would be if nothing
+  // wrapped is enough to scroll to it, without measuring the lines between.
+  if (!line_wrap_enabled || cursor_line - top_line >= visible_lines)
+    return screen_row + (cursor_line - top_line);
+
+  Line *current_line_node = line_index_find (buffer, top_line);
+  for (int line = top_line; line < cursor_line && current_line_node != NULL;
+       line++)
     {
-      int cursor_wrapped_line = buffer->current_col_offset / text_width;
-      screen_row += cursor_wrapped_line;
+      screen_row += get_wrapped_line_count (line_get_length (current_line_node),
+                                            text_width, 1);
+      current_line_node = current_line_node->next;
     }
 
   return screen_row;
@@ -384,13 +480,33 @@ drawStatusBar (const EditorState *state, const char *command)
       mvprintw (status_row, 1, "[No Name]");
     }
 
-  int cursor_line = get_absolute_line_number (&state->buffer,
-                                              state->buffer.current_line_node)
-                    + 1;
+  int cursor_line = get_cursor_line_number (&state->buffer) + 1;
   int cursor_col = state->buffer.current_col_offset + 1;
   char position_text[50];
-  snprintf (position_text, sizeof (position_text), "Line %d, Col %d",
-            cursor_line, cursor_col);
+  int progress = buffer_load_progress (&state->buffer);
+  if (progress >= 0)
+    {
+      snprintf (position_text, sizeof (position_text),
+                "Loading %d%%  Line %d, Col %d", progress, cursor_line,
+                cursor_col);
+    }
+  else if (state->save != NULL)
+    {
+      snprintf (position_text, sizeof (position_text),
+                "Saving %d%%  Line %d, Col %d",
+                background_save_progress (state->save), cursor_line,
+                cursor_col);
+    }
+  else if (state->follower != NULL)
+    {
+      snprintf (position_text, sizeof (position_text),
+                "Following  Line %d, Col %d", cursor_line, cursor_col);
+    }
+  else
+    {
+      snprintf (position_text, sizeof (position_text), "Line %d, Col %d",
+                cursor_line, cursor_col);
+    }
   int pos_len = strlen (position_text);
   mvprintw (status_row, max_col - pos_len - 1, "%s", position_text);
 
@@ -469,35 +585,18 @@ handleInsertModeInput (int ch, EditorState *state)
     case 10:
       if (line != NULL)
         {
-          char *line_text = line_to_string (line);
-          if (line_text)
-            {
-              push_undo_operation (UNDO_SPLIT_LINE, line, current_col,
-                                   line_text + current_col,
-                                   strlen (line_text + current_col));
+          push_undo_operation (UNDO_SPLIT_LINE, line, current_col, NULL, 0);
 
-              Line *new_line = create_new_line (line_text + current_col);
+          buffer->current_line_node = buffer_replace_range (
+              buffer, line, current_col, line, current_col, "\n", 1,
+              &buffer->current_col_offset);
 
-              gap_buffer_move_cursor_to (line->gb, current_col);
-              size_t chars_to_delete = line_get_length (line) - current_col;
-              for (size_t i = 0; i < chars_to_delete; i++)
-                {
-                  gap_buffer_delete_char (line->gb);
-                }
-
-              insert_line_after (buffer, line, new_line);
-              buffer->current_line_node = new_line;
-              buffer->current_col_offset = 0;
-
-              free (line_text);
-
-              int cursor_screen_row = get_cursor_screen_row (
-                  buffer, visible_lines, state->top_line,
-                  state->line_wrap_enabled);
-              if (cursor_screen_row > visible_lines)
-                {
-                  state->top_line++;
-                }
+          int cursor_screen_row
+              = get_cursor_screen_row (buffer, visible_lines, state->top_line,
+                                       state->line_wrap_enabled);
+          if (cursor_screen_row > visible_lines)
+            {
+              state->top_line++;
             }
         }
       break;
@@ -517,31 +616,12 @@ handleInsertModeInput (int ch, EditorState *state)
         {
           Line *prev_line = line->prev;
           size_t prev_len = line_get_length (prev_line);
-          char *current_text = line_to_string (line);
-
-          if (current_text)
-            {
-              push_undo_operation (UNDO_MERGE_LINES, prev_line, prev_len,
-                                   current_text, strlen (current_text));
-
-              line_insert_string_at (prev_line, prev_len, current_text);
-              free (current_text);
-            }
 
+          push_undo_operation (UNDO_MERGE_LINES, prev_line, prev_len, NULL, 0);
           invalidate_undo_operations_for_line (line);
 
-          prev_line->next = line->next;
-          if (line->next != NULL)
-            {
-              line->next->prev = prev_line;
-            }
-          else
-            {
-              buffer->tail = prev_line;
-            }
-          gap_buffer_destroy (line->gb);
-          free (line);
-          buffer->num_lines--;
+          buffer_replace_range (buffer, prev_line, prev_len, line, 0, NULL, 0,
+                                NULL);
 
           buffer->current_line_node = prev_line;
           buffer->current_col_offset = prev_len;
@@ -567,35 +647,16 @@ handleInsertModeInput (int ch, EditorState *state)
 
           line_delete_char_at (line, current_col);
         }
-      else if (line->next != NULL)
+      else if (buffer_next_line (buffer, line) != NULL)
         {
           Line *next_line = line->next;
-          char *next_text = line_to_string (next_line);
-
-          if (next_text)
-            {
-              push_undo_operation (UNDO_MERGE_LINES, line,
-                                   line_get_length (line), next_text,
-                                   strlen (next_text));
-
-              line_insert_string_at (line, line_get_length (line), next_text);
-              free (next_text);
-            }
 
+          push_undo_operation (UNDO_MERGE_LINES, line, line_get_length (line),
+                               NULL, 0);
           invalidate_undo_operations_for_line (next_line);
 
-          line->next = next_line->next;
-          if (next_line->next != NULL)
-            {
-              next_line->next->prev = line;
-            }
-          else
-            {
-              buffer->tail = line;
-            }
-          gap_buffer_destroy (next_line->gb);
-          free (next_line);
-          buffer->num_lines--;
+          buffer_replace_range (buffer, line, line_get_length (line),
+                                next_line, 0, NULL, 0, NULL);
         }
       break;
 
@@ -621,7 +682,7 @@ handleInsertModeInput (int ch, EditorState *state)
       break;
 
     case KEY_DOWN:
-      if (line->next != NULL)
+      if (buffer_next_line (buffer, line) != NULL)
         {
           buffer->current_line_node = line->next;
           size_t new_line_length = line_get_length (buffer->current_line_node);
@@ -691,7 +752,7 @@ handleNormalModeInput (int ch, EditorState *state)
         }
       break;
     case 'j':
-      if (line->next != NULL)
+      if (buffer_next_line (buffer, line) != NULL)
         {
           buffer->current_line_node = line->next;
           size_t new_line_length = line_get_length (buffer->current_line_node);
@@ -717,8 +778,8 @@ handleNormalModeInput (int ch, EditorState *state)
             {
               buffer->current_col_offset = new_line_length;
             }
-          if (get_absolute_line_number (buffer, buffer->current_line_node)
-              < state->top_line)
+          sync_cursor_position (buffer);
+          if ((int)buffer->cursor_line_number < state->top_line)
             {
               state->top_line--;
             }
@@ -836,17 +897,7 @@ handleNormalModeInput (int ch, EditorState *state)
         else
           {
             push_undo_operation (UNDO_INSERT_LINE, NULL, 0, "", 0);
-            new_line->next = buffer->head;
-            if (buffer->head != NULL)
-              {
-                buffer->head->prev = new_line;
-              }
-            buffer->head = new_line;
-            if (buffer->tail == NULL)
-              {
-                buffer->tail = new_line;
-              }
-            buffer->num_lines++;
+            insert_line_at_beginning (buffer, new_line);
           }
 
         buffer->current_line_node = new_line;
@@ -925,7 +976,175 @@ handleNormalModeInput (int ch, EditorState *state)
           set_temp_message (state, "Nothing to redo");
         }
       break;
+
+    case 12: // Ctrl+L: the terminal may no longer show what was drawn
+      screen_damage_all (&state->screen);
+      clearok (curscr, TRUE);
+      break;
+    }
+}
+
+// Lets a mapped buffer drop what is not near the screen, the cursor or the
+// current search match. Returns the bytes it still uses.
+static size_t
+page_out_cold_lines (EditorState *state)
+{
+  TextBuffer *buffer = &state->buffer;
+  size_t hot_lines[3];
+  size_t num_hot = 0;
+
+  hot_lines[num_hot++] = state->top_line;
+  hot_lines[num_hot++] = get_cursor_line_number (buffer);
+  if (search_state.has_active_search
+      && line_index_contains (buffer, search_state.current_match_line))
+    {
+      hot_lines[num_hot++]
+          = line_index_position (search_state.current_match_line);
+    }
+
+  return buffer_page_out (buffer, hot_lines, num_hot);
+}
+
+// Puts the cursor on the last line and scrolls it to the bottom of the
+// screen.
+static void
+pin_to_end (EditorState *state)
+{
+  TextBuffer *buffer = &state->buffer;
+  int visible_lines = getmaxy (stdscr) - 2;
+
+  buffer->current_line_node = buffer->tail;
+  buffer->current_col_offset = 0;
+  state->top_line = buffer->num_lines > (size_t)visible_lines
+                        ? (int)(buffer->num_lines - visible_lines)
+                        : 0;
+}
+
+// Appends what was written to the followed file. The view stays pinned to
+// the end as long as the cursor is on the last line. Returns nonzero when
+// the buffer changed.
+static int
+poll_follower (EditorState *state)
+{
+  TextBuffer *buffer = &state->buffer;
+  int at_end = buffer->current_line_node == buffer->tail;
+  size_t appended;
+  FollowStatus status = poll_following (state, &appended);
+
+  if (appended > 0 && at_end)
+    pin_to_end (state);
+
+  if (status != FOLLOW_OK)
+    {
+      stop_following (state);
+      set_temp_message (state, status == FOLLOW_TRUNCATED
+                                   ? "Stopped following: file was truncated"
+                               : status == FOLLOW_GONE
+                                   ? "Stopped following: file was removed"
+                                   : "Stopped following: read failed");
+      return 1;
+    }
+  return appended > 0;
+}
+
+// Reads a whole number of megabytes into *bytes. Returns 0 when `text` is
+// anything else or too big.
+static int
+parse_megabytes (const char *text, size_t *bytes)
+{
+  if (!isdigit ((unsigned char)*text))
+    return 0;
+
+  char *end;
+  errno = 0;
+  unsigned long megabytes = strtoul (text, &end, 10);
+  if (errno == ERANGE || *end != '\0' || megabytes > SIZE_MAX >> 20)
+    return 0;
+
+  *bytes = (size_t)megabytes << 20;
+  return 1;
+}
+
+// Reports how a save to `filename` ended. Edits logged before
+// `journal_position` are in the file now. Returns nonzero on success.
+static int
+report_save (EditorState *state, const char *filename, int status,
+             uint64_t journal_position)
+{
+  if (status != 0)
+    {
+      char message[sizeof (state->temp_message)];
+      snprintf (message, sizeof (message), "Error saving %s: %s", filename,
+                strerror (errno));
+      set_temp_message (state, message);
+      return 0;
+    }
+
+  set_temp_message (state, "File saved");
+
+  // The log only covers the file being edited
+  if (state->filename != NULL && strcmp (filename, state->filename) == 0)
+    {
+      if (state->journal != NULL)
+        journal_checkpoint_at (state->journal, &state->buffer.disk,
+                               journal_position);
+      // The save replaced the file; follow the new one from its end
+      if (state->follower != NULL)
+        start_following (state);
+    }
+  return 1;
+}
+
+// Waits for a save still running in the background, if there is one, and
+// reports it. Returns nonzero unless it failed.
+static int
+finish_background_save (EditorState *state)
+{
+  if (state->save == NULL)
+    return 1;
+
+  BackgroundSave *save = state->save;
+  int status = background_save_finish (save, &state->buffer);
+  state->save = NULL;
+
+  int saved = report_save (state, save->filename, status,
+                           state->save_journal_position);
+  background_save_free (save);
+  return saved;
+}
+
+// Quits, unless a save that was still running failed: then the editor
+// stays open with the error showing.
+static void
+quit_editor (EditorState *state)
+{
+  if (!finish_background_save (state))
+    return;
+
+  close_editor_journal (state);
+  endwin ();
+  exit (EXIT_SUCCESS);
+}
+
+// Saves the buffer, in the background when that takes a while, and reports
+// the outcome on the status bar. Returns nonzero unless the save failed.
+static int
+save_buffer (EditorState *state, const char *filename)
+{
+  // One save at a time, in the order they were asked for
+  finish_background_save (state);
+
+  uint64_t position
+      = state->journal != NULL ? journal_position (state->journal) : 0;
+  int status;
+  state->save = background_save_start (filename, &state->buffer, &status);
+  if (state->save != NULL)
+    {
+      state->save_journal_position = position;
+      set_temp_message (state, "Saving in the background");
+      return 1;
     }
+  return report_save (state, filename, status, UINT64_MAX);
 }
 
 void
@@ -934,7 +1153,6 @@ handleCommandModeInput (int ch, char *command, EditorState *state)
   static int command_index = 0;
   static int is_search_command = 0; // Track if this is a search command
   static int search_direction = 1;  // 1 for forward, 0 for backward
-  TextBuffer *buffer = &state->buffer;
 
   if (!search_initialized)
     {
@@ -995,15 +1213,13 @@ handleCommandModeInput (int ch, char *command, EditorState *state)
         }
       else if (strcmp (command, "q") == 0)
         {
-          endwin ();
-          exit (EXIT_SUCCESS);
+          quit_editor (state);
         }
       else if (strcmp (command, "w") == 0)
         {
           if (state->filename != NULL && strlen (state->filename) > 0)
             {
-              saveToFile (state->filename, buffer);
-              set_temp_message (state, "File saved");
+              save_buffer (state, state->filename);
             }
           else
             {
@@ -1015,28 +1231,28 @@ handleCommandModeInput (int ch, char *command, EditorState *state)
           const char *save_filename = command + 2; // Skip "w "
           if (strlen (save_filename) > 0)
             {
-              saveToFile (save_filename, buffer);
-              set_temp_message (state, "File saved");
+              save_buffer (state, save_filename);
             }
         }
       else if (strcmp (command, "wq") == 0)
         {
-          if (state->filename != NULL && strlen (state->filename) > 0)
+          // Stay open with the error showing if the save failed
+          if (state->filename == NULL || strlen (state->filename) == 0
+              || (save_buffer (state, state->filename)
+                  && finish_background_save (state)))
             {
-              saveToFile (state->filename, buffer);
+              quit_editor (state);
             }
-          endwin ();
-          exit (EXIT_SUCCESS);
         }
       else if (strncmp (command, "wq ", 3) == 0)
         {
           const char *save_filename = command + 3; // Skip "wq "
-          if (strlen (save_filename) > 0)
+          if (strlen (save_filename) == 0
+              || (save_buffer (state, save_filename)
+                  && finish_background_save (state)))
             {
-              saveToFile (save_filename, buffer);
+              quit_editor (state);
             }
-          endwin ();
-          exit (EXIT_SUCCESS);
         }
       else if (strcmp (command, "wrap") == 0)
         {
@@ -1064,6 +1280,68 @@ handleCommandModeInput (int ch, char *command, EditorState *state)
           search_state.case_sensitive = 1;
           set_temp_message (state, "Search is now case sensitive");
         }
+      else if (strcmp (command, "set compress") == 0)
+        {
+          state->buffer.compressed = 1;
+          set_temp_message (state, "Saves will be gzip compressed");
+        }
+      else if (strcmp (command, "set nocompress") == 0)
+        {
+          state->buffer.compressed = 0;
+          set_temp_message (state, "Saves will be uncompressed");
+        }
+      else if (strcmp (command, "follow") == 0)
+        {
+          if (start_following (state) && buffer_is_loaded (&state->buffer))
+            {
+              pin_to_end (state);
+              set_temp_message (state, "Following the end of the file");
+            }
+          else if (state->follower != NULL)
+            {
+              // Jumping to the end would split the whole file into lines
+              set_temp_message (state, "Following: new lines show once the "
+                                       "end of the file is reached");
+            }
+        }
+      else if (strcmp (command, "nofollow") == 0)
+        {
+          stop_following (state);
+          set_temp_message (state, "Stopped following");
+        }
+      else if (strcmp (command, "budget") == 0
+               || strncmp (command, "budget ", 7) == 0)
+        {
+          Pager *pager = state->buffer.pager;
+          size_t budget = 0;
+          if (pager == NULL)
+            {
+              set_temp_message (state, "Only mapped files are paged");
+            }
+          else if (command[6] == ' '
+                   && !parse_megabytes (command + 7, &budget))
+            {
+              set_temp_message (state, "Invalid budget");
+            }
+          else
+            {
+              if (command[6] == ' ')
+                pager->budget = budget;
+              char message[sizeof (state->temp_message)];
+              size_t used = page_out_cold_lines (state);
+              snprintf (message, sizeof (message),
+                        "Using %zuM of %zuM budget, %zuM spilled",
+                        used >> 20, pager->budget >> 20,
+                        pager->spilled_bytes >> 20);
+              set_temp_message (state, message);
+            }
+        }
+      else if (strcmp (command, "pools") == 0)
+        {
+          char stats[sizeof (state->temp_message)];
+          pool_format_stats (stats, sizeof (stats));
+          set_temp_message (state, stats);
+        }
       else if (!is_search_command)
         {
           set_temp_message (state, "Unknown command");
@@ -1109,7 +1387,52 @@ handleCommandModeInput (int ch, char *command, EditorState *state)
 void
 handleInput (char *command, EditorState *state)
 {
-  int ch = getch ();
+  int ch;
+  int loading = buffer_load_progress (&state->buffer) >= 0;
+
+  int catching_up = state->follower != NULL && state->follower->pending;
+
+  if (loading || catching_up)
+    timeout (LOAD_POLL_MS);
+  else if (state->save != NULL)
+    timeout (SAVE_POLL_MS);
+  else
+    timeout (IDLE_TIMEOUT_MS);
+
+  while ((ch = getch ()) == ERR)
+    {
+      // Lines that arrived from the loader go in first; returning redraws
+      // the screen and the load progress, or why the load stopped short
+      if (loading)
+        {
+          if (!buffer_poll_load (&state->buffer, IDLE_LOAD_LINES))
+            report_load_error (state);
+          return;
+        }
+
+      // A save in the background redraws its progress until it is done.
+      // It is replacing the file, so a followed file waits for it.
+      if (state->save != NULL)
+        {
+          if (background_save_done (state->save))
+            finish_background_save (state);
+          return;
+        }
+
+      // So does whatever was appended to a followed file
+      if (state->follower != NULL && poll_follower (state))
+        return;
+
+      // Idle: compact edited lines a batch at a time, then page out what
+      // has gone cold and block until the next key, unless a followed file
+      // still needs polling
+      if (buffer_compact_lines (&state->buffer, IDLE_COMPACT_LINES) == 0)
+        {
+          page_out_cold_lines (state);
+          if (state->follower == NULL)
+            timeout (-1);
+        }
+    }
 
   switch (state->current_mode)
     {
@@ -1123,4 +1446,6 @@ handleInput (char *command, EditorState *state)
       handleCommandModeInput (ch, command, state);
       break;
     }
+
+  sync_cursor_position (&state->buffer);
 }
@@ -1,11 +1,54 @@
 
 #include "data_structures.h"
+#include "journal.h"
+#include "line_index.h"
 #include "undo.h"
 #include <stdlib.h>
 #include <string.h>
 
 UndoStack undo_stack;
 
+// Every edit pushed here, and every undo and redo, is also logged to it
+static Journal *undo_journal = NULL;
+
+// Logs an edit about to be made. Undo and redo log the edit they make
+// rather than the fact that they undid or redid something, so the log
+// replays without the history it was written with: after a save, undo
+// reaches back into edits the log no longer holds.
+static void
+log_edit (UndoType type, Line *line, size_t col, const char *data,
+          size_t data_len)
+{
+  if (undo_journal)
+    {
+      journal_record (undo_journal, type,
+                      line ? line_index_position (line) : JOURNAL_NO_LINE,
+                      col, data, data_len);
+    }
+}
+
+// Logs the removal of the line after `prev` (the first line when NULL),
+// with its text so that replay can check it removes the right one.
+static void
+log_line_removal (Line *prev, Line *removed)
+{
+  if (!undo_journal)
+    return;
+
+  char *text = line_to_string (removed);
+  if (text)
+    log_edit (UNDO_DELETE_LINE, prev, 0, text, line_get_length (removed));
+  free (text);
+}
+
+// Logs deleting the character at `col`.
+static void
+log_char_deletion (Line *line, size_t col)
+{
+  char c = line_get_char_at (line, col);
+  log_edit (UNDO_DELETE_CHAR, line, col, &c, 1);
+}
+
 void
 init_undo_system (void)
 {
@@ -21,10 +64,18 @@ init_undo_system (void)
     }
 }
 
+void
+undo_attach_journal (Journal *journal)
+{
+  undo_journal = journal;
+}
+
 void
 push_undo_operation (UndoType type, Line *target_line, size_t col_pos,
                      const char *data, size_t data_len)
 {
+  log_edit (type, target_line, col_pos, data, data_len);
+
   clear_redo_stack ();
 
   undo_stack.current = (undo_stack.current + 1) % MAX_UNDO_OPERATIONS;
@@ -59,16 +110,7 @@ is_line_valid_in_buffer (TextBuffer *buffer, Line *target_line)
   if (!buffer || !target_line)
     return 0;
 
-  Line *current = buffer->head;
-  while (current != NULL)
-    {
-      if (current == target_line)
-        {
-          return 1;
-        }
-      current = current->next;
-    }
-  return 0;
+  return line_index_contains (buffer, target_line);
 }
 
 void
@@ -130,18 +172,14 @@ validate_cursor_position (TextBuffer *buffer)
       insert_line_at_end (buffer, initial_line);
       buffer->current_line_node = initial_line;
       buffer->current_col_offset = 0;
-      return;
     }
-
-  if (!buffer->current_line_node
-      || !is_line_valid_in_buffer (buffer, buffer->current_line_node))
+  else if (!buffer->current_line_node
+           || !is_line_valid_in_buffer (buffer, buffer->current_line_node))
     {
       buffer->current_line_node = buffer->head;
       buffer->current_col_offset = 0;
-      return;
     }
-
-  if (buffer->current_line_node)
+  else
     {
       size_t line_len = line_get_length (buffer->current_line_node);
       if (buffer->current_col_offset > line_len)
@@ -149,6 +187,9 @@ validate_cursor_position (TextBuffer *buffer)
           buffer->current_col_offset = line_len;
         }
     }
+
+  // Undo and redo can touch lines above the cursor
+  refresh_cursor_position (buffer);
 }
 
 void
@@ -164,6 +205,8 @@ perform_undo (TextBuffer *buffer)
       Line *to_remove = buffer->head;
       if (to_remove)
         {
+          log_line_removal (NULL, to_remove);
+
           // Invalidate any operations that reference the line being removed
           invalidate_undo_operations_for_line (to_remove);
 
@@ -175,19 +218,8 @@ perform_undo (TextBuffer *buffer)
               buffer->current_col_offset = 0;
             }
 
-          buffer->head = to_remove->next;
-          if (buffer->head)
-            {
-              buffer->head->prev = NULL;
-            }
-          else
-            {
-              buffer->tail = NULL;
-            }
-
-          gap_buffer_destroy (to_remove->gb);
-          free (to_remove);
-          buffer->num_lines--;
+          remove_line (buffer, to_remove);
+          free_line (to_remove);
         }
       undo_stack.current--;
       validate_cursor_position (buffer);
@@ -209,6 +241,7 @@ perform_undo (TextBuffer *buffer)
     case UNDO_INSERT_CHAR:
       if (op->col_pos < line_get_length (target_line))
         {
+          log_char_deletion (target_line, op->col_pos);
           line_delete_char_at (target_line, op->col_pos);
 
           // Update cursor if it's on this line
@@ -224,6 +257,7 @@ perform_undo (TextBuffer *buffer)
       // Only restore the character if the position is valid and makes sense
       if (op->col_pos <= line_get_length (target_line) && op->data_len > 0)
         {
+          log_edit (UNDO_INSERT_CHAR, target_line, op->col_pos, op->data, 1);
           line_insert_char_at (target_line, op->col_pos, op->data[0]);
 
           // Update cursor if it's on this line
@@ -241,6 +275,8 @@ perform_undo (TextBuffer *buffer)
         Line *to_remove = target_line->next;
         if (to_remove)
           {
+            log_line_removal (target_line, to_remove);
+
             // Invalidate any operations that reference the line being removed
             invalidate_undo_operations_for_line (to_remove);
 
@@ -252,27 +288,15 @@ perform_undo (TextBuffer *buffer)
                 buffer->current_col_offset = line_get_length (target_line);
               }
 
-            // Remove the line from the linked list
-            if (to_remove->next)
-              {
-                to_remove->next->prev = target_line;
-              }
-            target_line->next = to_remove->next;
-
-            if (buffer->tail == to_remove)
-              {
-                buffer->tail = target_line;
-              }
-
-            gap_buffer_destroy (to_remove->gb);
-            free (to_remove);
-            buffer->num_lines--;
+            remove_line (buffer, to_remove);
+            free_line (to_remove);
           }
         break;
       }
 
     case UNDO_DELETE_LINE:
       {
+        log_edit (UNDO_INSERT_LINE, target_line, 0, op->data, op->data_len);
         Line *new_line = create_new_line (op->data);
         if (new_line)
           {
@@ -289,6 +313,9 @@ perform_undo (TextBuffer *buffer)
             char *second_content = line_to_string (second_line);
             if (second_content)
               {
+                log_edit (UNDO_MERGE_LINES, target_line, op->col_pos, NULL,
+                          0);
+
                 // Invalidate operations that reference the second line
                 invalidate_undo_operations_for_line (second_line);
 
@@ -306,19 +333,8 @@ perform_undo (TextBuffer *buffer)
                 free (second_content);
 
                 // Remove the second line
-                target_line->next = second_line->next;
-                if (second_line->next)
-                  {
-                    second_line->next->prev = target_line;
-                  }
-                else
-                  {
-                    buffer->tail = target_line;
-                  }
-
-                gap_buffer_destroy (second_line->gb);
-                free (second_line);
-                buffer->num_lines--;
+                remove_line (buffer, second_line);
+                free_line (second_line);
               }
           }
         break;
@@ -328,35 +344,22 @@ perform_undo (TextBuffer *buffer)
       {
         // Split the line back at the merge point
         size_t split_pos = op->col_pos;
-        char *line_text = line_to_string (target_line);
-
-        if (line_text && strlen (line_text) >= split_pos)
+        if (split_pos <= line_get_length (target_line))
           {
-            Line *new_line = create_new_line (line_text + split_pos);
+            log_edit (UNDO_SPLIT_LINE, target_line, split_pos, NULL, 0);
+            int cursor_moves = buffer->current_line_node == target_line
+                               && buffer->current_col_offset > split_pos;
 
-            if (new_line)
-              {
-                // Truncate the original line
-                gap_buffer_move_cursor_to (target_line->gb, split_pos);
-                size_t chars_to_delete
-                    = line_get_length (target_line) - split_pos;
-                for (size_t i = 0; i < chars_to_delete; i++)
-                  {
-                    gap_buffer_delete_char (target_line->gb);
-                  }
-
-                // Insert the new line
-                insert_line_after_buffer (buffer, target_line, new_line);
+            Line *new_line
+                = buffer_replace_range (buffer, target_line, split_pos,
+                                        target_line, split_pos, "\n", 1, NULL);
 
-                // Update cursor if it was beyond the split point
-                if (buffer->current_line_node == target_line
-                    && buffer->current_col_offset > split_pos)
-                  {
-                    buffer->current_line_node = new_line;
-                    buffer->current_col_offset -= split_pos;
-                  }
+            // Move the cursor along if it was beyond the split point
+            if (cursor_moves)
+              {
+                buffer->current_line_node = new_line;
+                buffer->current_col_offset -= split_pos;
               }
-            free (line_text);
           }
         break;
       }
@@ -392,6 +395,7 @@ perform_redo (TextBuffer *buffer)
     case UNDO_INSERT_CHAR:
       if (op->col_pos <= line_get_length (target_line))
         {
+          log_edit (UNDO_INSERT_CHAR, target_line, op->col_pos, op->data, 1);
           line_insert_char_at (target_line, op->col_pos, op->data[0]);
 
           // Update cursor if it's on this line
@@ -406,6 +410,7 @@ perform_redo (TextBuffer *buffer)
     case UNDO_DELETE_CHAR:
       if (op->col_pos < line_get_length (target_line))
         {
+          log_char_deletion (target_line, op->col_pos);
           line_delete_char_at (target_line, op->col_pos);
 
           // Update cursor if it's on this line
@@ -419,6 +424,7 @@ perform_redo (TextBuffer *buffer)
 
     case UNDO_INSERT_LINE:
       {
+        log_edit (UNDO_INSERT_LINE, target_line, 0, op->data, op->data_len);
         Line *new_line = create_new_line (op->data);
         if (new_line)
           {
@@ -432,6 +438,8 @@ perform_redo (TextBuffer *buffer)
         Line *to_remove = target_line->next;
         if (to_remove)
           {
+            log_line_removal (target_line, to_remove);
+
             // Invalidate any operations that reference the line being removed
             invalidate_undo_operations_for_line (to_remove);
 
@@ -443,21 +451,8 @@ perform_redo (TextBuffer *buffer)
                 buffer->current_col_offset = line_get_length (target_line);
               }
 
-            // Remove the line
-            if (to_remove->next)
-              {
-                to_remove->next->prev = target_line;
-              }
-            target_line->next = to_remove->next;
-
-            if (buffer->tail == to_remove)
-              {
-                buffer->tail = target_line;
-              }
-
-            gap_buffer_destroy (to_remove->gb);
-            free (to_remove);
-            buffer->num_lines--;
+            remove_line (buffer, to_remove);
+            free_line (to_remove);
           }
         break;
       }
@@ -466,35 +461,22 @@ perform_redo (TextBuffer *buffer)
       {
         // Split the line at the specified position
         size_t split_pos = op->col_pos;
-        char *line_text = line_to_string (target_line);
-
-        if (line_text && strlen (line_text) >= split_pos)
+        if (split_pos <= line_get_length (target_line))
           {
-            Line *new_line = create_new_line (line_text + split_pos);
+            log_edit (UNDO_SPLIT_LINE, target_line, split_pos, NULL, 0);
+            int cursor_moves = buffer->current_line_node == target_line
+                               && buffer->current_col_offset > split_pos;
 
-            if (new_line)
-              {
-                // Truncate the original line
-                gap_buffer_move_cursor_to (target_line->gb, split_pos);
-                size_t chars_to_delete
-                    = line_get_length (target_line) - split_pos;
-                for (size_t i = 0; i < chars_to_delete; i++)
-                  {
-                    gap_buffer_delete_char (target_line->gb);
-                  }
+            Line *new_line
+                = buffer_replace_range (buffer, target_line, split_pos,
+                                        target_line, split_pos, "\n", 1, NULL);
 
-                // Insert the new line
-                insert_line_after_buffer (buffer, target_line, new_line);
-
-                // Update cursor if it was beyond the split point
-                if (buffer->current_line_node == target_line
-                    && buffer->current_col_offset > split_pos)
-                  {
-                    buffer->current_line_node = new_line;
-                    buffer->current_col_offset -= split_pos;
-                  }
+            // Move the cursor along if it was beyond the split point
+            if (cursor_moves)
+              {
+                buffer->current_line_node = new_line;
+                buffer->current_col_offset -= split_pos;
               }
-            free (line_text);
           }
         break;
       }
@@ -504,41 +486,24 @@ perform_redo (TextBuffer *buffer)
         Line *second_line = target_line->next;
         if (second_line)
           {
-            char *second_content = line_to_string (second_line);
-            if (second_content)
-              {
-                // Invalidate operations that reference the second line
-                invalidate_undo_operations_for_line (second_line);
+            log_edit (UNDO_MERGE_LINES, target_line,
+                      line_get_length (target_line), NULL, 0);
 
-                // Update cursor if it's on the second line
-                if (buffer->current_line_node == second_line)
-                  {
-                    buffer->current_line_node = target_line;
-                    buffer->current_col_offset = line_get_length (target_line)
-                                                 + buffer->current_col_offset;
-                  }
+            // Invalidate operations that reference the second line
+            invalidate_undo_operations_for_line (second_line);
 
-                // Merge the lines
-                line_insert_string_at (target_line,
-                                       line_get_length (target_line),
-                                       second_content);
-                free (second_content);
-
-                // Remove the second line
-                target_line->next = second_line->next;
-                if (second_line->next)
-                  {
-                    second_line->next->prev = target_line;
-                  }
-                else
-                  {
-                    buffer->tail = target_line;
-                  }
-
-                gap_buffer_destroy (second_line->gb);
-                free (second_line);
-                buffer->num_lines--;
+            // Update cursor if it's on the second line
+            if (buffer->current_line_node == second_line)
+              {
+                buffer->current_line_node = target_line;
+                buffer->current_col_offset = line_get_length (target_line)
+                                             + buffer->current_col_offset;
               }
+
+            // Merge the lines
+            buffer_replace_range (buffer, target_line,
+                                  line_get_length (target_line), second_line,
+                                  0, NULL, 0, NULL);
           }
         break;
       }
@@ -555,22 +520,13 @@ get_line_number (TextBuffer *buffer, Line *target)
   if (!buffer || !target)
     return 0;
 
-  Line *current = buffer->head;
-  size_t line_num = 0;
-
-  while (current != NULL && current != target)
-    {
-      current = current->next;
-      line_num++;
-    }
-
   // If target not found, return a safe value
-  if (current != target)
+  if (!line_index_contains (buffer, target))
     {
       return 0;
     }
 
-  return line_num;
+  return line_index_position (target);
 }
 
 Line *
@@ -579,14 +535,5 @@ get_line_by_number (TextBuffer *buffer, size_t line_num)
   if (!buffer || !buffer->head)
     return NULL;
 
-  Line *current = buffer->head;
-  size_t count = 0;
-
-  while (current != NULL && count < line_num)
-    {
-      current = current->next;
-      count++;
-    }
-
-  return current;
+  return line_index_find (buffer, line_num);
 }
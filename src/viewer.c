@@ -0,0 +1,720 @@
+#define _GNU_SOURCE
+
+#ifdef _WIN32
+#include <pdcurses.h>
+#else
+#include <ncurses.h>
+#endif
+
+#include "color_config.h"
+#include "search.h"
+#include "startup_time.h"
+#include "viewer.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Columns moved per horizontal scroll when lines are not wrapped
+#define VIEWER_SCROLL_COLUMNS 8
+// Screen columns taken by the line numbers, as in the editor
+#define VIEWER_TEXT_COL 8
+
+// Maps `filename` read-only. Returns 0 on success and -1 with errno set.
+int
+viewer_open (Viewer *viewer, const char *filename)
+{
+  memset (viewer, 0, sizeof (*viewer));
+  viewer->filename = filename;
+  viewer->line_wrap_enabled = 1;
+
+  int fd = open (filename, O_RDONLY);
+  if (fd < 0)
+    return -1;
+
+  struct stat st;
+  if (fstat (fd, &st) != 0)
+    {
+      close (fd);
+      return -1;
+    }
+  if (!S_ISREG (st.st_mode))
+    {
+      close (fd);
+      errno = EINVAL;
+      return -1;
+    }
+
+  viewer->data = "";
+  if (st.st_size > 0)
+    {
+      void *mapping
+          = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (mapping == MAP_FAILED)
+        {
+          close (fd);
+          return -1;
+        }
+      viewer->data = mapping;
+      viewer->size = st.st_size;
+    }
+  close (fd);
+
+  viewer->checkpoint_capacity = 1024;
+  viewer->checkpoints
+      = malloc (viewer->checkpoint_capacity * sizeof (uint64_t));
+  if (!viewer->checkpoints)
+    {
+      viewer_close (viewer);
+      errno = ENOMEM;
+      return -1;
+    }
+
+  viewer->checkpoints[0] = 0;
+  viewer->num_checkpoints = 1;
+  viewer->num_lines = 1;
+  newline_scanner_init (&viewer->scanner, viewer->data, 0, viewer->size);
+  return 0;
+}
+
+void
+viewer_close (Viewer *viewer)
+{
+  if (viewer->size > 0)
+    munmap ((void *)viewer->data, viewer->size);
+  free (viewer->checkpoints);
+  viewer->checkpoints = NULL;
+  viewer->data = NULL;
+  viewer->size = 0;
+}
+
+// Finds the start of one more line. Returns 0 once every line is known.
+static int
+index_next_line (Viewer *viewer)
+{
+  if (viewer->complete)
+    return 0;
+
+  // A newline at the very end does not start another line
+  size_t newline = newline_scanner_next (&viewer->scanner);
+  if (newline + 1 >= viewer->size)
+    {
+      viewer->complete = 1;
+      return 0;
+    }
+
+  if (viewer->num_lines % VIEWER_INDEX_STRIDE == 0)
+    {
+      if (viewer->num_checkpoints == viewer->checkpoint_capacity)
+        {
+          size_t capacity = viewer->checkpoint_capacity * 2;
+          uint64_t *grown = realloc (viewer->checkpoints,
+                                     capacity * sizeof (uint64_t));
+          if (!grown)
+            {
+              viewer->complete = 1;
+              return 0;
+            }
+          viewer->checkpoints = grown;
+          viewer->checkpoint_capacity = capacity;
+        }
+      viewer->checkpoints[viewer->num_checkpoints++] = newline + 1;
+    }
+
+  viewer->num_lines++;
+  viewer->last_start = newline + 1;
+  return 1;
+}
+
+static size_t
+line_end (const Viewer *viewer, size_t start)
+{
+  const char *newline
+      = memchr (viewer->data + start, '\n', viewer->size - start);
+  return newline ? (size_t)(newline - viewer->data) : viewer->size;
+}
+
+// Text of line `line` (counted from 0), or NULL past the last line. The
+// text is not terminated; *length excludes the newline.
+const char *
+viewer_line (Viewer *viewer, size_t line, size_t *length)
+{
+  while (viewer->num_lines <= line && index_next_line (viewer))
+    ;
+  if (line >= viewer->num_lines)
+    return NULL;
+
+  size_t start = viewer->checkpoints[line / VIEWER_INDEX_STRIDE];
+  for (size_t i = 0; i < line % VIEWER_INDEX_STRIDE; i++)
+    {
+      start = line_end (viewer, start) + 1;
+    }
+
+  *length = line_end (viewer, start) - start;
+  return viewer->data + start;
+}
+
+size_t
+viewer_count_lines (Viewer *viewer)
+{
+  while (index_next_line (viewer))
+    ;
+  return viewer->num_lines;
+}
+
+// Number of the line holding byte `offset`.
+size_t
+viewer_line_of_offset (Viewer *viewer, size_t offset)
+{
+  while (viewer->last_start <= offset && index_next_line (viewer))
+    ;
+
+  size_t low = 0;
+  size_t high = viewer->num_checkpoints;
+  while (high - low > 1)
+    {
+      size_t middle = low + (high - low) / 2;
+      if (viewer->checkpoints[middle] <= offset)
+        low = middle;
+      else
+        high = middle;
+    }
+
+  size_t line = low * VIEWER_INDEX_STRIDE;
+  const char *next = viewer->data + viewer->checkpoints[low];
+  const char *end = viewer->data + offset;
+  while ((next = memchr (next, '\n', end - next)) != NULL)
+    {
+      next++;
+      line++;
+    }
+  return line;
+}
+
+static int
+matches_at (const Viewer *viewer, size_t offset, const char *term,
+            size_t term_length)
+{
+  if (offset + term_length > viewer->size)
+    return 0;
+  if (viewer->case_sensitive)
+    return memcmp (viewer->data + offset, term, term_length) == 0;
+  return strncasecmp_custom (viewer->data + offset, term, term_length) == 0;
+}
+
+// First match starting in [from, to).
+static int
+find_forward (const Viewer *viewer, const char *term, size_t term_length,
+              size_t from, size_t to, size_t *match)
+{
+  if (viewer->case_sensitive)
+    {
+      size_t span = to + term_length - 1;
+      if (span > viewer->size)
+        span = viewer->size;
+      if (span <= from)
+        return 0;
+
+      const char *found
+          = memmem (viewer->data + from, span - from, term, term_length);
+      if (found == NULL)
+        return 0;
+      *match = found - viewer->data;
+      return 1;
+    }
+
+  char lower = to_lower (term[0]);
+  for (size_t i = from; i < to; i++)
+    {
+      if (to_lower (viewer->data[i]) == lower
+          && matches_at (viewer, i, term, term_length))
+        {
+          *match = i;
+          return 1;
+        }
+    }
+  return 0;
+}
+
+// Last match starting in [to, from).
+static int
+find_backward (const Viewer *viewer, const char *term, size_t term_length,
+               size_t from, size_t to, size_t *match)
+{
+  char lower = to_lower (term[0]);
+  for (size_t i = from; i > to; i--)
+    {
+      if (to_lower (viewer->data[i - 1]) == lower
+          && matches_at (viewer, i - 1, term, term_length))
+        {
+          *match = i - 1;
+          return 1;
+        }
+    }
+  return 0;
+}
+
+// Finds `term` at or after byte `from` going forward, or before it going
+// backward, wrapping around the ends of the file like the editor's search.
+int
+viewer_find (const Viewer *viewer, const char *term, size_t from,
+             int forward, size_t *match)
+{
+  size_t term_length = strlen (term);
+  if (term_length == 0 || term_length > viewer->size)
+    return 0;
+  if (from > viewer->size)
+    from = viewer->size;
+
+  if (forward)
+    {
+      return find_forward (viewer, term, term_length, from, viewer->size,
+                           match)
+             || find_forward (viewer, term, term_length, 0, from, match);
+    }
+  return find_backward (viewer, term, term_length, from, 0, match)
+         || find_backward (viewer, term, term_length, viewer->size, from,
+                           match);
+}
+
+static int
+line_rows (const Viewer *viewer, size_t length, int width)
+{
+  if (!viewer->line_wrap_enabled || length == 0)
+    return 1;
+  return (length + width - 1) / width;
+}
+
+// Moves top_line so the cursor line is on screen.
+static void
+scroll_to_cursor (Viewer *viewer, int visible_lines, int width)
+{
+  if (viewer->cursor_line < viewer->top_line)
+    {
+      viewer->top_line = viewer->cursor_line;
+      return;
+    }
+  if (viewer->cursor_line - viewer->top_line >= (size_t)visible_lines)
+    {
+      viewer->top_line = viewer->cursor_line - visible_lines + 1;
+    }
+
+  for (;;)
+    {
+      int rows = 0;
+      size_t length;
+      for (size_t line = viewer->top_line; line <= viewer->cursor_line;
+           line++)
+        {
+          viewer_line (viewer, line, &length);
+          rows += line_rows (viewer, length, width);
+        }
+      if (rows <= visible_lines || viewer->top_line == viewer->cursor_line)
+        break;
+      viewer->top_line++;
+    }
+}
+
+// Draws one line of the file starting at `row`, clipped to `last_row`, with
+// search matches highlighted the way the editor shows them. Returns the rows
+// it takes up.
+static int
+draw_view_line (Viewer *viewer, int row, int last_row, int width,
+                const char *text, size_t length)
+{
+  size_t start = text - viewer->data;
+  size_t first = viewer->line_wrap_enabled ? 0 : viewer->left_col;
+  size_t last = viewer->line_wrap_enabled ? length : first + width;
+  if (last > length)
+    last = length;
+
+  size_t term_length = strlen (viewer->search_term);
+  int searching = viewer->has_active_search && term_length > 0;
+  size_t highlight_end = 0;
+  int color_pair = COLOR_PAIR_TEXT;
+
+  // A match can begin left of the first column shown
+  if (searching)
+    {
+      size_t from = first >= term_length ? first - term_length + 1 : 0;
+      for (size_t i = from; i < first; i++)
+        {
+          if (matches_at (viewer, start + i, viewer->search_term,
+                          term_length))
+            {
+              highlight_end = i + term_length;
+              color_pair = start + i == viewer->match_offset
+                               ? COLOR_PAIR_CURSOR_LINE
+                               : COLOR_PAIR_STATUS_BAR;
+            }
+        }
+    }
+
+  int rows = line_rows (viewer, length, width);
+  for (size_t i = first; i < last; i++)
+    {
+      int screen_row = row + (int)((i - first) / width);
+      if (screen_row > last_row)
+        break;
+
+      if (searching && i >= highlight_end
+          && matches_at (viewer, start + i, viewer->search_term,
+                         term_length)
+          && i + term_length <= length)
+        {
+          highlight_end = i + term_length;
+          color_pair = start + i == viewer->match_offset
+                           ? COLOR_PAIR_CURSOR_LINE
+                           : COLOR_PAIR_STATUS_BAR;
+        }
+      if (i >= highlight_end)
+        color_pair = COLOR_PAIR_TEXT;
+
+      unsigned char c = text[i];
+      attron (COLOR_PAIR (color_pair));
+      mvaddch (screen_row, VIEWER_TEXT_COL + (int)((i - first) % width),
+               c < 32 || c == 127 ? ' ' : c);
+      attroff (COLOR_PAIR (color_pair));
+    }
+
+  return rows;
+}
+
+static void
+draw_viewer (Viewer *viewer)
+{
+  int max_row, max_col;
+  getmaxyx (stdscr, max_row, max_col);
+  int visible_lines = max_row - 2;
+  int width = max_col - VIEWER_TEXT_COL;
+  if (visible_lines < 1 || width < 1)
+    return;
+
+  scroll_to_cursor (viewer, visible_lines, width);
+  clear ();
+
+  attron (COLOR_PAIR (COLOR_PAIR_NORMAL_MODE));
+  mvprintw (0, 0, " VIEW ");
+  attroff (COLOR_PAIR (COLOR_PAIR_NORMAL_MODE));
+  int indicator_col = 7;
+  if (viewer->line_wrap_enabled)
+    {
+      mvprintw (0, indicator_col, " [WRAP] ");
+      indicator_col += 8;
+    }
+  if (viewer->has_active_search)
+    {
+      mvprintw (0, indicator_col, " [SEARCH: %s] ", viewer->search_term);
+    }
+
+  int row = 1;
+  int cursor_row = 1;
+  for (size_t line = viewer->top_line; row <= visible_lines; line++)
+    {
+      size_t length;
+      const char *text = viewer_line (viewer, line, &length);
+      if (text == NULL)
+        break;
+
+      attron (COLOR_PAIR (COLOR_PAIR_LINE_NUMBERS));
+      mvprintw (row, 1, "%4zu", line + 1);
+      attroff (COLOR_PAIR (COLOR_PAIR_LINE_NUMBERS));
+      if (line == viewer->cursor_line)
+        {
+          cursor_row = row;
+          attron (COLOR_PAIR (COLOR_PAIR_CURSOR_LINE));
+          mvprintw (row, 5, "->");
+          attroff (COLOR_PAIR (COLOR_PAIR_CURSOR_LINE));
+        }
+
+      row += draw_view_line (viewer, row, visible_lines, width, text, length);
+    }
+
+  int status_row = max_row - 1;
+  char position[64];
+  if (viewer->complete)
+    snprintf (position, sizeof (position), "Line %zu of %zu",
+              viewer->cursor_line + 1, viewer->num_lines);
+  else
+    snprintf (position, sizeof (position), "Line %zu",
+              viewer->cursor_line + 1);
+  int position_length = strlen (position);
+
+  attron (COLOR_PAIR (COLOR_PAIR_STATUS_BAR));
+  mvhline (status_row, 0, ' ', max_col);
+  mvprintw (status_row, 1, "%s [RO]", viewer->filename);
+  mvprintw (status_row, max_col - position_length - 1, "%s", position);
+  attroff (COLOR_PAIR (COLOR_PAIR_STATUS_BAR));
+
+  int message_start = 20;
+  int message_width = max_col - message_start - position_length - 5;
+  if (message_width > 0 && (viewer->prompt || viewer->message[0]))
+    {
+      attron (COLOR_PAIR (COLOR_PAIR_COMMAND));
+      mvhline (status_row, message_start, ' ', message_width);
+      if (viewer->prompt)
+        mvprintw (status_row, message_start, "%c%.*s", viewer->prompt,
+                  message_width - 1, viewer->input);
+      else
+        mvprintw (status_row, message_start, "%.*s", message_width,
+                  viewer->message);
+      attroff (COLOR_PAIR (COLOR_PAIR_COMMAND));
+    }
+
+  if (viewer->prompt)
+    move (status_row, message_start + 1 + (int)strlen (viewer->input));
+  else
+    move (cursor_row, VIEWER_TEXT_COL);
+  refresh ();
+}
+
+static void
+set_viewer_message (Viewer *viewer, const char *message)
+{
+  snprintf (viewer->message, sizeof (viewer->message), "%s", message);
+}
+
+static void
+move_cursor (Viewer *viewer, long delta)
+{
+  size_t length;
+  if (delta < 0)
+    {
+      size_t up = (size_t)-delta;
+      viewer->cursor_line
+          = viewer->cursor_line > up ? viewer->cursor_line - up : 0;
+      return;
+    }
+
+  size_t target = viewer->cursor_line + (size_t)delta;
+  if (viewer_line (viewer, target, &length) == NULL)
+    target = viewer->num_lines - 1;
+  viewer->cursor_line = target;
+}
+
+// Jumps to the next match after the current one (or the cursor line when
+// there is none yet) in the given direction.
+static void
+jump_to_next_match (Viewer *viewer, int forward)
+{
+  size_t length;
+  const char *text = viewer_line (viewer, viewer->cursor_line, &length);
+  size_t line_start = text - viewer->data;
+  size_t from = line_start;
+  if (viewer->has_active_search && viewer->match_offset >= line_start
+      && viewer->match_offset <= line_start + length)
+    {
+      from = forward ? viewer->match_offset + 1 : viewer->match_offset;
+    }
+
+  size_t match;
+  if (!viewer_find (viewer, viewer->search_term, from, forward, &match))
+    {
+      char message[sizeof (viewer->message)];
+      snprintf (message, sizeof (message), "Pattern not found: %.200s",
+                viewer->search_term);
+      set_viewer_message (viewer, message);
+      return;
+    }
+
+  viewer->has_active_search = 1;
+  viewer->match_offset = match;
+  viewer->cursor_line = viewer_line_of_offset (viewer, match);
+  if (!viewer->line_wrap_enabled)
+    {
+      size_t column = match - (size_t)(viewer_line (viewer,
+                                                    viewer->cursor_line,
+                                                    &length)
+                                       - viewer->data);
+      int width = getmaxx (stdscr) - VIEWER_TEXT_COL;
+      if (column < viewer->left_col || column >= viewer->left_col + width)
+        viewer->left_col = column > (size_t)width / 2 ? column - width / 2
+                                                      : 0;
+    }
+}
+
+// Runs a ':' command. Returns nonzero when the viewer should quit.
+static int
+run_viewer_command (Viewer *viewer, const char *command)
+{
+  if (strcmp (command, "q") == 0 || strcmp (command, "q!") == 0)
+    return 1;
+
+  if (command[0] >= '0' && command[0] <= '9')
+    {
+      size_t line = strtoul (command, NULL, 10);
+      viewer->cursor_line = 0;
+      move_cursor (viewer, line > 0 ? (long)(line - 1) : 0);
+    }
+  else if (strcmp (command, "wrap") == 0)
+    viewer->line_wrap_enabled = 1;
+  else if (strcmp (command, "nowrap") == 0)
+    viewer->line_wrap_enabled = 0;
+  else if (strcmp (command, "nohl") == 0)
+    viewer->has_active_search = 0;
+  else if (strcmp (command, "set ic") == 0)
+    {
+      viewer->case_sensitive = 0;
+      set_viewer_message (viewer, "Search is now case insensitive");
+    }
+  else if (strcmp (command, "set noic") == 0)
+    {
+      viewer->case_sensitive = 1;
+      set_viewer_message (viewer, "Search is now case sensitive");
+    }
+  else if (command[0] == 'w')
+    set_viewer_message (viewer, "Read-only view: cannot save");
+  else
+    set_viewer_message (viewer, "Unknown command");
+  return 0;
+}
+
+// Handles one key typed at the ':', '/' or '?' prompt. Returns nonzero when
+// the viewer should quit.
+static int
+handle_prompt_key (Viewer *viewer, int ch)
+{
+  size_t length = strlen (viewer->input);
+
+  if (ch == 27)
+    {
+      viewer->prompt = 0;
+    }
+  else if (ch == KEY_BACKSPACE || ch == 127 || ch == 8)
+    {
+      if (length == 0)
+        viewer->prompt = 0;
+      else
+        viewer->input[length - 1] = '\0';
+    }
+  else if (ch == 10 || ch == KEY_ENTER)
+    {
+      char prompt = viewer->prompt;
+      viewer->prompt = 0;
+      if (prompt == ':')
+        return run_viewer_command (viewer, viewer->input);
+
+      if (length > 0)
+        {
+          strcpy (viewer->search_term, viewer->input);
+          viewer->has_active_search = 0;
+          jump_to_next_match (viewer, prompt == '/');
+        }
+    }
+  else if (ch >= 32 && ch < 127 && length + 1 < sizeof (viewer->input))
+    {
+      viewer->input[length] = ch;
+      viewer->input[length + 1] = '\0';
+    }
+  return 0;
+}
+
+// Handles one key in the view. Returns nonzero when the viewer should quit.
+static int
+handle_viewer_key (Viewer *viewer, int ch)
+{
+  int page = getmaxy (stdscr) - 2;
+  if (page < 1)
+    page = 1;
+
+  viewer->message[0] = '\0';
+  switch (ch)
+    {
+    case 'q':
+      return 1;
+    case 'j':
+    case KEY_DOWN:
+    case 10:
+      move_cursor (viewer, 1);
+      break;
+    case 'k':
+    case KEY_UP:
+      move_cursor (viewer, -1);
+      break;
+    case ' ':
+    case 6: // Ctrl+F
+    case KEY_NPAGE:
+      move_cursor (viewer, page);
+      viewer->top_line = viewer->cursor_line;
+      break;
+    case 2: // Ctrl+B
+    case KEY_PPAGE:
+      move_cursor (viewer, -page);
+      viewer->top_line = viewer->cursor_line;
+      break;
+    case 'g':
+    case KEY_HOME:
+      viewer->cursor_line = 0;
+      break;
+    case 'G':
+    case KEY_END:
+      viewer->cursor_line = viewer_count_lines (viewer) - 1;
+      break;
+    case 'h':
+    case KEY_LEFT:
+      viewer->left_col = viewer->left_col > VIEWER_SCROLL_COLUMNS
+                             ? viewer->left_col - VIEWER_SCROLL_COLUMNS
+                             : 0;
+      break;
+    case 'l':
+    case KEY_RIGHT:
+      if (!viewer->line_wrap_enabled)
+        viewer->left_col += VIEWER_SCROLL_COLUMNS;
+      break;
+    case 'w':
+      viewer->line_wrap_enabled = !viewer->line_wrap_enabled;
+      break;
+    case 'n':
+    case 'N':
+      if (viewer->search_term[0] == '\0')
+        set_viewer_message (viewer, "No active search");
+      else
+        jump_to_next_match (viewer, ch == 'n');
+      break;
+    case ':':
+    case '/':
+    case '?':
+      viewer->prompt = ch;
+      viewer->input[0] = '\0';
+      break;
+    case 'i':
+    case 'a':
+    case 'A':
+    case 'o':
+    case 'O':
+    case 'x':
+    case 'X':
+      set_viewer_message (viewer, "Read-only view");
+      break;
+    }
+  return 0;
+}
+
+// Shows `filename` read-only until the user quits. Curses must already be
+// set up. Returns 0, or -1 with errno set when the file cannot be mapped.
+int
+run_viewer (const char *filename)
+{
+  Viewer viewer;
+  if (viewer_open (&viewer, filename) != 0)
+    return -1;
+  startup_time_mark ("viewer_open");
+
+  for (;;)
+    {
+      draw_viewer (&viewer);
+      startup_time_finish ("first frame");
+      int ch = getch ();
+      int quit = viewer.prompt ? handle_prompt_key (&viewer, ch)
+                               : handle_viewer_key (&viewer, ch);
+      if (quit)
+        break;
+    }
+
+  viewer_close (&viewer);
+  return 0;
+}
@@ -0,0 +1,135 @@
+#include "buffer_iterator.h"
+#include "data_structures.h"
+#include "line_index.h"
+#include "test_framework.h"
+#include "text_editor_functions.h"
+#include <string.h>
+
+// Builds a buffer whose lines use every storage kind: a slice, a gap buffer
+// with the gap in the middle and a piece table with several pieces.
+static void
+build_mixed_buffer (TextBuffer *buffer, PieceStore *store)
+{
+  init_editor_buffer (buffer);
+
+  insert_line_at_end (buffer, create_new_line_slice ("slice", 5));
+
+  Line *edited = create_new_line ("gap buffer");
+  line_insert_string_at (edited, 3, "---");
+  insert_line_at_end (buffer, edited);
+
+  insert_line_at_end (buffer, create_new_line_empty ());
+
+  Line *pieces = create_new_line_from_store (store, 0, 6);
+  line_insert_string_at (pieces, 3, "+");
+  insert_line_at_end (buffer, pieces);
+}
+
+static size_t
+collect_forward (BufferIterator *it, char *out)
+{
+  const char *chunk;
+  size_t length;
+  size_t total = 0;
+
+  while ((length = buffer_iterator_next (it, &chunk)) > 0)
+    {
+      memcpy (out + total, chunk, length);
+      total += length;
+    }
+  out[total] = '\0';
+  return total;
+}
+
+static size_t
+collect_backward (BufferIterator *it, char *out, size_t size)
+{
+  const char *chunk;
+  size_t length;
+  size_t start = size;
+
+  while ((length = buffer_iterator_prev (it, &chunk)) > 0)
+    {
+      start -= length;
+      memcpy (out + start, chunk, length);
+    }
+  memmove (out, out + start, size - start);
+  out[size - start] = '\0';
+  return size - start;
+}
+
+void
+test_buffer_iterator_forward (void)
+{
+  char *original = malloc (6);
+  memcpy (original, "pieces", 6);
+  PieceStore *store = piece_store_create (original, 6);
+
+  TextBuffer buffer;
+  build_mixed_buffer (&buffer, store);
+
+  BufferIterator it;
+  char out[128];
+  buffer_iterator_init (&it, &buffer);
+  size_t total = collect_forward (&it, out);
+  ASSERT_STR_EQ ("slice\ngap--- buffer\n\npie+ces\n", out,
+                 "Iterator should yield every line and newline");
+  ASSERT_EQ (line_index_total_bytes (&buffer), total,
+             "Iterator should yield as many bytes as the index counts");
+  ASSERT_NULL (it.line, "Iterator should end past the last line");
+
+  buffer_iterator_seek (&it, 1, 4);
+  ASSERT_EQ (10, buffer_iterator_offset (&it),
+             "Seek should land on the requested line and column");
+  collect_forward (&it, out);
+  ASSERT_STR_EQ ("-- buffer\n\npie+ces\n", out,
+                 "Iterating after a seek should start there");
+
+  buffer_iterator_seek (&it, 0, 99);
+  collect_forward (&it, out);
+  ASSERT_STR_EQ ("\ngap--- buffer\n\npie+ces\n", out,
+                 "Seeking past the end of a line should clamp the column");
+
+  free_editor_buffer (&buffer);
+  piece_store_destroy (store);
+}
+
+void
+test_buffer_iterator_backward (void)
+{
+  char *original = malloc (6);
+  memcpy (original, "pieces", 6);
+  PieceStore *store = piece_store_create (original, 6);
+
+  TextBuffer buffer;
+  build_mixed_buffer (&buffer, store);
+
+  BufferIterator it;
+  char out[128];
+  buffer_iterator_init (&it, &buffer);
+  buffer_iterator_seek_end (&it);
+  collect_backward (&it, out, sizeof (out));
+  ASSERT_STR_EQ ("slice\ngap--- buffer\n\npie+ces\n", out,
+                 "Iterating backward should yield the same bytes");
+  ASSERT_TRUE (it.line == buffer.head && it.col == 0,
+               "Iterator should stop at the start of the buffer");
+
+  buffer_iterator_seek (&it, 3, 4);
+  collect_backward (&it, out, sizeof (out));
+  ASSERT_STR_EQ ("slice\ngap--- buffer\n\npie+", out,
+                 "Iterating backward from a seek should end at the start");
+
+  free_editor_buffer (&buffer);
+  piece_store_destroy (store);
+}
+
+void
+run_buffer_iterator_tests (void)
+{
+  TEST_SUITE_START ("Buffer Iterator Tests");
+
+  test_buffer_iterator_forward ();
+  test_buffer_iterator_backward ();
+
+  TEST_SUITE_END ("Buffer Iterator Tests");
+}
@@ -1,7 +1,10 @@
 #include "data_structures.h"
 #include "editor_state.h"
 #include "gap_buffer.h"
+#include "line_index.h"
 #include "test_framework.h"
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 void
@@ -18,8 +21,7 @@ test_line_creation (void)
                  "Line should contain correct content");
   free (content);
 
-  gap_buffer_destroy (line->gb);
-  free (line);
+  free_line (line);
 
   // Test creating empty line
   Line *empty_line = create_new_line_empty ();
@@ -28,8 +30,7 @@ test_line_creation (void)
   ASSERT_EQ (0, line_get_length (empty_line),
              "Empty line should have length 0");
 
-  gap_buffer_destroy (empty_line->gb);
-  free (empty_line);
+  free_line (empty_line);
 }
 
 void
@@ -82,8 +83,7 @@ test_line_operations (void)
                  "Character should be deleted with backspace");
   free (content);
 
-  gap_buffer_destroy (line->gb);
-  free (line);
+  free_line (line);
 }
 
 void
@@ -247,6 +247,142 @@ test_buffer_traversal_with_editor_state (void)
   free_editor_state (&state);
 }
 
+void
+test_cursor_position_tracking (void)
+{
+  TextBuffer buffer;
+  init_editor_buffer (&buffer);
+
+  Line *lines[4];
+  const char *contents[4] = { "one", "two", "three", "four" };
+  for (int i = 0; i < 4; i++)
+    {
+      lines[i] = create_new_line (contents[i]);
+      insert_line_at_end (&buffer, lines[i]);
+    }
+
+  buffer.current_line_node = lines[2];
+  buffer.current_col_offset = 1;
+  sync_cursor_position (&buffer);
+  ASSERT_EQ (2, get_cursor_line_number (&buffer),
+             "Cursor should be on line 2");
+  ASSERT_EQ (9, get_cursor_byte_offset (&buffer),
+             "Cursor byte offset should count previous lines and column");
+
+  buffer.current_line_node = lines[1];
+  sync_cursor_position (&buffer);
+  ASSERT_EQ (1, buffer.cursor_line_number,
+             "Moving up should decrement the cached line number");
+  ASSERT_EQ (5, get_cursor_byte_offset (&buffer),
+             "Moving up should update the cached byte offset");
+
+  Line *above = create_new_line ("zero");
+  insert_line_at_beginning (&buffer, above);
+  ASSERT_EQ (2, buffer.cursor_line_number,
+             "Inserting above the cursor should shift it down");
+  ASSERT_EQ (10, get_cursor_byte_offset (&buffer),
+             "Inserting above the cursor should shift its byte offset");
+
+  insert_line_after (&buffer, lines[3], create_new_line ("five"));
+  ASSERT_EQ (2, buffer.cursor_line_number,
+             "Inserting below the cursor should not move it");
+
+  remove_line (&buffer, lines[0]);
+  free_line (lines[0]);
+  ASSERT_EQ (1, buffer.cursor_line_number,
+             "Removing a line above the cursor should shift it up");
+  ASSERT_EQ (6, get_cursor_byte_offset (&buffer),
+             "Removing a line above the cursor should shift its offset");
+
+  buffer.current_line_node = buffer.tail;
+  sync_cursor_position (&buffer);
+  ASSERT_EQ (4, get_cursor_line_number (&buffer),
+             "Jumping to the tail should look the position up");
+
+  free_editor_buffer (&buffer);
+}
+
+// Joins the buffer into one string with '\n' between lines.
+static char *
+buffer_contents (const TextBuffer *buffer)
+{
+  static char contents[256];
+  size_t used = 0;
+
+  contents[0] = '\0';
+  for (Line *line = buffer->head; line != NULL; line = line->next)
+    {
+      char *text = line_to_string (line);
+      used += snprintf (contents + used, sizeof (contents) - used, "%s%s",
+                        text, line->next ? "\n" : "");
+      free (text);
+    }
+  return contents;
+}
+
+void
+test_buffer_replace_range (void)
+{
+  TextBuffer buffer;
+  init_editor_buffer (&buffer);
+
+  const char *contents[5] = { "alpha", "beta", "gamma", "delta", "omega" };
+  Line *lines[5];
+  for (int i = 0; i < 5; i++)
+    {
+      lines[i] = create_new_line (contents[i]);
+      insert_line_at_end (&buffer, lines[i]);
+    }
+
+  size_t col;
+  Line *end = buffer_replace_range (&buffer, lines[0], 2, lines[0], 4, "XYZ",
+                                    3, &col);
+  ASSERT_STR_EQ ("alXYZa\nbeta\ngamma\ndelta\nomega",
+                 buffer_contents (&buffer),
+                 "Replacing within a line should not touch other lines");
+  ASSERT_TRUE (end == lines[0] && col == 5,
+               "End of the new text should be reported");
+
+  end = buffer_replace_range (&buffer, lines[1], 2, lines[3], 1, "-", 1,
+                              &col);
+  ASSERT_STR_EQ ("alXYZa\nbe-elta\nomega", buffer_contents (&buffer),
+                 "Replacing across lines should join the ends");
+  ASSERT_EQ (3, buffer.num_lines, "Lines in the range should be removed");
+  ASSERT_TRUE (end == lines[1] && col == 3,
+               "Joined text should end on the first line");
+
+  end = buffer_replace_range (&buffer, lines[1], 2, lines[1], 3,
+                              "1\n2\n3", 5, &col);
+  ASSERT_STR_EQ ("alXYZa\nbe1\n2\n3elta\nomega", buffer_contents (&buffer),
+                 "Inserting newlines should split the line");
+  ASSERT_EQ (5, buffer.num_lines, "New lines should be counted");
+  ASSERT_TRUE (end == lines[1]->next->next && col == 1,
+               "End should be on the last new line");
+  ASSERT_TRUE (buffer.tail == lines[4], "Tail should not change");
+
+  buffer.current_line_node = lines[4];
+  buffer.current_col_offset = 2;
+  end = buffer_replace_range (&buffer, lines[0], 5, lines[4], 1, "\nx\n",
+                              3, &col);
+  ASSERT_STR_EQ ("alXYZ\nx\nmega", buffer_contents (&buffer),
+                 "Multi-line text should replace a multi-line range");
+  ASSERT_TRUE (end == lines[4] && col == 0,
+               "Last line of the range should be reused");
+  ASSERT_EQ (2, get_cursor_line_number (&buffer),
+             "Cursor position should be resynced after the edit");
+  ASSERT_EQ (line_index_total_bytes (&buffer), strlen ("alXYZ\nx\nmega\n"),
+             "Line index should match the edited buffer");
+
+  end = buffer_replace_range (&buffer, lines[0], 0, buffer.tail, 4, NULL, 0,
+                              &col);
+  ASSERT_EQ (1, buffer.num_lines, "Deleting everything should leave one line");
+  ASSERT_STR_EQ ("", buffer_contents (&buffer), "The line should be empty");
+  ASSERT_TRUE (buffer.head == buffer.tail && end == buffer.head,
+               "Head and tail should be the remaining line");
+
+  free_editor_buffer (&buffer);
+}
+
 void
 test_temp_message_functionality (void)
 {
@@ -307,8 +443,7 @@ test_line_edge_cases (void)
   ASSERT_STR_EQ ("test", content, "Line content should remain unchanged");
   free (content);
 
-  gap_buffer_destroy (line->gb);
-  free (line);
+  free_line (line);
 }
 
 void
@@ -344,6 +479,8 @@ run_data_structures_tests (void)
   test_editor_state_with_filename ();
   test_line_insertion_with_editor_state ();
   test_buffer_traversal_with_editor_state ();
+  test_cursor_position_tracking ();
+  test_buffer_replace_range ();
   test_temp_message_functionality ();
   test_line_edge_cases ();
   test_editor_state_edge_cases ();
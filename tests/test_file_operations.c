@@ -1,10 +1,19 @@
+#define _XOPEN_SOURCE 700
+
+#include "background_save.h"
 #include "data_structures.h"
 #include "editor_state.h"
+#include "file_loader.h"
+#include "line_index.h"
 #include "test_framework.h"
 #include "text_editor_functions.h"
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 // A global filename for testing
 const char *TEST_FILENAME = "test_file.txt";
@@ -273,6 +282,524 @@ test_file_operations_with_line_wrap_settings (void)
   TEST_CASE_END ();
 }
 
+void
+test_load_lines_copy_on_write (void)
+{
+  TEST_CASE_START ("Loaded lines share the file contents until edited");
+
+  FILE *file = fopen (TEST_FILENAME, "w");
+  fputs ("first\nsecond\nthird", file);
+  fclose (file);
+
+  TextBuffer buffer;
+  init_editor_buffer (&buffer);
+  loadFromFile (TEST_FILENAME, &buffer);
+
+  ASSERT_EQ (3, buffer.num_lines, "Loaded buffer should have 3 lines");
+  Line *second = buffer.head->next;
+  ASSERT_NULL (second->gb, "Unedited line should not own a gap buffer");
+  ASSERT_TRUE (second->text >= buffer.store->original
+                   && second->text < buffer.store->original
+                                         + buffer.store->original_length,
+               "Unedited line should point into the file contents");
+  ASSERT_EQ (6, line_get_length (second), "Slice length should be 6");
+  ASSERT_EQ ('c', line_get_char_at (second, 2), "Slice char should be 'c'");
+
+  line_insert_char_at (second, 6, '!');
+  ASSERT_NOT_NULL (second->gb, "Edited line should own a gap buffer");
+  ASSERT_NULL (buffer.head->gb, "Other lines should stay slices");
+
+  char *content = line_to_string (second);
+  ASSERT_STR_EQ ("second!", content, "Edit should apply to the copy");
+  free (content);
+  content = line_to_string (buffer.tail);
+  ASSERT_STR_EQ ("third", content, "Last line without newline is kept");
+  free (content);
+
+  const char *text;
+  size_t length = line_span_at (buffer.tail, 0, &text);
+  ASSERT_TRUE (text == buffer.store->original + 13 && length == 5,
+               "Reading a slice should not copy it");
+
+  line_truncate (buffer.head, 2);
+  ASSERT_NULL (buffer.head->gb, "Truncating a slice should not copy it");
+  content = line_to_string (buffer.head);
+  ASSERT_STR_EQ ("fi", content, "Truncated slice should be shortened");
+  free (content);
+
+  free_editor_buffer (&buffer);
+  remove (TEST_FILENAME);
+  TEST_CASE_END ();
+}
+
+void
+test_lazy_load_mapped_file (void)
+{
+  TEST_CASE_START ("Mapped files are split into lines on demand");
+
+  FILE *file = fopen (TEST_FILENAME, "w");
+  for (int i = 0; i < 100; i++)
+    {
+      fprintf (file, "line %d\n", i);
+    }
+  fclose (file);
+
+  TextBuffer buffer;
+  init_editor_buffer (&buffer);
+  buffer.lazy_load = 1;
+  loadFromFile (TEST_FILENAME, &buffer);
+
+  ASSERT_TRUE (buffer.store != NULL && buffer.store->mapped,
+               "Lazy load should map the file");
+  ASSERT_EQ (1, buffer.num_lines, "Only the first line should be scanned");
+  ASSERT_FALSE (buffer_is_loaded (&buffer), "Buffer should not be loaded");
+
+  buffer_ensure_lines (&buffer, 10);
+  ASSERT_EQ (10, buffer.num_lines, "Ensuring lines should scan more");
+  Line *next = buffer_next_line (&buffer, buffer.tail);
+  ASSERT_NOT_NULL (next, "Stepping past the tail should scan a line");
+  ASSERT_EQ (11, buffer.num_lines, "Stepping should scan one line");
+  ASSERT_EQ (10, line_index_position (next), "Scanned line should be indexed");
+
+  line_insert_string_at (buffer.head, 0, "first ");
+  ASSERT_NOT_NULL (buffer.head->gb, "Edited mapped line should be copied");
+
+  buffer_load_all (&buffer);
+  ASSERT_TRUE (buffer_is_loaded (&buffer), "Buffer should be fully loaded");
+  ASSERT_EQ (100, buffer.num_lines, "All lines should be scanned");
+  char *content = line_to_string (line_index_find (&buffer, 99));
+  ASSERT_STR_EQ ("line 99", content, "Last line should be found by number");
+  free (content);
+
+  saveToFile (TEST_FILENAME, &buffer);
+  free_editor_buffer (&buffer);
+
+  init_editor_buffer (&buffer);
+  loadFromFile (TEST_FILENAME, &buffer);
+  ASSERT_EQ (100, buffer.num_lines, "Saved file should keep every line");
+  content = line_to_string (buffer.head);
+  ASSERT_STR_EQ ("first line 0", content, "Saved file should keep the edit");
+  free (content);
+  content = line_to_string (buffer.tail);
+  ASSERT_STR_EQ ("line 99", content, "Saved file should keep unedited lines");
+  free (content);
+
+  free_editor_buffer (&buffer);
+  remove (TEST_FILENAME);
+  TEST_CASE_END ();
+}
+
+void
+test_async_load_streams_lines (void)
+{
+  TEST_CASE_START ("Large files are read in the background");
+
+  const size_t num_lines = 200000;
+  FILE *file = fopen (TEST_FILENAME, "w");
+  for (size_t i = 0; i < num_lines; i++)
+    {
+      fprintf (file, "line %zu\n", i);
+    }
+  fclose (file);
+
+  TextBuffer buffer;
+  init_editor_buffer (&buffer);
+  buffer.async_load = 1;
+  loadFromFile (TEST_FILENAME, &buffer);
+
+  ASSERT_TRUE (buffer.num_lines > 0, "First chunk should be split at once");
+  char *content = line_to_string (buffer.head);
+  ASSERT_STR_EQ ("line 0", content, "First line should be loaded");
+  free (content);
+
+  int polls = 0;
+  while (buffer_poll_load (&buffer, 1000))
+    {
+      polls++;
+    }
+  ASSERT_TRUE (polls > 0, "Remaining lines should arrive over several polls");
+  ASSERT_EQ (-1, buffer_load_progress (&buffer), "Load should be finished");
+  ASSERT_EQ (num_lines, buffer.num_lines, "Every line should be loaded");
+  content = line_to_string (line_index_find (&buffer, num_lines - 1));
+  ASSERT_STR_EQ ("line 199999", content, "Streamed lines should be indexed");
+  free (content);
+  free_editor_buffer (&buffer);
+
+  init_editor_buffer (&buffer);
+  buffer.async_load = 1;
+  buffer.lazy_load = 1;
+  loadFromFile (TEST_FILENAME, &buffer);
+  ASSERT_TRUE (buffer.store->mapped, "Lazy load should map the file");
+  ASSERT_NULL (buffer.loader, "A mapped file should not be read ahead");
+  ASSERT_EQ (-1, buffer_load_progress (&buffer),
+             "A mapped file should not show as loading");
+  ASSERT_EQ (0, buffer_poll_load (&buffer, 1000),
+             "A mapped file should leave the idle loop alone");
+  buffer_load_all (&buffer);
+  ASSERT_EQ (num_lines, buffer.num_lines,
+             "Loading everything should split the mapping");
+  free_editor_buffer (&buffer);
+
+  remove (TEST_FILENAME);
+  TEST_CASE_END ();
+}
+
+void
+test_async_load_keeps_read_error (void)
+{
+  TEST_CASE_START ("A background read that fails says why");
+
+  // A directory opens but fails to read
+  int fd = open ("tests", O_RDONLY);
+  size_t size = 2 * FILE_LOADER_CHUNK;
+  char *contents = malloc (size);
+  FileLoader *loader = file_loader_start (fd, contents, size);
+  ASSERT_NOT_NULL (loader, "Loader should start");
+  file_loader_wait (loader);
+  ASSERT_TRUE (file_loader_done (loader), "Load should stop at the error");
+  ASSERT_EQ (EISDIR, file_loader_error (loader),
+             "The read error should be kept");
+  ASSERT_EQ (0, file_loader_available (loader), "Nothing should be read");
+
+  file_loader_destroy (loader);
+  free (contents);
+  close (fd);
+  TEST_CASE_END ();
+}
+
+void
+test_parallel_load_matches_serial (void)
+{
+  TEST_CASE_START ("Splitting a file on several threads keeps every line");
+
+  // Short, empty and very long lines, and no newline at the end
+  FILE *file = fopen (TEST_FILENAME, "w");
+  for (size_t i = 0; i < 120000; i++)
+    {
+      if (i % 1000 == 0)
+        fprintf (file, "\n");
+      else if (i == 50000)
+        fprintf (file, "%0*d\n", 2 * PARALLEL_LOAD_MIN_BYTES, 7);
+      else
+        fprintf (file, "line %zu of a parallel load\n", i);
+    }
+  fprintf (file, "last");
+  fclose (file);
+
+  StorageMode modes[] = { STORAGE_GAP_BUFFER, STORAGE_PIECE_TABLE };
+  for (int m = 0; m < 2; m++)
+    {
+      TextBuffer serial;
+      init_editor_buffer (&serial);
+      serial.storage_mode = modes[m];
+      serial.load_threads = 1;
+      loadFromFile (TEST_FILENAME, &serial);
+
+      TextBuffer parallel;
+      init_editor_buffer (&parallel);
+      parallel.storage_mode = modes[m];
+      parallel.load_threads = 4;
+      loadFromFile (TEST_FILENAME, &parallel);
+
+      ASSERT_EQ (serial.num_lines, parallel.num_lines,
+                 "Both loads should find the same number of lines");
+
+      int same = 1;
+      Line *a = serial.head;
+      Line *b = parallel.head;
+      for (; a != NULL && b != NULL && same; a = a->next, b = b->next)
+        {
+          char *left = line_to_string (a);
+          char *right = line_to_string (b);
+          same = strcmp (left, right) == 0
+                 && (a->pt == NULL) == (b->pt == NULL);
+          free (left);
+          free (right);
+        }
+      ASSERT_TRUE (same && a == NULL && b == NULL,
+                   "Lines should match in content, storage and order");
+
+      Line *last = line_index_find (&parallel, parallel.num_lines - 1);
+      ASSERT_TRUE (last == parallel.tail, "Runs should be indexed in order");
+      ASSERT_TRUE (parallel.tail->prev->next == parallel.tail,
+                   "Runs should be linked both ways");
+
+      // Lines from the threads' pools are edited and freed like any other
+      line_insert_string_at (last, 4, "!");
+      char *content = line_to_string (last);
+      ASSERT_STR_EQ ("last!", content, "Last line should be editable");
+      free (content);
+
+      free_editor_buffer (&serial);
+      free_editor_buffer (&parallel);
+    }
+
+  remove (TEST_FILENAME);
+  TEST_CASE_END ();
+}
+
+// Reads a whole file into a string the caller frees.
+static char *
+read_whole_file (const char *filename)
+{
+  FILE *file = fopen (filename, "r");
+  if (!file)
+    return NULL;
+  fseek (file, 0, SEEK_END);
+  long size = ftell (file);
+  rewind (file);
+  char *content = malloc (size + 1);
+  content[fread (content, 1, size, file)] = '\0';
+  fclose (file);
+  return content;
+}
+
+void
+test_background_save_writes_snapshot (void)
+{
+  TEST_CASE_START ("Background saves write the buffer as it was at :w");
+
+  // Over BACKGROUND_SAVE_MIN_BYTES, with the end of the file never split
+  // into lines
+  const size_t num_lines = 100000;
+  FILE *file = fopen (TEST_FILENAME, "w");
+  for (size_t i = 0; i < num_lines; i++)
+    {
+      fprintf (file, "line %06zu\n", i);
+    }
+  fclose (file);
+
+  TextBuffer buffer;
+  init_editor_buffer (&buffer);
+  buffer.lazy_load = 1;
+  loadFromFile (TEST_FILENAME, &buffer);
+  buffer_ensure_lines (&buffer, 10);
+  char *original = read_whole_file (TEST_FILENAME);
+  char *expected = malloc (strlen (original) + 3);
+  strcpy (expected, "! ");
+  strcat (expected, original);
+  free (original);
+
+  // Not the same length, so the file cannot be patched in place
+  line_insert_string_at (buffer.head, 0, "! ");
+  int status = -1;
+  BackgroundSave *save = background_save_start (TEST_FILENAME, &buffer,
+                                                &status);
+  ASSERT_NOT_NULL (save, "A large save should run in the background");
+  ASSERT_EQ (0, status, "Starting the save should succeed");
+  ASSERT_EQ (12 * num_lines + 2, save->total,
+             "The snapshot should cover the whole file");
+  ASSERT_TRUE (save->num_spans <= 3,
+               "Unedited text should be written from where it lies");
+
+  // Edits made while the save runs are not part of it
+  line_insert_string_at (buffer.head, 0, "later ");
+  insert_line_at_end (&buffer, create_new_line ("appended"));
+
+  ASSERT_EQ (0, background_save_finish (save, &buffer),
+             "The save should succeed");
+  ASSERT_TRUE (background_save_done (save), "The save should be done");
+  ASSERT_EQ (100, background_save_progress (save),
+             "Every byte should have been written");
+  background_save_free (save);
+
+  char *content = read_whole_file (TEST_FILENAME);
+  ASSERT_TRUE (content && strcmp (expected, content) == 0,
+               "The file should hold the buffer as it was when saved");
+  free (content);
+
+  ASSERT_EQ (0, saveToFile (TEST_FILENAME, &buffer),
+             "Saving the later edits should succeed");
+  content = read_whole_file (TEST_FILENAME);
+  ASSERT_TRUE (content && strncmp (content, "later ! line 000000\n", 20) == 0,
+               "Edits made during the save should be saved next time");
+  free (content);
+  free (expected);
+  free_editor_buffer (&buffer);
+
+  // A small buffer is saved on the spot
+  init_editor_buffer (&buffer);
+  insert_line_at_end (&buffer, create_new_line ("small"));
+  status = -1;
+  ASSERT_NULL (background_save_start (TEST_FILENAME, &buffer, &status),
+               "A small save should not need a thread");
+  ASSERT_EQ (0, status, "The small save should succeed");
+  content = read_whole_file (TEST_FILENAME);
+  ASSERT_STR_EQ ("small\n", content, "The small save should be written");
+  free (content);
+  free_editor_buffer (&buffer);
+
+  remove (TEST_FILENAME);
+  TEST_CASE_END ();
+}
+
+void
+test_save_replaces_file_atomically (void)
+{
+  TEST_CASE_START ("Saving replaces the file through a synced temp file");
+
+  const char *link_name = "test_file_link.txt";
+  FILE *file = fopen (TEST_FILENAME, "w");
+  fputs ("old\n", file);
+  fclose (file);
+  chmod (TEST_FILENAME, 0640);
+  symlink (TEST_FILENAME, link_name);
+
+  TextBuffer buffer;
+  init_editor_buffer (&buffer);
+  insert_line_at_end (&buffer, create_new_line ("new"));
+  insert_line_at_end (&buffer, create_new_line ("text"));
+
+  ASSERT_EQ (0, saveToFile (link_name, &buffer), "Save should succeed");
+
+  struct stat st;
+  ASSERT_TRUE (lstat (link_name, &st) == 0 && S_ISLNK (st.st_mode),
+               "Saving through a symlink should keep the link");
+  ASSERT_TRUE (stat (TEST_FILENAME, &st) == 0 && (st.st_mode & 0777) == 0640,
+               "Saved file should keep its permissions");
+
+  char content[32] = "";
+  file = fopen (TEST_FILENAME, "r");
+  size_t length = fread (content, 1, sizeof (content) - 1, file);
+  content[length] = '\0';
+  fclose (file);
+  ASSERT_STR_EQ ("new\ntext\n", content, "Target should hold the new text");
+
+  ASSERT_EQ (-1, saveToFile ("no_such_directory/file.txt", &buffer),
+             "Saving into a missing directory should fail");
+
+  free_editor_buffer (&buffer);
+  remove (link_name);
+  remove (TEST_FILENAME);
+  TEST_CASE_END ();
+}
+
+static ino_t
+file_inode (const char *filename)
+{
+  struct stat st;
+  return stat (filename, &st) == 0 ? st.st_ino : 0;
+}
+
+void
+test_save_patches_same_length_edits (void)
+{
+  TEST_CASE_START ("Same-length edits are written in place");
+
+  FILE *file = fopen (TEST_FILENAME, "w");
+  for (int i = 0; i < 100; i++)
+    {
+      fprintf (file, "line %02d\n", i);
+    }
+  fclose (file);
+
+  TextBuffer buffer;
+  init_editor_buffer (&buffer);
+  buffer.lazy_load = 1;
+  loadFromFile (TEST_FILENAME, &buffer);
+  buffer_ensure_lines (&buffer, 10);
+  ino_t inode = file_inode (TEST_FILENAME);
+
+  ASSERT_EQ (0, saveToFile (TEST_FILENAME, &buffer),
+             "Saving an unchanged buffer should succeed");
+  ASSERT_EQ (inode, file_inode (TEST_FILENAME),
+             "Saving an unchanged buffer should not rewrite the file");
+
+  Line *line = line_index_find (&buffer, 7);
+  line_replace_bytes (line, 5, 2, "XY", 2);
+  ASSERT_TRUE (line->flags & LINE_DIRTY, "Edited line should be dirty");
+  ASSERT_EQ (0, saveToFile (TEST_FILENAME, &buffer), "Patch should succeed");
+  ASSERT_EQ (inode, file_inode (TEST_FILENAME),
+             "Same-length edit should be patched into the same file");
+  ASSERT_EQ (10, buffer.num_lines,
+             "Patching should not split the rest of the file");
+  ASSERT_FALSE (line->flags & LINE_DIRTY, "Saved line should be clean");
+
+  char content[16] = "";
+  file = fopen (TEST_FILENAME, "r");
+  fseek (file, 8 * 7, SEEK_SET);
+  size_t length = fread (content, 1, 8, file);
+  content[length] = '\0';
+  fclose (file);
+  ASSERT_STR_EQ ("line XY\n", content, "Patched bytes should be on disk");
+
+  line_insert_char_at (line, 0, '>');
+  ASSERT_EQ (0, saveToFile (TEST_FILENAME, &buffer), "Full save should work");
+  ASSERT_TRUE (inode != file_inode (TEST_FILENAME),
+               "A longer line should replace the file");
+  ASSERT_EQ (100, buffer.num_lines, "Full save should load every line");
+
+  inode = file_inode (TEST_FILENAME);
+  line_replace_bytes (line_index_find (&buffer, 99), 0, 1, "L", 1);
+  ASSERT_EQ (0, saveToFile (TEST_FILENAME, &buffer), "Patch should succeed");
+  ASSERT_EQ (inode, file_inode (TEST_FILENAME),
+             "Edits after a full save should be patched too");
+  free_editor_buffer (&buffer);
+
+  init_editor_buffer (&buffer);
+  loadFromFile (TEST_FILENAME, &buffer);
+  char *text = line_to_string (line_index_find (&buffer, 7));
+  ASSERT_STR_EQ (">line XY", text, "Reloaded line should have both edits");
+  free (text);
+  text = line_to_string (buffer.tail);
+  ASSERT_STR_EQ ("Line 99", text, "Reloaded last line should be patched");
+  free (text);
+
+  insert_line_at_end (&buffer, create_new_line ("new"));
+  remove_line (&buffer, buffer.tail->prev);
+  ASSERT_EQ (0, saveToFile (TEST_FILENAME, &buffer), "Save should succeed");
+  ASSERT_TRUE (inode != file_inode (TEST_FILENAME),
+               "Added or removed lines should replace the file");
+  free_editor_buffer (&buffer);
+
+  remove (TEST_FILENAME);
+  TEST_CASE_END ();
+}
+
+void
+test_partial_load_is_not_saved_over (void)
+{
+  TEST_CASE_START ("A file that was not read whole is not saved over");
+
+  // A directory opens but fails to read
+  TextBuffer buffer;
+  init_editor_buffer (&buffer);
+  loadFromFile ("tests", &buffer);
+  ASSERT_TRUE (buffer.load_error != 0, "The read error should be kept");
+  ASSERT_EQ (1, buffer.num_lines, "The buffer should still have a line");
+  free_editor_buffer (&buffer);
+
+  FILE *file = fopen (TEST_FILENAME, "w");
+  fputs ("first\nsecond\n", file);
+  fclose (file);
+
+  // As if the read had stopped after the first line
+  init_editor_buffer (&buffer);
+  loadFromFile (TEST_FILENAME, &buffer);
+  remove_line (&buffer, buffer.tail);
+  buffer.load_error = EIO;
+  buffer.partial = buffer.disk;
+
+  line_insert_string_at (buffer.head, 0, "the ");
+  ASSERT_EQ (-1, saveToFile (TEST_FILENAME, &buffer),
+             "Saving over the file should be refused");
+  ASSERT_EQ (EIO, errno, "The reason should be the read error");
+  char *content = read_whole_file (TEST_FILENAME);
+  ASSERT_STR_EQ ("first\nsecond\n", content, "The file should be whole");
+  free (content);
+
+  const char *other = "test_file_partial.txt";
+  ASSERT_EQ (0, saveToFile (other, &buffer),
+             "Saving as another file should work");
+  ASSERT_EQ (-1, saveToFile (TEST_FILENAME, &buffer),
+             "The file should stay protected after a save as");
+
+  free_editor_buffer (&buffer);
+  remove (other);
+  remove (TEST_FILENAME);
+  TEST_CASE_END ();
+}
+
 void
 run_file_operations_tests (void)
 {
@@ -284,6 +811,15 @@ run_file_operations_tests (void)
   test_save_to_new_file_with_editor_state ();
   test_save_with_multiple_modes ();
   test_file_operations_with_line_wrap_settings ();
+  test_load_lines_copy_on_write ();
+  test_lazy_load_mapped_file ();
+  test_async_load_streams_lines ();
+  test_async_load_keeps_read_error ();
+  test_parallel_load_matches_serial ();
+  test_background_save_writes_snapshot ();
+  test_save_replaces_file_atomically ();
+  test_save_patches_same_length_edits ();
+  test_partial_load_is_not_saved_over ();
 
   TEST_SUITE_END ("File Operations Tests with EditorState");
 }
@@ -0,0 +1,192 @@
+#include "data_structures.h"
+#include "follow.h"
+#include "line_index.h"
+#include "test_framework.h"
+#include "text_editor_functions.h"
+#include <errno.h>
+
+#define TEST_FOLLOW_FILENAME "test_follow.log"
+
+static void
+append_to_file (const char *text)
+{
+  FILE *file = fopen (TEST_FOLLOW_FILENAME, "a");
+  fputs (text, file);
+  fclose (file);
+}
+
+static void
+assert_line (TextBuffer *buffer, size_t line, const char *expected,
+             const char *message)
+{
+  char *content = line_to_string (line_index_find (buffer, line));
+  ASSERT_STR_EQ (expected, content, message);
+  free (content);
+}
+
+void
+test_follower_appends_lines (void)
+{
+  TEST_CASE_START ("Follower appends what is written to the file");
+
+  remove (TEST_FOLLOW_FILENAME);
+  append_to_file ("first\nsecond");
+
+  TextBuffer buffer;
+  init_editor_buffer (&buffer);
+  loadFromFile (TEST_FOLLOW_FILENAME, &buffer);
+  FileFollower *follower = follower_start (TEST_FOLLOW_FILENAME, &buffer);
+  ASSERT_NOT_NULL (follower, "Follower should start on a loaded file");
+
+  size_t appended;
+  ASSERT_EQ (FOLLOW_OK, follower_poll (follower, &buffer, &appended),
+             "Polling a quiet file should succeed");
+  ASSERT_EQ (0, appended, "Nothing should be appended before a write");
+
+  append_to_file (" half\nthird\nfou");
+  ASSERT_EQ (FOLLOW_OK, follower_poll (follower, &buffer, &appended),
+             "Polling after a write should succeed");
+  ASSERT_EQ (15, appended, "Only the new bytes should be read");
+  ASSERT_EQ (4, buffer.num_lines, "Each new line should be appended");
+  assert_line (&buffer, 1, "second half",
+               "Text up to the first newline should finish the last line");
+  assert_line (&buffer, 2, "third", "Whole lines should be appended");
+  assert_line (&buffer, 3, "fou", "A line being written should show");
+  ASSERT_FALSE (buffer.lines_changed,
+                "Lines read from the file should not be edits");
+  ASSERT_FALSE (line_index_find (&buffer, 1)->flags & LINE_DIRTY,
+                "Finishing the last line should not be an edit");
+  ASSERT_EQ (27, buffer.disk.size, "The file should be known to be longer");
+
+  append_to_file ("rth\n\n");
+  follower_poll (follower, &buffer, &appended);
+  ASSERT_EQ (5, buffer.num_lines, "Empty lines should be appended");
+  assert_line (&buffer, 3, "fourth", "The open line should be finished");
+  assert_line (&buffer, 4, "", "The empty line should be the last");
+  ASSERT_TRUE (line_index_find (&buffer, 4) == buffer.tail,
+               "The line index should cover appended lines");
+
+  FILE *file = fopen (TEST_FOLLOW_FILENAME, "w");
+  fclose (file);
+  ASSERT_EQ (FOLLOW_TRUNCATED, follower_poll (follower, &buffer, &appended),
+             "A truncated file should stop the follower");
+
+  follower_stop (follower);
+  free_editor_buffer (&buffer);
+  remove (TEST_FOLLOW_FILENAME);
+}
+
+void
+test_follower_catches_up_in_chunks (void)
+{
+  TEST_CASE_START ("Follower reads a large burst a chunk at a time");
+
+  remove (TEST_FOLLOW_FILENAME);
+  append_to_file ("");
+
+  TextBuffer buffer;
+  init_editor_buffer (&buffer);
+  loadFromFile (TEST_FOLLOW_FILENAME, &buffer);
+  FileFollower *follower = follower_start (TEST_FOLLOW_FILENAME, &buffer);
+
+  // 64-byte lines, a little over two chunks
+  FILE *file = fopen (TEST_FOLLOW_FILENAME, "a");
+  size_t lines = 2 * FOLLOW_CHUNK / 64 + 10;
+  for (size_t i = 0; i < lines; i++)
+    {
+      fprintf (file, "%063zu\n", i);
+    }
+  fclose (file);
+
+  size_t appended;
+  size_t polls = 0;
+  do
+    {
+      ASSERT_EQ (FOLLOW_OK, follower_poll (follower, &buffer, &appended),
+                 "Each chunk should be read");
+      ASSERT_TRUE (appended <= FOLLOW_CHUNK, "No poll should read more");
+      polls++;
+    }
+  while (follower->pending);
+
+  ASSERT_EQ (3, polls, "The burst should take three polls");
+  ASSERT_EQ (lines, buffer.num_lines,
+             "The empty file's line should take the first line");
+  char expected[64];
+  snprintf (expected, sizeof (expected), "%063zu", lines - 1);
+  assert_line (&buffer, lines - 1, expected, "Last line should be whole");
+
+  follower_stop (follower);
+  free_editor_buffer (&buffer);
+
+  // A file replaced since it was loaded is not followed
+  init_editor_buffer (&buffer);
+  loadFromFile (TEST_FOLLOW_FILENAME, &buffer);
+  file = fopen (TEST_FOLLOW_FILENAME ".new", "w");
+  fclose (file);
+  rename (TEST_FOLLOW_FILENAME ".new", TEST_FOLLOW_FILENAME);
+  errno = 0;
+  ASSERT_NULL (follower_start (TEST_FOLLOW_FILENAME, &buffer),
+               "A replaced file should not be followed");
+  ASSERT_EQ (ESTALE, errno, "The reason should be that it changed");
+  free_editor_buffer (&buffer);
+
+  remove (TEST_FOLLOW_FILENAME);
+}
+
+void
+test_follower_waits_for_lazy_scan (void)
+{
+  TEST_CASE_START ("Follower leaves a lazily loaded file unscanned");
+
+  remove (TEST_FOLLOW_FILENAME);
+  FILE *file = fopen (TEST_FOLLOW_FILENAME, "w");
+  for (int i = 0; i < 1000; i++)
+    {
+      fprintf (file, "line %d\n", i);
+    }
+  fclose (file);
+
+  TextBuffer buffer;
+  init_editor_buffer (&buffer);
+  buffer.lazy_load = 1;
+  loadFromFile (TEST_FOLLOW_FILENAME, &buffer);
+  buffer_ensure_lines (&buffer, 10);
+  size_t scanned = buffer.num_lines;
+
+  FileFollower *follower = follower_start (TEST_FOLLOW_FILENAME, &buffer);
+  ASSERT_NOT_NULL (follower, "Follower should start on a lazy file");
+  ASSERT_EQ (scanned, buffer.num_lines, "Starting should not scan the file");
+
+  append_to_file ("new line\n");
+  size_t appended;
+  ASSERT_EQ (FOLLOW_OK, follower_poll (follower, &buffer, &appended),
+             "Polling a partly scanned file should succeed");
+  ASSERT_EQ (0, appended, "New text should wait for the scan");
+  ASSERT_FALSE (buffer_is_loaded (&buffer),
+                "Polling should not scan the file");
+  ASSERT_EQ (scanned, buffer.num_lines, "No line should be appended yet");
+
+  buffer_load_all (&buffer);
+  follower_poll (follower, &buffer, &appended);
+  ASSERT_EQ (9, appended, "New text should follow once the scan is done");
+  ASSERT_EQ (1001, buffer.num_lines, "The new line should be the last");
+  assert_line (&buffer, 1000, "new line", "The new line should be whole");
+  assert_line (&buffer, 999, "line 999", "Scanned lines should come first");
+
+  follower_stop (follower);
+  free_editor_buffer (&buffer);
+  remove (TEST_FOLLOW_FILENAME);
+}
+
+void
+run_follow_tests (void)
+{
+  TEST_SUITE_START ("Follow Tests");
+
+  test_follower_appends_lines ();
+  test_follower_catches_up_in_chunks ();
+  test_follower_waits_for_lazy_scan ();
+
+  TEST_SUITE_END ("Follow Tests");
+}
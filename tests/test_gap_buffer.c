@@ -221,6 +221,113 @@ test_gap_buffer_edge_cases (void)
   gap_buffer_destroy (gb);
 }
 
+void
+test_gap_buffer_inline_storage (void)
+{
+  GapBuffer *gb = gap_buffer_create (16);
+  ASSERT_TRUE (gap_buffer_is_inline (gb),
+               "Small gap buffer should use inline storage");
+
+  // Grow inside the inline storage, with text on both sides of the gap
+  gap_buffer_insert_string (gb, "0123456789abcdefghij");
+  gap_buffer_move_cursor_to (gb, 10);
+  gap_buffer_insert_string (gb, "-");
+  ASSERT_TRUE (gap_buffer_is_inline (gb),
+               "Text that fits inline should stay inline");
+  char *result = gap_buffer_to_string (gb);
+  ASSERT_STR_EQ ("0123456789-abcdefghij", result,
+                 "Inline growth should preserve text after the gap");
+  free (result);
+
+  gap_buffer_insert_string (gb, "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789");
+  ASSERT_FALSE (gap_buffer_is_inline (gb),
+                "Text past the inline size should move to the heap");
+  result = gap_buffer_to_string (gb);
+  ASSERT_STR_EQ ("0123456789-ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789abcdefghij",
+                 result, "Switching to the heap should preserve the text");
+  free (result);
+  gap_buffer_destroy (gb);
+
+  gb = gap_buffer_create (GAP_BUFFER_INLINE_SIZE + 1);
+  ASSERT_FALSE (gap_buffer_is_inline (gb),
+                "Large initial capacity should go to the heap");
+  gap_buffer_destroy (gb);
+}
+
+void
+test_gap_buffer_compaction (void)
+{
+  GapBuffer *gb = gap_buffer_create (16);
+  for (int i = 0; i < 1000; i++)
+    {
+      gap_buffer_insert_char (gb, 'a' + (i % 26));
+    }
+  size_t peak = gb->capacity;
+
+  gap_buffer_move_cursor_to (gb, 10);
+  for (int i = 0; i < 900; i++)
+    {
+      gap_buffer_delete_char (gb);
+    }
+  ASSERT_EQ (100, gap_buffer_length (gb), "100 characters should remain");
+  ASSERT_TRUE (gb->capacity < peak / 2,
+               "Deleting most of the text should shrink the buffer");
+  ASSERT_EQ (10, gap_buffer_cursor_position (gb),
+             "Shrinking should keep the cursor in place");
+  ASSERT_EQ ('a' + 910 % 26, gap_buffer_get_char_at (gb, 10),
+             "Shrinking should keep the text after the gap");
+
+  char digits[201];
+  for (int i = 0; i < 200; i++)
+    {
+      digits[i] = '0' + (i % 10);
+    }
+  digits[200] = '\0';
+  gap_buffer_insert_string (gb, digits);
+  ASSERT_TRUE (gap_buffer_wants_compact (gb),
+               "Growth slack should make the buffer worth compacting");
+  gap_buffer_compact (gb);
+  ASSERT_FALSE (gap_buffer_wants_compact (gb),
+                "Compacted buffer should not want compacting again");
+  ASSERT_EQ (300, gap_buffer_length (gb), "Compaction should keep the text");
+
+  gap_buffer_truncate (gb, 5);
+  ASSERT_TRUE (gap_buffer_is_inline (gb),
+               "Text that fits inline should move back inline");
+  char *result = gap_buffer_to_string (gb);
+  ASSERT_STR_EQ ("abcde", result, "Text should survive moving inline");
+  free (result);
+
+  gap_buffer_destroy (gb);
+}
+
+void
+test_gap_buffer_spans (void)
+{
+  GapBuffer *gb = gap_buffer_create (16);
+  gap_buffer_insert_string (gb, "Hello World");
+  gap_buffer_move_cursor_to (gb, 5);
+
+  const char *first, *second;
+  size_t first_length, second_length;
+  gap_buffer_get_spans (gb, &first, &first_length, &second, &second_length);
+  ASSERT_EQ (5, first_length, "First span should end at the gap");
+  ASSERT_EQ (6, second_length, "Second span should start after the gap");
+  ASSERT_EQ (0, memcmp (first, "Hello", 5), "First span should be 'Hello'");
+  ASSERT_EQ (0, memcmp (second, " World", 6),
+             "Second span should be ' World'");
+
+  const char *text = gap_buffer_get_text (gb);
+  ASSERT_EQ (0, memcmp (text, "Hello World", 11),
+             "Text should be contiguous once the gap is moved");
+  ASSERT_EQ (11, gap_buffer_cursor_position (gb),
+             "Gap should sit behind the text");
+  ASSERT_TRUE (text == gap_buffer_get_text (gb),
+               "Reading again should not move anything");
+
+  gap_buffer_destroy (gb);
+}
+
 void
 run_gap_buffer_tests (void)
 {
@@ -234,6 +341,9 @@ run_gap_buffer_tests (void)
   test_gap_buffer_complex_editing ();
   test_gap_buffer_capacity_expansion ();
   test_gap_buffer_edge_cases ();
+  test_gap_buffer_inline_storage ();
+  test_gap_buffer_compaction ();
+  test_gap_buffer_spans ();
 
   TEST_SUITE_END ("Gap Buffer Tests");
 }
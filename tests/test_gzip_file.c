@@ -0,0 +1,219 @@
+#define _XOPEN_SOURCE 700
+#include "data_structures.h"
+#include "gzip_file.h"
+#include "line_index.h"
+#include "test_framework.h"
+#include "text_editor_functions.h"
+#include <fcntl.h>
+#include <unistd.h>
+
+#define TEST_GZIP_FILENAME "test_gzip_file.txt.gz"
+
+static void
+write_member (int fd, const char *text)
+{
+  GzipWriter writer;
+  gzip_writer_init (&writer, fd);
+  gzip_writer_write (&writer, text, strlen (text));
+  gzip_writer_finish (&writer);
+}
+
+static int
+starts_with_gzip_magic (const char *filename)
+{
+  FILE *file = fopen (filename, "r");
+  int detected = file != NULL && gzip_detect (file);
+  if (file)
+    fclose (file);
+  return detected;
+}
+
+void
+test_gzip_load_and_save (void)
+{
+  TEST_CASE_START ("Gzip files are inflated on load and deflated on save");
+
+  int fd = open (TEST_GZIP_FILENAME, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  write_member (fd, "first\nsecond\n");
+  write_member (fd, "third\n");
+  // gzip ignores padding after the last member
+  write (fd, "\0\0\0\0", 4);
+  close (fd);
+
+  TextBuffer buffer;
+  init_editor_buffer (&buffer);
+  loadFromFile (TEST_GZIP_FILENAME, &buffer);
+
+  ASSERT_TRUE (buffer.compressed, "Gzip file should be detected");
+  ASSERT_EQ (3, buffer.num_lines, "Every member should be inflated");
+  char *content = line_to_string (line_index_find (&buffer, 2));
+  ASSERT_STR_EQ ("third", content, "Second member should follow the first");
+  free (content);
+
+  line_insert_string_at (buffer.head, 0, "the ");
+  ASSERT_EQ (0, saveToFile (TEST_GZIP_FILENAME, &buffer),
+             "Compressed buffer should save");
+  ASSERT_TRUE (starts_with_gzip_magic (TEST_GZIP_FILENAME),
+               "Saved file should be compressed again");
+  free_editor_buffer (&buffer);
+
+  init_editor_buffer (&buffer);
+  loadFromFile (TEST_GZIP_FILENAME, &buffer);
+  content = line_to_string (buffer.head);
+  ASSERT_STR_EQ ("the first", content, "Saved file should keep the edit");
+  free (content);
+
+  buffer.compressed = 0;
+  ASSERT_EQ (0, saveToFile (TEST_GZIP_FILENAME, &buffer),
+             "Unchanged buffer should still save in the new format");
+  ASSERT_FALSE (starts_with_gzip_magic (TEST_GZIP_FILENAME),
+                "Turning compression off should save plain text");
+  free_editor_buffer (&buffer);
+
+  init_editor_buffer (&buffer);
+  loadFromFile (TEST_GZIP_FILENAME, &buffer);
+  ASSERT_FALSE (buffer.compressed, "Plain file should not be compressed");
+  ASSERT_EQ (3, buffer.num_lines, "Plain file should keep every line");
+  free_editor_buffer (&buffer);
+
+  remove (TEST_GZIP_FILENAME);
+}
+
+void
+test_gzip_damaged_file_loads_raw (void)
+{
+  TEST_CASE_START ("Damaged gzip files are shown as they are");
+
+  int fd = open (TEST_GZIP_FILENAME, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  write_member (fd, "some text that will be cut short\n");
+  off_t size = lseek (fd, 0, SEEK_CUR);
+  ftruncate (fd, size - 6);
+  close (fd);
+
+  TextBuffer buffer;
+  init_editor_buffer (&buffer);
+  loadFromFile (TEST_GZIP_FILENAME, &buffer);
+
+  ASSERT_FALSE (buffer.compressed, "Truncated file should not be inflated");
+  ASSERT_EQ ((size_t)(size - 6), line_index_total_bytes (&buffer) - 1,
+             "Truncated file should load byte for byte");
+
+  free_editor_buffer (&buffer);
+  remove (TEST_GZIP_FILENAME);
+}
+
+void
+test_gzip_inflates_in_parts (void)
+{
+  TEST_CASE_START ("Gzip output is inflated a few KB per call in tests");
+
+  // Over GZIP_CHUNK, so the buffer grows as well
+  size_t size = GZIP_CHUNK + 12345;
+  char *text = malloc (size + 1);
+  for (size_t i = 0; i < size; i++)
+    text[i] = i % 61 == 60 ? '\n' : 'a' + (i * 7 + i / 61) % 26;
+  text[size] = '\0';
+
+  int fd = open (TEST_GZIP_FILENAME, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  write_member (fd, text);
+  // Junk that claims to expand to 4G
+  write (fd, "\xff\xff\xff\xff", 4);
+  close (fd);
+
+  FILE *file = fopen (TEST_GZIP_FILENAME, "r");
+  size_t length = 0;
+  char *contents = gzip_read_contents (file, &length);
+  fclose (file);
+
+  ASSERT_NOT_NULL (contents, "File should inflate");
+  ASSERT_EQ (size, length, "Only inflated bytes should be counted");
+  ASSERT_TRUE (contents && memcmp (contents, text, size) == 0,
+               "Every part should land after the one before");
+
+  free (contents);
+  free (text);
+  remove (TEST_GZIP_FILENAME);
+}
+
+static char *
+numbered_lines (size_t first, size_t count)
+{
+  char *text = malloc (count * 24 + 1);
+  size_t length = 0;
+  for (size_t i = first; i < first + count; i++)
+    length += sprintf (text + length, "line %zu\n", i);
+  return text;
+}
+
+void
+test_gzip_large_file_inflates_in_background (void)
+{
+  TEST_CASE_START ("Large gzip files show before they are inflated");
+
+  // The trailer of the last member undersells the file, so part of it has
+  // to be added once the rest is in
+  char *first = numbered_lines (0, 150000);
+  char *second = numbered_lines (150000, 100000);
+  int fd = open (TEST_GZIP_FILENAME, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  write_member (fd, first);
+  write_member (fd, second);
+  close (fd);
+  ASSERT_TRUE (strlen (second) >= ASYNC_LOAD_THRESHOLD,
+               "Trailer should claim enough to load in the background");
+
+  TextBuffer buffer;
+  init_editor_buffer (&buffer);
+  buffer.async_load = 1;
+  loadFromFile (TEST_GZIP_FILENAME, &buffer);
+
+  ASSERT_TRUE (buffer.compressed, "Gzip file should be detected");
+  ASSERT_TRUE (buffer.num_lines > 0, "First chunk should be split at once");
+  ASSERT_TRUE (buffer.num_lines < 250000,
+               "The rest should not be inflated before returning");
+  char *content = line_to_string (buffer.head);
+  ASSERT_STR_EQ ("line 0", content, "First line should be inflated");
+  free (content);
+
+  while (buffer_poll_load (&buffer, 10000))
+    {
+    }
+  ASSERT_EQ (0, buffer.load_error, "Whole file should be inflated");
+  ASSERT_EQ (250000, buffer.num_lines, "Both members should be split");
+  content = line_to_string (line_index_find (&buffer, 149999));
+  ASSERT_STR_EQ ("line 149999", content,
+                 "Lines split before the rest came in should stay whole");
+  free (content);
+  content = line_to_string (buffer.tail);
+  ASSERT_STR_EQ ("line 249999", content, "Last member should be added");
+  free (content);
+
+  line_insert_string_at (buffer.head, 0, "the ");
+  ASSERT_EQ (0, saveToFile (TEST_GZIP_FILENAME, &buffer),
+             "Inflated buffer should save");
+  free_editor_buffer (&buffer);
+
+  init_editor_buffer (&buffer);
+  loadFromFile (TEST_GZIP_FILENAME, &buffer);
+  ASSERT_EQ (250000, buffer.num_lines, "Saved file should keep every line");
+  content = line_to_string (buffer.head);
+  ASSERT_STR_EQ ("the line 0", content, "Saved file should keep the edit");
+  free (content);
+  free_editor_buffer (&buffer);
+
+  free (first);
+  free (second);
+  remove (TEST_GZIP_FILENAME);
+}
+
+void
+run_gzip_file_tests (void)
+{
+  TEST_SUITE_START ("Gzip File Tests");
+
+  test_gzip_load_and_save ();
+  test_gzip_damaged_file_loads_raw ();
+  test_gzip_inflates_in_parts ();
+  test_gzip_large_file_inflates_in_background ();
+
+  TEST_SUITE_END ("Gzip File Tests");
+}
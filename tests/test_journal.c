@@ -0,0 +1,279 @@
+#define _XOPEN_SOURCE 700
+#include "data_structures.h"
+#include "editor_state.h"
+#include "journal.h"
+#include "line_index.h"
+#include "test_framework.h"
+#include "text_editor_functions.h"
+#include "undo.h"
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define TEST_JOURNAL_FILENAME "test_journal.txt"
+#define TEST_JOURNAL_LOG ".test_journal.txt.ben-journal"
+
+static void
+write_test_file (void)
+{
+  FILE *file = fopen (TEST_JOURNAL_FILENAME, "w");
+  fprintf (file, "alpha\nbeta\n");
+  fclose (file);
+}
+
+static void
+open_state (EditorState *state)
+{
+  init_editor_state (state, TEST_JOURNAL_FILENAME);
+  init_undo_system ();
+  open_editor_journal (state);
+}
+
+// Stops logging the way a crash would: whatever was committed stays.
+static void
+crash_state (EditorState *state)
+{
+  undo_attach_journal (NULL);
+  journal_close (state->journal, 0);
+  state->journal = NULL;
+  free_editor_state (state);
+}
+
+static long
+log_size (void)
+{
+  struct stat st;
+  return stat (TEST_JOURNAL_LOG, &st) == 0 ? (long)st.st_size : -1;
+}
+
+void
+test_journal_replays_after_crash (void)
+{
+  TEST_CASE_START ("Journal replays edits lost in a crash");
+
+  write_test_file ();
+  EditorState state;
+  open_state (&state);
+  ASSERT_NOT_NULL (state.journal, "Editing a file should start a journal");
+
+  Line *line = state.buffer.head;
+  push_undo_operation (UNDO_INSERT_CHAR, line, 5, "!", 1);
+  line_insert_char_at (line, 5, '!');
+  push_undo_operation (UNDO_SPLIT_LINE, line, 2, NULL, 0);
+  buffer_replace_range (&state.buffer, line, 2, line, 2, "\n", 1, NULL);
+  Line *beta = line_index_find (&state.buffer, 2);
+  push_undo_operation (UNDO_DELETE_CHAR, beta, 0, "b", 1);
+  line_delete_char_at (beta, 0);
+  perform_undo (&state.buffer);
+  crash_state (&state);
+
+  open_state (&state);
+  ASSERT_STR_EQ ("Recovered 4 edits from the journal", state.temp_message,
+                 "Replay should report the edits it made");
+  ASSERT_EQ (3, state.buffer.num_lines, "Replayed split should add a line");
+  char *content = line_to_string (state.buffer.head->next);
+  ASSERT_STR_EQ ("pha!", content, "Replayed edits should be in the buffer");
+  free (content);
+  content = line_to_string (line_index_find (&state.buffer, 2));
+  ASSERT_STR_EQ ("beta", content, "Replayed undo should restore the char");
+  free (content);
+
+  // Replay logged the undo as the insert it made, which undoes on its own
+  perform_undo (&state.buffer);
+  crash_state (&state);
+
+  // A record torn by the crash is dropped
+  FILE *log = fopen (TEST_JOURNAL_LOG, "a");
+  fwrite ("torn", 1, 4, log);
+  fclose (log);
+  long size_before = log_size ();
+
+  open_state (&state);
+  ASSERT_STR_EQ ("Recovered 5 edits from the journal", state.temp_message,
+                 "Every complete record should replay");
+  ASSERT_EQ (size_before - 4, log_size (),
+             "The torn record should be cut off the log");
+  content = line_to_string (line_index_find (&state.buffer, 2));
+  ASSERT_STR_EQ ("eta", content, "Replayed undo should delete again");
+  free (content);
+
+  saveToFile (TEST_JOURNAL_FILENAME, &state.buffer);
+  journal_checkpoint (state.journal, &state.buffer.disk);
+  ASSERT_EQ ((long)sizeof (JournalHeader), log_size (),
+             "Saving should truncate the log to its header");
+  crash_state (&state);
+
+  open_state (&state);
+  ASSERT_FALSE (has_temp_message (&state),
+                "Nothing should be replayed after a save");
+  free_editor_state (&state);
+  ASSERT_EQ (-1, log_size (), "Closing the editor should delete the log");
+
+  remove (TEST_JOURNAL_FILENAME);
+}
+
+void
+test_journal_ignores_other_contents (void)
+{
+  TEST_CASE_START ("Journal is not replayed over a changed file");
+
+  write_test_file ();
+  EditorState state;
+  open_state (&state);
+  push_undo_operation (UNDO_INSERT_CHAR, state.buffer.head, 0, "x", 1);
+  line_insert_char_at (state.buffer.head, 0, 'x');
+  crash_state (&state);
+
+  FILE *file = fopen (TEST_JOURNAL_FILENAME, "a");
+  fprintf (file, "gamma\n");
+  fclose (file);
+
+  open_state (&state);
+  ASSERT_FALSE (has_temp_message (&state),
+                "Edits made to other contents should not replay");
+  char *content = line_to_string (state.buffer.head);
+  ASSERT_STR_EQ ("alpha", content, "Changed file should load as it is");
+  free (content);
+  free_editor_state (&state);
+
+  remove (TEST_JOURNAL_FILENAME);
+}
+
+void
+test_journal_keeps_edits_after_snapshot (void)
+{
+  TEST_CASE_START ("Journal keeps edits made while a save was running");
+
+  write_test_file ();
+  EditorState state;
+  open_state (&state);
+
+  Line *line = state.buffer.head;
+  push_undo_operation (UNDO_INSERT_CHAR, line, 5, "!", 1);
+  line_insert_char_at (line, 5, '!');
+  uint64_t position = journal_position (state.journal);
+  saveToFile (TEST_JOURNAL_FILENAME, &state.buffer);
+
+  // Made after the contents being saved were taken
+  Line *beta = line->next;
+  push_undo_operation (UNDO_INSERT_CHAR, beta, 0, "x", 1);
+  line_insert_char_at (beta, 0, 'x');
+
+  journal_checkpoint_at (state.journal, &state.buffer.disk, position);
+  crash_state (&state);
+  ASSERT_EQ ((long)(sizeof (JournalHeader) + sizeof (JournalRecord) + 1),
+             log_size (), "Only the later edit should stay in the log");
+
+  open_state (&state);
+  ASSERT_STR_EQ ("Recovered 1 edits from the journal", state.temp_message,
+                 "The later edit should replay over the saved file");
+  char *content = line_to_string (state.buffer.head);
+  ASSERT_STR_EQ ("alpha!", content, "The saved edit should not replay");
+  free (content);
+  content = line_to_string (state.buffer.head->next);
+  ASSERT_STR_EQ ("xbeta", content, "The later edit should be recovered");
+  free (content);
+  free_editor_state (&state);
+
+  remove (TEST_JOURNAL_FILENAME);
+}
+
+void
+test_journal_replays_undo_after_save (void)
+{
+  TEST_CASE_START ("Journal replays undos of edits from before a save");
+
+  write_test_file ();
+  EditorState state;
+  open_state (&state);
+
+  Line *line = state.buffer.head;
+  push_undo_operation (UNDO_INSERT_CHAR, line, 5, "!", 1);
+  line_insert_char_at (line, 5, '!');
+  push_undo_operation (UNDO_INSERT_LINE, line, 0, "", 0);
+  insert_line_after (&state.buffer, line, create_new_line_empty ());
+  saveToFile (TEST_JOURNAL_FILENAME, &state.buffer);
+  journal_checkpoint (state.journal, &state.buffer.disk);
+
+  // The log no longer holds the edits these undo
+  perform_undo (&state.buffer);
+  perform_undo (&state.buffer);
+  push_undo_operation (UNDO_INSERT_CHAR, line, 0, "x", 1);
+  line_insert_char_at (line, 0, 'x');
+
+  // A record that cannot apply, then one that can
+  push_undo_operation (UNDO_DELETE_CHAR, line, 99, "z", 1);
+  push_undo_operation (UNDO_INSERT_CHAR, line->next, 0, "y", 1);
+  line_insert_char_at (line->next, 0, 'y');
+  crash_state (&state);
+  long size_before = log_size ();
+
+  open_state (&state);
+  ASSERT_STR_EQ ("Recovered 4 edits from the journal", state.temp_message,
+                 "Undos should replay over the saved file");
+  ASSERT_EQ (2, state.buffer.num_lines, "Undone line should be removed");
+  char *content = line_to_string (state.buffer.head);
+  ASSERT_STR_EQ ("xalpha", content, "Undo and typing should both replay");
+  free (content);
+  content = line_to_string (state.buffer.tail);
+  ASSERT_STR_EQ ("ybeta", content,
+                 "Edits after a record that cannot apply should replay");
+  free (content);
+  ASSERT_EQ (size_before, log_size (),
+             "A record that cannot apply should stay in the log");
+  free_editor_state (&state);
+
+  remove (TEST_JOURNAL_FILENAME);
+}
+
+void
+test_journal_replays_over_followed_file (void)
+{
+  TEST_CASE_START ("Journal replays over text appended while following");
+
+  write_test_file ();
+  EditorState state;
+  open_state (&state);
+
+  Line *line = state.buffer.head;
+  push_undo_operation (UNDO_INSERT_CHAR, line, 5, "!", 1);
+  line_insert_char_at (line, 5, '!');
+  ASSERT_TRUE (start_following (&state), "A plain file should be followed");
+
+  FILE *file = fopen (TEST_JOURNAL_FILENAME, "a");
+  fprintf (file, "gamma\n");
+  fclose (file);
+  size_t appended;
+  ASSERT_EQ (FOLLOW_OK, poll_following (&state, &appended),
+             "Polling after a write should succeed");
+  ASSERT_EQ (6, appended, "The new line should be read");
+  stop_following (&state);
+  crash_state (&state);
+
+  open_state (&state);
+  ASSERT_STR_EQ ("Recovered 1 edits from the journal", state.temp_message,
+                 "The edit should replay over the longer file");
+  ASSERT_EQ (3, state.buffer.num_lines, "The followed line should stay");
+  char *content = line_to_string (state.buffer.head);
+  ASSERT_STR_EQ ("alpha!", content, "The edit should be recovered");
+  free (content);
+  content = line_to_string (state.buffer.head->next->next);
+  ASSERT_STR_EQ ("gamma", content, "The followed text should be loaded");
+  free (content);
+  free_editor_state (&state);
+
+  remove (TEST_JOURNAL_FILENAME);
+}
+
+void
+run_journal_tests (void)
+{
+  TEST_SUITE_START ("Journal Tests");
+
+  test_journal_replays_after_crash ();
+  test_journal_ignores_other_contents ();
+  test_journal_keeps_edits_after_snapshot ();
+  test_journal_replays_undo_after_save ();
+  test_journal_replays_over_followed_file ();
+
+  TEST_SUITE_END ("Journal Tests");
+}
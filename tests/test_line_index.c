@@ -0,0 +1,214 @@
+#include "data_structures.h"
+#include "line_index.h"
+#include "test_framework.h"
+#include "text_editor_functions.h"
+
+// Walks the list and checks every line against the index.
+static int
+index_matches_list (const TextBuffer *buffer)
+{
+  size_t position = 0;
+  size_t offset = 0;
+
+  for (Line *line = buffer->head; line != NULL; line = line->next)
+    {
+      if (line_index_find (buffer, position) != line
+          || line_index_position (line) != position
+          || line_index_byte_offset (line) != offset)
+        {
+          return 0;
+        }
+      position++;
+      offset += line_get_length (line) + 1;
+    }
+
+  return position == buffer->num_lines
+         && line_index_find (buffer, position) == NULL
+         && line_index_total_bytes (buffer) == offset;
+}
+
+void
+test_line_index_insertion (void)
+{
+  TextBuffer buffer;
+  init_editor_buffer (&buffer);
+
+  ASSERT_NULL (line_index_find (&buffer, 0),
+               "Empty buffer should have no line 0");
+
+  Line *middle = create_new_line ("middle");
+  insert_line_at_end (&buffer, middle);
+  insert_line_at_beginning (&buffer, create_new_line ("first"));
+  insert_line_at_end (&buffer, create_new_line ("last"));
+  insert_line_after (&buffer, middle, create_new_line ("after middle"));
+
+  ASSERT_EQ (4, buffer.num_lines, "Buffer should have 4 lines");
+  ASSERT_EQ (1, line_index_position (middle), "Middle line should be line 1");
+  ASSERT_EQ (6, line_index_byte_offset (middle),
+             "Middle line should start after \"first\\n\"");
+  ASSERT_TRUE (index_matches_list (&buffer), "Index should match the list");
+
+  for (int i = 0; i < 500; i++)
+    {
+      Line *anchor = line_index_find (&buffer, (i * 7) % buffer.num_lines);
+      insert_line_after (&buffer, anchor, create_new_line ("x"));
+    }
+  ASSERT_EQ (504, buffer.num_lines, "Buffer should have 504 lines");
+  ASSERT_TRUE (index_matches_list (&buffer),
+               "Index should match the list after many insertions");
+
+  free_editor_buffer (&buffer);
+}
+
+void
+test_line_index_removal (void)
+{
+  TextBuffer buffer;
+  init_editor_buffer (&buffer);
+
+  for (int i = 0; i < 300; i++)
+    {
+      insert_line_at_end (&buffer, create_new_line ("line"));
+    }
+
+  Line *head = buffer.head;
+  remove_line (&buffer, head);
+  free_line (head);
+  Line *tail = buffer.tail;
+  remove_line (&buffer, tail);
+  free_line (tail);
+
+  for (int i = 0; i < 200; i++)
+    {
+      Line *line = line_index_find (&buffer, (i * 13) % buffer.num_lines);
+      ASSERT_TRUE (line_index_contains (&buffer, line),
+                   "Line found by number should be in the buffer");
+      remove_line (&buffer, line);
+      ASSERT_FALSE (line_index_contains (&buffer, line),
+                    "Removed line should no longer be in the buffer");
+      free_line (line);
+    }
+
+  ASSERT_EQ (98, buffer.num_lines, "Buffer should have 98 lines left");
+  ASSERT_TRUE (index_matches_list (&buffer),
+               "Index should match the list after removals");
+
+  free_editor_buffer (&buffer);
+}
+
+void
+test_line_index_byte_counts (void)
+{
+  TextBuffer buffer;
+  init_editor_buffer (&buffer);
+
+  Line *first = create_new_line ("abc");
+  Line *second = create_new_line ("de");
+  insert_line_at_end (&buffer, first);
+  insert_line_at_end (&buffer, second);
+  ASSERT_EQ (7, line_index_total_bytes (&buffer),
+             "Total bytes should include newlines");
+
+  line_insert_string_at (first, 3, "xyz");
+  ASSERT_EQ (7, line_index_byte_offset (second),
+             "Edits should update byte offsets of later lines");
+
+  line_truncate (first, 1);
+  line_delete_char_at (second, 0);
+  ASSERT_EQ (2, line_index_byte_offset (second),
+             "Deletions should update byte offsets");
+  ASSERT_EQ (4, line_index_total_bytes (&buffer),
+             "Total bytes should track deletions");
+
+  free_editor_buffer (&buffer);
+}
+
+void
+test_line_index_build (void)
+{
+  const char *filename = "test_line_index.txt";
+  FILE *file = fopen (filename, "w");
+  for (int i = 0; i < 1000; i++)
+    {
+      fprintf (file, "line %d\n", i);
+    }
+  fclose (file);
+
+  TextBuffer buffer;
+  init_editor_buffer (&buffer);
+  loadFromFile (filename, &buffer);
+
+  ASSERT_EQ (1000, buffer.num_lines, "Loaded buffer should have 1000 lines");
+  ASSERT_TRUE (index_matches_list (&buffer),
+               "Index built at load should match the list");
+
+  char *content = line_to_string (line_index_find (&buffer, 567));
+  ASSERT_STR_EQ ("line 567", content, "Line 567 should be found by number");
+  free (content);
+
+  free_editor_buffer (&buffer);
+  remove (filename);
+}
+
+void
+test_line_index_compaction_sweep (void)
+{
+  TextBuffer buffer;
+  init_editor_buffer (&buffer);
+
+  Line *lines[50];
+  for (int i = 0; i < 50; i++)
+    {
+      lines[i] = create_new_line ("short");
+      insert_line_at_end (&buffer, lines[i]);
+    }
+
+  ASSERT_NULL (line_index_find_flagged (&buffer, 0, LINE_NEEDS_COMPACT),
+               "Fresh lines should not need compacting");
+
+  for (int i = 10; i < 50; i += 20)
+    {
+      for (int j = 0; j < 300; j++)
+        {
+          line_insert_char_at (lines[i], 0, 'x');
+        }
+    }
+  ASSERT_TRUE (line_index_find_flagged (&buffer, 0, LINE_NEEDS_COMPACT)
+                   == lines[10],
+               "First grown line should be flagged");
+  ASSERT_TRUE (line_index_find_flagged (&buffer, 11, LINE_NEEDS_COMPACT)
+                   == lines[30],
+               "Search should start at the given line number");
+
+  buffer.current_line_node = lines[30];
+  ASSERT_EQ (1, buffer_compact_lines (&buffer, 10),
+             "Only the line away from the cursor should be compacted");
+  ASSERT_FALSE (lines[10]->flags & LINE_NEEDS_COMPACT,
+                "Compacted line should no longer be flagged");
+  ASSERT_TRUE (lines[30]->flags & LINE_NEEDS_COMPACT,
+               "Cursor line should be left for later");
+  ASSERT_EQ (305, line_get_length (lines[10]),
+             "Compaction should not change the text");
+
+  buffer.current_line_node = lines[0];
+  ASSERT_EQ (1, buffer_compact_lines (&buffer, 10),
+             "Cursor line should be compacted once the cursor leaves");
+  ASSERT_NULL (line_index_find_flagged (&buffer, 0, LINE_NEEDS_COMPACT),
+               "No lines should be left to compact");
+
+  free_editor_buffer (&buffer);
+}
+
+void
+run_line_index_tests (void)
+{
+  TEST_SUITE_START ("Line Index Tests");
+
+  test_line_index_insertion ();
+  test_line_index_removal ();
+  test_line_index_byte_counts ();
+  test_line_index_build ();
+  test_line_index_compaction_sweep ();
+
+  TEST_SUITE_END ("Line Index Tests");
+}
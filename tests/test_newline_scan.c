@@ -0,0 +1,75 @@
+#include "newline_scan.h"
+#include "test_framework.h"
+
+// Checks every newline the scanner reports against a byte-by-byte search.
+static int
+scan_matches (const char *data, size_t start, size_t length)
+{
+  NewlineScanner scanner;
+  newline_scanner_init (&scanner, data, start, length);
+
+  for (size_t i = start; i < length; i++)
+    {
+      if (data[i] == '\n' && newline_scanner_next (&scanner) != i)
+        return 0;
+    }
+
+  return newline_scanner_next (&scanner) == length
+         && newline_scanner_next (&scanner) == length;
+}
+
+void
+test_newline_scan_blocks (void)
+{
+  TEST_CASE_START ("Newline scanner matches a byte-by-byte search");
+
+  char data[1000];
+  unsigned int state = 12345;
+  for (size_t i = 0; i < sizeof (data); i++)
+    {
+      state = state * 1103515245u + 12345u;
+      // About one byte in eight is a newline, with some runs of them
+      data[i] = (state >> 16) % 8 == 0 ? '\n' : 'a' + (state >> 16) % 26;
+    }
+
+  ASSERT_TRUE (scan_matches (data, 0, sizeof (data)),
+               "Whole buffer should be scanned exactly");
+
+  int all_match = 1;
+  for (size_t start = 0; start < 70; start++)
+    {
+      for (size_t length = start; length < 200; length += 7)
+        {
+          all_match = all_match && scan_matches (data, start, length);
+        }
+    }
+  ASSERT_TRUE (all_match, "Unaligned starts and partial blocks should match");
+
+  char newlines[130];
+  memset (newlines, '\n', sizeof (newlines));
+  ASSERT_TRUE (scan_matches (newlines, 0, sizeof (newlines)),
+               "Every byte of a block can be a newline");
+
+  char none[200];
+  memset (none, 'x', sizeof (none));
+  NewlineScanner scanner;
+  newline_scanner_init (&scanner, none, 3, sizeof (none));
+  ASSERT_EQ (sizeof (none), newline_scanner_next (&scanner),
+             "Text without newlines should scan to the end");
+
+  newline_scanner_init (&scanner, none, 0, 0);
+  ASSERT_EQ (0, newline_scanner_next (&scanner),
+             "Empty text should have no newlines");
+
+  TEST_CASE_END ();
+}
+
+void
+run_newline_scan_tests (void)
+{
+  TEST_SUITE_START ("Newline Scan Tests");
+
+  test_newline_scan_blocks ();
+
+  TEST_SUITE_END ("Newline Scan Tests");
+}
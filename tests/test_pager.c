@@ -0,0 +1,154 @@
+#define _DEFAULT_SOURCE
+#include "data_structures.h"
+#include "line_index.h"
+#include "pager.h"
+#include "test_framework.h"
+#include "text_editor_functions.h"
+#include <sys/mman.h>
+
+#define TEST_PAGER_FILENAME "test_pager.txt"
+
+void
+test_pager_evicts_cold_windows (void)
+{
+  TEST_CASE_START ("Pager drops cold windows of a mapping");
+
+  size_t length = 4 * PAGER_WINDOW_SIZE;
+  FILE *file = fopen (TEST_PAGER_FILENAME, "w");
+  for (size_t i = 0; i < length; i++)
+    {
+      fputc ('a' + i % 26, file);
+    }
+  fclose (file);
+
+  file = fopen (TEST_PAGER_FILENAME, "r");
+  char *mapping = mmap (NULL, length, PROT_READ, MAP_PRIVATE, fileno (file),
+                        0);
+  fclose (file);
+  ASSERT_TRUE (mapping != MAP_FAILED, "Test file should map");
+
+  size_t sum = 0;
+  for (size_t i = 0; i < length; i += 4096)
+    {
+      sum += mapping[i];
+    }
+  ASSERT_TRUE (sum > 0, "Reading the mapping should fault it in");
+
+  Pager *pager = pager_create (mapping, length, PAGER_WINDOW_SIZE);
+  ASSERT_EQ (0, pager_resident_bytes (pager),
+             "Windows nobody touched should not be looked at");
+  pager_touch (pager, mapping, length);
+  ASSERT_EQ (length, pager_resident_bytes (pager),
+             "Every window should be resident after reading");
+
+  pager_begin_tick (pager);
+  pager_touch (pager, mapping, 10);
+  size_t resident = pager_evict (pager, PAGER_WINDOW_SIZE);
+  ASSERT_TRUE (resident <= PAGER_WINDOW_SIZE,
+               "Eviction should bring the mapping under the budget");
+  ASSERT_EQ (PAGER_WINDOW_SIZE, pager_resident_bytes (pager),
+             "The window in use should stay resident");
+  ASSERT_EQ (1, pager->num_listed, "Dropped windows should leave the list");
+
+  int intact = 1;
+  for (size_t i = 0; i < length; i += 4093)
+    {
+      if (mapping[i] != 'a' + (char)(i % 26))
+        intact = 0;
+    }
+  ASSERT_TRUE (intact, "Dropped windows should fault back in unchanged");
+
+  const char *spilled = pager_spill (pager, "spilled text", 12);
+  ASSERT_NOT_NULL (spilled, "Text should spill to the spill file");
+  ASSERT_TRUE (memcmp (spilled, "spilled text", 12) == 0,
+               "Spilled text should read back");
+  ASSERT_EQ (12, pager->spilled_bytes, "Spilled bytes should be counted");
+  ASSERT_TRUE (pager->lru_tail->region == 1,
+               "Spilled text should start out cold");
+
+  pager_destroy (pager);
+  munmap (mapping, length);
+  remove (TEST_PAGER_FILENAME);
+}
+
+void
+test_buffer_page_out_spills_edited_lines (void)
+{
+  TEST_CASE_START ("Edited lines far from the cursor are paged out");
+
+  FILE *file = fopen (TEST_PAGER_FILENAME, "w");
+  for (int i = 0; i < 10000; i++)
+    {
+      fprintf (file, "line %d\n", i);
+    }
+  fclose (file);
+
+  TextBuffer buffer;
+  init_editor_buffer (&buffer);
+  buffer.lazy_load = 1;
+  loadFromFile (TEST_PAGER_FILENAME, &buffer);
+  buffer_load_all (&buffer);
+  ASSERT_NOT_NULL (buffer.pager, "Mapped buffer should have a pager");
+
+  Line *far = line_index_find (&buffer, 5000);
+  Line *split = line_index_find (&buffer, 8000);
+  line_insert_string_at (buffer.head, 0, "near ");
+  line_insert_string_at (far, 0, "far ");
+  for (int i = 0; i < 20; i++)
+    {
+      line_insert_string_at (split, 0, "x");
+      line_delete_char_at (split, 0);
+    }
+  line_insert_string_at (split, 4, " edited");
+  ASSERT_TRUE (far->flags & LINE_OWNS_STORAGE, "Edited line should own text");
+
+  buffer.current_line_node = buffer.head;
+  buffer.pager->budget = 0;
+  size_t hot_lines[] = { 0 };
+  buffer_page_out (&buffer, hot_lines, 1);
+
+  ASSERT_FALSE (far->flags & LINE_OWNS_STORAGE,
+                "Cold edited line should be paged out");
+  ASSERT_TRUE (far->gb == NULL && far->pt == NULL,
+               "Paged out line should become a slice");
+  ASSERT_TRUE (buffer.head->flags & LINE_OWNS_STORAGE,
+               "Line under the cursor should stay on the heap");
+  char *content = line_to_string (far);
+  ASSERT_STR_EQ ("far line 5000", content, "Paged out text should be kept");
+  free (content);
+  content = line_to_string (split);
+  ASSERT_STR_EQ ("line edited 8000", content,
+                 "Paged out pieces should be kept");
+  free (content);
+
+  line_insert_string_at (far, 0, "very ");
+  content = line_to_string (far);
+  ASSERT_STR_EQ ("very far line 5000", content,
+                 "Paged out line should take edits again");
+  free (content);
+
+  ASSERT_EQ (0, saveToFile (TEST_PAGER_FILENAME, &buffer),
+             "Buffer with paged out lines should save");
+  free_editor_buffer (&buffer);
+
+  init_editor_buffer (&buffer);
+  loadFromFile (TEST_PAGER_FILENAME, &buffer);
+  content = line_to_string (line_index_find (&buffer, 8000));
+  ASSERT_STR_EQ ("line edited 8000", content, "Saved file should keep edits");
+  free (content);
+  ASSERT_EQ (10000, buffer.num_lines, "Saved file should keep every line");
+  free_editor_buffer (&buffer);
+
+  remove (TEST_PAGER_FILENAME);
+}
+
+void
+run_pager_tests (void)
+{
+  TEST_SUITE_START ("Pager Tests");
+
+  test_pager_evicts_cold_windows ();
+  test_buffer_page_out_spills_edited_lines ();
+
+  TEST_SUITE_END ("Pager Tests");
+}
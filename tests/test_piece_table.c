@@ -0,0 +1,222 @@
+#include "data_structures.h"
+#include "piece_table.h"
+#include "test_framework.h"
+#include "text_editor_functions.h"
+
+static PieceStore *
+create_test_store (const char *text)
+{
+  size_t length = strlen (text);
+  char *original = malloc (length);
+  memcpy (original, text, length);
+  return piece_store_create (original, length);
+}
+
+void
+test_piece_table_creation (void)
+{
+  PieceStore *store = create_test_store ("Hello World");
+  PieceTable *pt = piece_table_create (store, 6, 5);
+  ASSERT_NOT_NULL (pt, "Piece table should be created successfully");
+  ASSERT_EQ (5, piece_table_length (pt), "Piece table should have length 5");
+  ASSERT_EQ (1, pt->num_pieces, "New piece table should have one piece");
+  ASSERT_EQ ('W', piece_table_get_char_at (pt, 0),
+             "First character should come from the original buffer");
+  ASSERT_EQ ('\0', piece_table_get_char_at (pt, 5),
+             "Character beyond piece table should be null");
+
+  char *result = piece_table_to_string (pt);
+  ASSERT_STR_EQ ("World", result, "Piece table should contain its slice");
+  free (result);
+  piece_table_destroy (pt);
+
+  pt = piece_table_create (store, 0, 0);
+  ASSERT_EQ (0, pt->num_pieces, "Empty piece table should have no pieces");
+  ASSERT_EQ (0, piece_table_length (pt), "Empty piece table has length 0");
+  piece_table_destroy (pt);
+
+  piece_store_destroy (store);
+}
+
+void
+test_piece_table_insert (void)
+{
+  PieceStore *store = create_test_store ("Hello World");
+  PieceTable *pt = piece_table_create (store, 0, 11);
+
+  piece_table_insert_char (pt, 5, ',');
+  piece_table_insert_char (pt, 6, '!');
+  ASSERT_EQ (3, pt->num_pieces,
+             "Consecutive inserts should extend a single add piece");
+
+  char *result = piece_table_to_string (pt);
+  ASSERT_STR_EQ ("Hello,! World", result, "Inserted text should appear");
+  free (result);
+
+  piece_table_insert_string (pt, 0, ">> ");
+  piece_table_insert_string (pt, piece_table_length (pt), " <<");
+  result = piece_table_to_string (pt);
+  ASSERT_STR_EQ (">> Hello,! World <<", result,
+                 "Inserts at both ends should work");
+  free (result);
+
+  ASSERT_EQ (0, memcmp (store->original, "Hello World", 11),
+             "Original buffer should never be modified");
+  ASSERT_EQ (8, store->add_length,
+             "Add buffer should only grow by the inserted bytes");
+
+  piece_table_destroy (pt);
+  piece_store_destroy (store);
+}
+
+void
+test_piece_table_delete (void)
+{
+  PieceStore *store = create_test_store ("abcdef");
+  PieceTable *pt = piece_table_create (store, 0, 6);
+
+  piece_table_delete_char (pt, 0);
+  piece_table_delete_char (pt, 4);
+  char *result = piece_table_to_string (pt);
+  ASSERT_STR_EQ ("bcde", result, "Deleting at the edges should shrink piece");
+  free (result);
+  ASSERT_EQ (1, pt->num_pieces, "Edge deletions should not split pieces");
+
+  piece_table_delete_char (pt, 1);
+  result = piece_table_to_string (pt);
+  ASSERT_STR_EQ ("bde", result, "Deleting in the middle should split piece");
+  free (result);
+  ASSERT_EQ (2, pt->num_pieces, "Middle deletion should leave two pieces");
+
+  piece_table_delete_char (pt, 10);
+  ASSERT_EQ (3, piece_table_length (pt),
+             "Deleting beyond the end should do nothing");
+
+  piece_table_truncate (pt, 1);
+  result = piece_table_to_string (pt);
+  ASSERT_STR_EQ ("b", result, "Truncate should drop trailing pieces");
+  free (result);
+
+  piece_table_delete_char (pt, 0);
+  ASSERT_EQ (0, pt->num_pieces, "Empty pieces should be removed");
+  ASSERT_EQ (0, piece_table_length (pt), "Piece table should be empty");
+
+  piece_table_destroy (pt);
+  piece_store_destroy (store);
+}
+
+void
+test_piece_table_delete_range (void)
+{
+  PieceStore *store = create_test_store ("0123456789");
+  PieceTable *pt = piece_table_create (store, 0, 10);
+
+  piece_table_insert_string (pt, 5, "abc");
+  piece_table_delete_range (pt, 3, 4);
+  char *result = piece_table_to_string (pt);
+  ASSERT_STR_EQ ("012c56789", result,
+                 "Range deletion should span several pieces");
+  free (result);
+  ASSERT_EQ (3, pt->num_pieces, "Fully deleted pieces should be dropped");
+
+  piece_table_delete_range (pt, 7, 100);
+  result = piece_table_to_string (pt);
+  ASSERT_STR_EQ ("012c567", result, "Range should be clamped to the end");
+  free (result);
+
+  piece_table_destroy (pt);
+  piece_store_destroy (store);
+}
+
+void
+test_piece_table_spans (void)
+{
+  PieceStore *store = create_test_store ("Hello World");
+  PieceTable *pt = piece_table_create (store, 0, 11);
+
+  piece_table_insert_string (pt, 5, ",");
+  size_t add_length = store->add_length;
+
+  const char *span;
+  ASSERT_EQ (5, piece_table_span_at (pt, 0, &span),
+             "First span should end at the insert");
+  ASSERT_TRUE (span == store->original, "Span should point into storage");
+  ASSERT_EQ (1, piece_table_span_at (pt, 5, &span),
+             "Inserted text should be its own span");
+  ASSERT_EQ (',', span[0], "Span should hold the inserted text");
+  ASSERT_EQ (4, piece_table_span_at (pt, 8, &span),
+             "Span should start inside a piece");
+  ASSERT_EQ (0, memcmp (span, "orld", 4), "Span should hold the tail");
+  ASSERT_EQ (2, piece_table_span_before (pt, 8, &span),
+             "Span before should end inside a piece");
+  ASSERT_EQ (0, memcmp (span, " W", 2), "Span before should hold ' W'");
+
+  ASSERT_EQ (3, pt->num_pieces, "Reading should not merge pieces");
+  ASSERT_EQ (add_length, store->add_length,
+             "Reading should not copy into the add buffer");
+
+  piece_table_destroy (pt);
+  piece_store_destroy (store);
+}
+
+void
+test_piece_table_load_from_file (void)
+{
+  const char *filename = "test_piece_table.txt";
+  FILE *file = fopen (filename, "w");
+  fprintf (file, "first\nsecond\n\nlast");
+  fclose (file);
+
+  TextBuffer buffer;
+  init_editor_buffer (&buffer);
+  buffer.storage_mode = STORAGE_PIECE_TABLE;
+  loadFromFile (filename, &buffer);
+
+  ASSERT_EQ (4, buffer.num_lines, "Piece-table load should find 4 lines");
+  ASSERT_NOT_NULL (buffer.store, "Buffer should own a piece store");
+  ASSERT_NOT_NULL (buffer.head->pt, "Loaded lines should use pieces");
+  ASSERT_NULL (buffer.head->gb, "Loaded lines should have no gap buffer");
+
+  char *content = line_to_string (buffer.tail);
+  ASSERT_STR_EQ ("last", content, "Line without newline should be loaded");
+  free (content);
+
+  Line *second = buffer.head->next;
+  line_insert_char_at (second, 0, '2');
+  line_delete_char_at (second, 1);
+  content = line_to_string (second);
+  ASSERT_STR_EQ ("2econd", content, "Piece-table lines should be editable");
+  free (content);
+
+  line_truncate (second, 1);
+  ASSERT_EQ (1, line_get_length (second), "Truncate should shorten line");
+
+  saveToFile (filename, &buffer);
+  free_editor_buffer (&buffer);
+  ASSERT_EQ (STORAGE_PIECE_TABLE, buffer.storage_mode,
+             "Storage mode should survive freeing the buffer");
+
+  init_editor_buffer (&buffer);
+  loadFromFile (filename, &buffer);
+  content = line_to_string (buffer.head->next);
+  ASSERT_STR_EQ ("2", content, "Edits should be saved");
+  free (content);
+  free_editor_buffer (&buffer);
+
+  remove (filename);
+}
+
+void
+run_piece_table_tests (void)
+{
+  TEST_SUITE_START ("Piece Table Tests");
+
+  test_piece_table_creation ();
+  test_piece_table_insert ();
+  test_piece_table_delete ();
+  test_piece_table_delete_range ();
+  test_piece_table_spans ();
+  test_piece_table_load_from_file ();
+
+  TEST_SUITE_END ("Piece Table Tests");
+}
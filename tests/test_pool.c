@@ -0,0 +1,85 @@
+#include "pool.h"
+#include "test_framework.h"
+
+void
+test_pool_alloc_and_free (void)
+{
+  Pool pool;
+  pool_init (&pool, "test", 24);
+
+  void *first = pool_alloc (&pool);
+  void *second = pool_alloc (&pool);
+  ASSERT_NOT_NULL (first, "Pool should hand out objects");
+  ASSERT_TRUE (first != second, "Objects should be distinct");
+  ASSERT_EQ (2, pool.objects_in_use, "Pool should count objects in use");
+  ASSERT_EQ (1, pool.num_chunks, "Objects should share one chunk");
+
+  pool_free (&pool, first);
+  ASSERT_EQ (1, pool.objects_in_use, "Freeing should decrement usage");
+  ASSERT_TRUE (pool_alloc (&pool) == first,
+               "Freed objects should be reused first");
+
+  pool_release (&pool);
+}
+
+void
+test_pool_growth (void)
+{
+  Pool pool;
+  pool_init (&pool, "growth", 64);
+
+  size_t count = 3 * POOL_CHUNK_SIZE / 64;
+  for (size_t i = 0; i < count; i++)
+    {
+      char *object = pool_alloc (&pool);
+      memset (object, 0xAB, 64);
+    }
+
+  ASSERT_EQ (count, pool.objects_in_use, "All objects should be in use");
+  ASSERT_TRUE (pool.num_chunks >= 3, "Pool should allocate more chunks");
+
+  PoolStats stats;
+  pool_get_stats (&pool, &stats);
+  ASSERT_EQ (count, stats.objects_in_use, "Stats should report usage");
+  ASSERT_TRUE (stats.objects_reserved >= count,
+               "Stats should report reserved capacity");
+  ASSERT_EQ (pool.num_chunks * POOL_CHUNK_SIZE, stats.bytes_reserved,
+             "Stats should report reserved bytes");
+
+  pool_release (&pool);
+  ASSERT_EQ (0, pool.num_chunks, "Release should drop all chunks");
+}
+
+void
+test_pool_blocks (void)
+{
+  size_t size = 20;
+  char *block = pool_alloc_block (&size);
+  ASSERT_NOT_NULL (block, "Small block should be allocated");
+  ASSERT_EQ (32, size, "Small block should be rounded to its size class");
+  memset (block, 'x', size);
+  pool_free_block (block, size);
+
+  size = 1000;
+  block = pool_alloc_block (&size);
+  ASSERT_NOT_NULL (block, "Large block should be allocated");
+  ASSERT_EQ (1000, size, "Large block should keep its size");
+  pool_free_block (block, size);
+
+  char summary[256];
+  pool_format_stats (summary, sizeof (summary));
+  ASSERT_TRUE (strstr (summary, "text32") != NULL,
+               "Stats summary should list used size classes");
+}
+
+void
+run_pool_tests (void)
+{
+  TEST_SUITE_START ("Pool Allocator Tests");
+
+  test_pool_alloc_and_free ();
+  test_pool_growth ();
+  test_pool_blocks ();
+
+  TEST_SUITE_END ("Pool Allocator Tests");
+}
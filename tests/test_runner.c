@@ -4,7 +4,20 @@
 void run_data_structures_tests (void);
 void run_file_operations_tests (void);
 void run_gap_buffer_tests (void);
+void run_piece_table_tests (void);
+void run_line_index_tests (void);
+void run_buffer_iterator_tests (void);
+void run_gzip_file_tests (void);
+void run_journal_tests (void);
+void run_newline_scan_tests (void);
+void run_pager_tests (void);
+void run_pool_tests (void);
 void run_undo_tests (void);
+void run_follow_tests (void);
+void run_search_tests (void);
+void run_screen_damage_tests (void);
+void run_startup_time_tests (void);
+void run_viewer_tests (void);
 
 int
 main ()
@@ -12,9 +25,22 @@ main ()
   init_test_framework ();
 
   run_gap_buffer_tests ();
+  run_piece_table_tests ();
+  run_line_index_tests ();
+  run_buffer_iterator_tests ();
+  run_gzip_file_tests ();
+  run_newline_scan_tests ();
+  run_pager_tests ();
+  run_pool_tests ();
   run_data_structures_tests ();
   run_file_operations_tests ();
   run_undo_tests ();
+  run_journal_tests ();
+  run_follow_tests ();
+  run_search_tests ();
+  run_screen_damage_tests ();
+  run_startup_time_tests ();
+  run_viewer_tests ();
 
   print_test_summary ();
 
@@ -0,0 +1,63 @@
+#include "screen_damage.h"
+#include "test_framework.h"
+
+void
+test_screen_damage_tracks_rows (void)
+{
+  TEST_CASE_START ("Screen damage redraws only the rows that changed");
+
+  ScreenDamage damage;
+  screen_damage_init (&damage);
+
+  screen_damage_begin (&damage, 3, 1);
+  int drawn = 0;
+  for (int row = 0; row < 3; row++)
+    drawn += screen_damage_row (&damage, row, 100 + row);
+  ASSERT_EQ (3, drawn, "The first frame should draw every row");
+
+  screen_damage_begin (&damage, 3, 1);
+  ASSERT_FALSE (screen_damage_row (&damage, 0, 100),
+                "An unchanged row should not be drawn");
+  ASSERT_TRUE (screen_damage_row (&damage, 1, 999),
+               "A changed row should be drawn");
+  ASSERT_FALSE (screen_damage_row (&damage, 2, 102),
+                "Rows after a changed one should not be drawn");
+
+  screen_damage_begin (&damage, 3, 1);
+  ASSERT_FALSE (screen_damage_row (&damage, 1, 999),
+                "A row should be clean once drawn");
+  ASSERT_TRUE (screen_damage_row (&damage, 5, 0),
+               "Rows past the screen should always be drawn");
+
+  screen_damage_begin (&damage, 3, 2);
+  ASSERT_TRUE (screen_damage_row (&damage, 0, 100),
+               "New frame settings should redraw every row");
+
+  screen_damage_all (&damage);
+  screen_damage_begin (&damage, 3, 2);
+  ASSERT_TRUE (screen_damage_row (&damage, 0, 100),
+               "A forced redraw should draw every row");
+  screen_damage_begin (&damage, 3, 2);
+  ASSERT_FALSE (screen_damage_row (&damage, 0, 100),
+                "A forced redraw should last one frame");
+
+  screen_damage_begin (&damage, 4, 2);
+  ASSERT_TRUE (screen_damage_row (&damage, 0, 100),
+               "A resized screen should redraw every row");
+
+  ASSERT_TRUE (screen_hash (SCREEN_HASH_SEED, "ab", 2)
+                   != screen_hash (SCREEN_HASH_SEED, "ba", 2),
+               "Signatures should depend on the order of the bytes");
+
+  screen_damage_free (&damage);
+}
+
+void
+run_screen_damage_tests (void)
+{
+  TEST_SUITE_START ("Screen Damage Tests");
+
+  test_screen_damage_tracks_rows ();
+
+  TEST_SUITE_END ("Screen Damage Tests");
+}
@@ -0,0 +1,123 @@
+#include "data_structures.h"
+#include "line_index.h"
+#include "search.h"
+#include "test_framework.h"
+#include "text_editor_functions.h"
+
+#define TEST_SEARCH_FILENAME "test_search.txt"
+
+static void
+fill_buffer (TextBuffer *buffer, const char *const *lines, size_t count)
+{
+  init_editor_buffer (buffer);
+  for (size_t i = 0; i < count; i++)
+    {
+      insert_line_at_end (buffer, create_new_line (lines[i]));
+    }
+}
+
+void
+test_search_buffer_both_ways (void)
+{
+  TEST_CASE_START ("Search streams the buffer in both directions");
+
+  const char *lines[] = { "alpha beta", "Gamma", "beta end" };
+  TextBuffer buffer;
+  fill_buffer (&buffer, lines, 3);
+  Line *first = buffer.head;
+  Line *last = buffer.tail;
+
+  Line *line;
+  size_t col;
+  ASSERT_TRUE (search_buffer (&buffer, "beta", 1, first, 6, 1, &line, &col),
+               "Forward search should find the next match");
+  ASSERT_TRUE (line == last && col == 0, "It should skip the one at the "
+                                         "cursor");
+  ASSERT_TRUE (search_buffer (&buffer, "beta", 1, last, 0, 1, &line, &col),
+               "Forward search should wrap around");
+  ASSERT_TRUE (line == first && col == 6, "It should wrap to the start");
+
+  ASSERT_FALSE (search_buffer (&buffer, "gamma", 1, first, 0, 1, &line,
+                               &col),
+                "Case sensitive search should miss Gamma");
+  ASSERT_TRUE (search_buffer (&buffer, "gamma", 0, first, 0, 1, &line, &col),
+               "Search should ignore case when asked");
+  ASSERT_TRUE (line == first->next && col == 0, "Gamma should be found");
+
+  ASSERT_TRUE (search_buffer (&buffer, "beta", 1, last, 0, 0, &line, &col),
+               "Backward search should find the match before");
+  ASSERT_TRUE (line == first && col == 6, "It should be on the first line");
+  ASSERT_TRUE (search_buffer (&buffer, "beta", 1, first, 6, 0, &line, &col),
+               "Backward search should wrap around");
+  ASSERT_TRUE (line == last && col == 0, "It should wrap to the end");
+
+  ASSERT_TRUE (search_buffer (&buffer, "beta\nGam", 1, last, 0, 1, &line,
+                              &col),
+               "A match may span lines");
+  ASSERT_TRUE (line == first && col == 6, "It should start on the first");
+  ASSERT_TRUE (search_buffer (&buffer, "ma\nbeta", 1, last, 3, 0, &line,
+                              &col),
+               "A match may span lines backward too");
+  ASSERT_TRUE (line == first->next && col == 3, "It should end on the last");
+
+  free_editor_buffer (&buffer);
+}
+
+void
+test_search_across_pieces (void)
+{
+  TEST_CASE_START ("Search reads piece tables without flattening them");
+
+  FILE *file = fopen (TEST_SEARCH_FILENAME, "w");
+  // More lines than a forward search splits at a time
+  for (int i = 0; i < 100000; i++)
+    {
+      fprintf (file, "line %d of the file\n", i);
+    }
+  fclose (file);
+
+  TextBuffer buffer;
+  init_editor_buffer (&buffer);
+  buffer.storage_mode = STORAGE_PIECE_TABLE;
+  buffer.lazy_load = 1;
+  loadFromFile (TEST_SEARCH_FILENAME, &buffer);
+  buffer_ensure_lines (&buffer, 5);
+
+  Line *line = buffer.head;
+  line_insert_string_at (line, 5, "NEEDLE");
+  size_t pieces = line->pt->num_pieces;
+  size_t add_length = buffer.store->add_length;
+
+  Line *match_line;
+  size_t col;
+  ASSERT_TRUE (search_buffer (&buffer, "line NEEDLE0 of", 1, line->next, 0,
+                              0, &match_line, &col),
+               "A match across pieces should be found");
+  ASSERT_TRUE (match_line == line && col == 0, "It should start before the "
+                                               "insert");
+  ASSERT_EQ (pieces, line->pt->num_pieces, "The line should stay in pieces");
+  ASSERT_EQ (add_length, buffer.store->add_length,
+             "Nothing should be copied to the add buffer");
+
+  ASSERT_TRUE (search_buffer (&buffer, "line 150 ", 1, buffer.head, 0, 1,
+                              &match_line, &col),
+               "Forward search should split a lazy file as it goes");
+  ASSERT_EQ (150, line_index_position (match_line),
+             "The match should be on its line");
+  ASSERT_FALSE (buffer_is_loaded (&buffer),
+                "Lines past the match should stay unsplit");
+
+  free_editor_buffer (&buffer);
+  remove (TEST_SEARCH_FILENAME);
+}
+
+void
+run_search_tests (void)
+{
+  TEST_SUITE_START ("Search Tests");
+
+  test_search_buffer_both_ways ();
+  test_search_across_pieces ();
+
+  TEST_SUITE_END ("Search Tests");
+}
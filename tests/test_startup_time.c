@@ -0,0 +1,55 @@
+#include "startup_time.h"
+#include "test_framework.h"
+
+#define TEST_STARTUP_TIME_FILENAME "test_startup_time.txt"
+
+void
+test_startup_time_report (void)
+{
+  TEST_CASE_START ("Startup time report lists each step once");
+
+  startup_time_mark ("before open");
+  ASSERT_EQ (0, startup_time_open (TEST_STARTUP_TIME_FILENAME),
+             "Report should be created");
+  startup_time_mark ("initscr");
+  startup_time_finish ("first frame");
+  startup_time_mark ("after finish");
+  startup_time_finish ("second frame");
+
+  FILE *file = fopen (TEST_STARTUP_TIME_FILENAME, "r");
+  ASSERT_NOT_NULL (file, "Report should be readable");
+
+  char line[256];
+  const char *events[] = { "--- ben starting ---", "initscr", "first frame" };
+  int lines = 0;
+  while (fgets (line, sizeof (line), file))
+    {
+      lines++;
+      if (lines <= 2)
+        continue;
+
+      double clock, self;
+      char event[64];
+      ASSERT_EQ (3, sscanf (line, "%lf %lf: %63[^\n]", &clock, &self, event),
+                 "Each step should have both times and its name");
+      ASSERT_TRUE (self >= 0 && self <= clock,
+                   "Time since the last step should be within the total");
+      if (lines - 3 < 3)
+        ASSERT_STR_EQ (events[lines - 3], event,
+                       "Steps should be listed in order");
+    }
+  fclose (file);
+  ASSERT_EQ (5, lines, "Marks outside the report should be ignored");
+
+  remove (TEST_STARTUP_TIME_FILENAME);
+}
+
+void
+run_startup_time_tests (void)
+{
+  TEST_SUITE_START ("Startup Time Tests");
+
+  test_startup_time_report ();
+
+  TEST_SUITE_END ("Startup Time Tests");
+}
@@ -143,18 +143,8 @@ test_undo_merge_lines (void)
   line_insert_string_at (first_line, line_get_length (first_line),
                          second_content);
 
-  first_line->next = second_line->next;
-  if (second_line->next)
-    {
-      second_line->next->prev = first_line;
-    }
-  else
-    {
-      buffer.tail = first_line;
-    }
-  gap_buffer_destroy (second_line->gb);
-  free (second_line);
-  buffer.num_lines--;
+  remove_line (&buffer, second_line);
+  free_line (second_line);
 
   ASSERT_EQ (1, buffer.num_lines, "Should Have 1 Line After Merge");
 
@@ -0,0 +1,104 @@
+#include "test_framework.h"
+#include "viewer.h"
+
+#define TEST_VIEWER_FILENAME "test_viewer.txt"
+
+void
+test_viewer_finds_lines (void)
+{
+  TEST_CASE_START ("Viewer finds lines through a sparse index");
+
+  FILE *file = fopen (TEST_VIEWER_FILENAME, "w");
+  for (int i = 0; i < 1000; i++)
+    {
+      fprintf (file, "entry %d\n", i);
+    }
+  fprintf (file, "no newline");
+  fclose (file);
+
+  Viewer viewer;
+  ASSERT_EQ (0, viewer_open (&viewer, TEST_VIEWER_FILENAME),
+             "Viewer should map the file");
+
+  size_t length;
+  const char *text = viewer_line (&viewer, 0, &length);
+  ASSERT_TRUE (length == 7 && memcmp (text, "entry 0", 7) == 0,
+               "First line should be read from the mapping");
+  ASSERT_FALSE (viewer.complete, "Only the lines needed should be indexed");
+
+  text = viewer_line (&viewer, 777, &length);
+  ASSERT_TRUE (length == 9 && memcmp (text, "entry 777", 9) == 0,
+               "Line between index entries should be found");
+  ASSERT_TRUE (viewer.num_checkpoints < 20,
+               "Index should hold one entry per stride of lines");
+
+  ASSERT_EQ (1001, viewer_count_lines (&viewer),
+             "Counting should reach the unterminated last line");
+  text = viewer_line (&viewer, 1000, &length);
+  ASSERT_TRUE (length == 10 && memcmp (text, "no newline", 10) == 0,
+               "Last line should end at the end of the file");
+  ASSERT_NULL (viewer_line (&viewer, 1001, &length),
+               "There should be no line past the end");
+
+  size_t offset = viewer_line (&viewer, 640, &length) - viewer.data + 3;
+  ASSERT_EQ (640, viewer_line_of_offset (&viewer, offset),
+             "Offset should map back to its line");
+
+  viewer_close (&viewer);
+  remove (TEST_VIEWER_FILENAME);
+}
+
+void
+test_viewer_search (void)
+{
+  TEST_CASE_START ("Viewer searches the mapping in both directions");
+
+  FILE *file = fopen (TEST_VIEWER_FILENAME, "w");
+  fprintf (file, "alpha\nBeta\ngamma beta\n");
+  fclose (file);
+
+  Viewer viewer;
+  viewer_open (&viewer, TEST_VIEWER_FILENAME);
+
+  size_t match;
+  ASSERT_TRUE (viewer_find (&viewer, "beta", 0, 1, &match),
+               "Forward search should find a match");
+  ASSERT_EQ (6, match, "Search should ignore case by default");
+
+  viewer.case_sensitive = 1;
+  ASSERT_TRUE (viewer_find (&viewer, "beta", 0, 1, &match),
+               "Case sensitive search should find a match");
+  ASSERT_EQ (17, match, "Case sensitive search should skip Beta");
+  ASSERT_TRUE (viewer_find (&viewer, "alpha", 1, 1, &match) && match == 0,
+               "Forward search should wrap around the end");
+  ASSERT_TRUE (viewer_find (&viewer, "gamma", 0, 0, &match) && match == 11,
+               "Backward search should wrap around the start");
+  ASSERT_FALSE (viewer_find (&viewer, "delta", 0, 1, &match),
+                "Missing term should not be found");
+
+  viewer_close (&viewer);
+
+  file = fopen (TEST_VIEWER_FILENAME, "w");
+  fclose (file);
+  ASSERT_EQ (0, viewer_open (&viewer, TEST_VIEWER_FILENAME),
+             "Empty file should open");
+  size_t length;
+  ASSERT_NOT_NULL (viewer_line (&viewer, 0, &length),
+                   "Empty file should show one line");
+  ASSERT_EQ (1, viewer_count_lines (&viewer),
+             "Empty file should have one line");
+  viewer_close (&viewer);
+
+  remove (TEST_VIEWER_FILENAME);
+}
+
+void
+run_viewer_tests (void)
+{
+  TEST_SUITE_START ("Viewer Tests");
+
+  test_viewer_finds_lines ();
+  test_viewer_search ();
+
+  TEST_SUITE_END ("Viewer Tests");
+}